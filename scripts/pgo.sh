@@ -0,0 +1,80 @@
+#!/bin/sh -e
+
+# Builds with profile-guided optimization, and reports the speedup over the
+# plain release build.
+#
+#   1. Instrumented build in build-pgo, with CHESS_PGO=generate.
+#   2. Training run of chess_train, which writes the profiles.
+#   3. Optimized build in the same directory, with CHESS_PGO=use. The object
+#      paths must stay the same for the profiles to be found.
+#   4. Release build in build-release, and timing of chess_train in both.
+#
+# Requires the dependencies installed by bootstrap.sh. Optional variables:
+#   chess_PGO_TRAIN_ARGS: arguments of the training run, such as PGN files
+#   chess_PGO_RUNS:       number of timed runs of each build, the best is kept
+
+if [ -z $chess_root_dir ]; then
+    echo "Error: variable chess_root_dir needs to be specified"
+    exit 1
+fi
+
+# Set directories
+pgo_build_dir="$chess_root_dir/build-pgo"
+release_build_dir="$chess_root_dir/build-release"
+profile_dir="$pgo_build_dir/pgo"
+
+# Set variables
+chess_vcpkg_cmake_toolchain="$chess_root_dir/scripts/.build/vcpkg/scripts/buildsystems/vcpkg.cmake"
+num_runs=${chess_PGO_RUNS:-3}
+num_jobs=$(nproc 2>/dev/null || sysctl -n hw.ncpu 2>/dev/null || echo 4)
+
+# Configure and build all targets
+cmake_build() {
+    build_dir=$1
+    shift
+    cmake -S "$chess_root_dir" -B "$build_dir" \
+        -DCMAKE_BUILD_TYPE=Release \
+        "-DCMAKE_TOOLCHAIN_FILE=$chess_vcpkg_cmake_toolchain" \
+        "$@"
+    cmake --build "$build_dir" -j "$num_jobs"
+}
+
+# Prints the best total time of the training workload, in seconds
+time_train() {
+    train=$1
+    best=
+    i=0
+    while [ $i -lt $num_runs ]; do
+        t=$("$train" $chess_PGO_TRAIN_ARGS | awk '$1 == "total" { print $2 }')
+        if [ -z "$best" ] || awk "BEGIN { exit !($t < $best) }"; then
+            best=$t
+        fi
+        i=$((i + 1))
+    done
+    echo $best
+}
+
+echo "Building instrumented binaries..."
+rm -rf "$profile_dir"
+cmake_build "$pgo_build_dir" -DCHESS_PGO=generate "-DCHESS_PGO_DIR=$profile_dir"
+
+echo "Training..."
+"$pgo_build_dir/chess_train" $chess_PGO_TRAIN_ARGS
+
+# Clang writes raw profiles, which are merged for the optimized build
+if ls "$profile_dir"/*.profraw >/dev/null 2>&1; then
+    llvm-profdata merge -output="$profile_dir/chess.profdata" "$profile_dir"/*.profraw
+fi
+
+echo "Building optimized binaries..."
+cmake_build "$pgo_build_dir" -DCHESS_PGO=use "-DCHESS_PGO_DIR=$profile_dir"
+
+echo "Building release binaries for comparison..."
+cmake_build "$release_build_dir" -DCHESS_PGO=
+
+echo "Timing the training workload, best of $num_runs runs..."
+release_time=$(time_train "$release_build_dir/chess_train")
+pgo_time=$(time_train "$pgo_build_dir/chess_train")
+awk -v r="$release_time" -v p="$pgo_time" 'BEGIN {
+    printf "release %.3f s, pgo %.3f s, speedup %.2fx\n", r, p, r / p
+}'
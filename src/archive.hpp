@@ -0,0 +1,265 @@
+#ifndef CHESS_ARCHIVE_HPP
+#define CHESS_ARCHIVE_HPP
+
+#include <algorithm> // sort, lower_bound, equal_range
+#include <cstdint>
+#include <cstdio>
+#include <cstring> // memcmp
+#include <optional>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <tuple> // tie
+#include <type_traits>
+#include <vector>
+
+#include "chess/operation.hpp"
+#include "mapped_file.hpp"
+
+namespace chess {
+
+//-----------------------------------------------------------------------------
+// Archive of finished games.
+//
+// The archive is a single file of fixed-size records in columns, intended to
+// be memory-mapped read-only and queried in place without deserialization.
+//
+// Layout (native byte order, every section aligned to 8 bytes):
+//   - ArchiveHeader
+//   - ArchiveGameRecord[num_games], sorted by game id
+//   - PackedOperation[num_plies], the operations of all games
+//   - uint8_t[num_plies], code2 (draw flags) of the operations
+//   - HashInt[num_positions], hash of every position of all games, including
+//     the opening position. Game i with n plies has n + 1 positions.
+//   - ArchivePositionEntry[num_positions], sorted by (hash, game, ply)
+//
+// Hashes are computed with standard_zobrist_table(), so that they can be
+// compared with positions from other games and processes.
+//-----------------------------------------------------------------------------
+
+struct ArchiveHeader {
+    inline static constexpr char          magic_value[8] { 'C', 'H', 'E', 'S', 'S', 'A', 'R', 'C' };
+    inline static constexpr std::uint32_t current_version = 1;
+
+    char          magic[8] {};
+    std::uint32_t version = current_version;
+    std::uint32_t reserved = 0;
+    std::uint64_t zobrist_seed = standard_zobrist_seed;
+    std::uint64_t num_games = 0;
+    std::uint64_t num_plies = 0;
+    std::uint64_t num_positions = 0;
+};
+
+struct ArchiveGameRecord {
+    std::uint64_t game_id = 0;
+    // Index of the first operation in the operation column.
+    std::uint64_t first_ply = 0;
+    // Index of the first position in the hash column.
+    std::uint64_t first_position = 0;
+    std::uint32_t num_plies = 0;
+    // Underlying value of GameState::Status.
+    std::uint8_t  result = 0;
+    std::uint8_t  reserved[3] {};
+};
+
+struct ArchivePositionEntry {
+    BoardStateZobristTable::HashInt hash = 0;
+    std::uint32_t                   game_index = 0;
+    // Number of operations made before the position.
+    std::uint32_t                   ply = 0;
+};
+
+constexpr std::uint64_t archive_align(std::uint64_t offset) { return (offset + 7) / 8 * 8; }
+
+// Input of archive writing.
+struct ArchiveInputGame {
+    std::uint64_t      game_id = 0;
+    const GameHistory* p_game_history = nullptr;
+};
+
+// Writes games into an archive file. Game ids should be unique.
+inline void write_game_archive(const std::string& path, std::vector< ArchiveInputGame > games) {
+    using HashInt = BoardStateZobristTable::HashInt;
+
+    std::sort(games.begin(), games.end(), [](const auto& a, const auto& b) { return a.game_id < b.game_id; });
+
+    const auto& table = standard_zobrist_table();
+
+    ArchiveHeader header;
+    std::memcpy(header.magic, ArchiveHeader::magic_value, sizeof(header.magic));
+
+    std::vector< ArchiveGameRecord >    game_records;
+    std::vector< PackedOperation >      ops;
+    std::vector< std::uint8_t >         op_code2s;
+    std::vector< HashInt >              hashes;
+    std::vector< ArchivePositionEntry > entries;
+    game_records.reserve(games.size());
+
+    for(std::uint32_t gi = 0; gi < games.size(); ++gi) {
+        const auto  history = games[gi].p_game_history->current_items();
+
+        ArchiveGameRecord record;
+        record.game_id = games[gi].game_id;
+        record.first_ply = ops.size();
+        record.first_position = hashes.size();
+        record.num_plies = history.size() - 1;
+        record.result = underlying(history.back().game_state.status);
+        game_records.push_back(record);
+
+        for(std::uint32_t ply = 0; ply < history.size(); ++ply) {
+            // The first item holds no operation.
+            if(ply > 0) {
+                ops.push_back(pack_operation(history[ply].op));
+                op_code2s.push_back(history[ply].op.code2);
+            }
+
+            const auto h = hash(history[ply].game_state.board_state, table);
+            hashes.push_back(h);
+            entries.push_back({ h, gi, ply });
+        }
+    }
+    std::sort(entries.begin(), entries.end(), [](const auto& a, const auto& b) {
+        return std::tie(a.hash, a.game_index, a.ply) < std::tie(b.hash, b.game_index, b.ply);
+    });
+
+    header.num_games = game_records.size();
+    header.num_plies = ops.size();
+    header.num_positions = hashes.size();
+
+    std::FILE* file = std::fopen(path.c_str(), "wb");
+    if(!file) {
+        throw std::runtime_error("Cannot open archive " + path);
+    }
+    std::uint64_t offset = 0;
+    const auto write_section = [&](const void* data, std::size_t bytes) {
+        const char padding[8] {};
+        std::fwrite(padding, 1, archive_align(offset) - offset, file);
+        offset = archive_align(offset);
+        std::fwrite(data, 1, bytes, file);
+        offset += bytes;
+    };
+    write_section(&header, sizeof(header));
+    write_section(game_records.data(), game_records.size() * sizeof(ArchiveGameRecord));
+    write_section(ops.data(), ops.size() * sizeof(PackedOperation));
+    write_section(op_code2s.data(), op_code2s.size());
+    write_section(hashes.data(), hashes.size() * sizeof(HashInt));
+    write_section(entries.data(), entries.size() * sizeof(ArchivePositionEntry));
+
+    const bool failed = std::ferror(file);
+    std::fclose(file);
+    if(failed) {
+        throw std::runtime_error("Cannot write archive " + path);
+    }
+}
+
+// Read-only memory-mapped archive.
+struct GameArchive {
+    using HashInt = BoardStateZobristTable::HashInt;
+
+    // A game in the archive, referring to the mapped memory.
+    struct GameView {
+        const ArchiveGameRecord*          p_record = nullptr;
+        std::span< const PackedOperation > ops;
+        std::span< const std::uint8_t >   op_code2s;
+        // Has one more item than ops.
+        std::span< const HashInt >        hashes;
+
+        auto result() const { return static_cast< GameState::Status >(p_record->result); }
+    };
+
+    MappedFile                               file;
+    const ArchiveHeader*                     p_header = nullptr;
+    std::span< const ArchiveGameRecord >     games;
+    std::span< const PackedOperation >       ops;
+    std::span< const std::uint8_t >          op_code2s;
+    std::span< const HashInt >               hashes;
+    std::span< const ArchivePositionEntry >  positions;
+
+    explicit GameArchive(const std::string& path) : file(path) {
+        p_header = file.view_as< ArchiveHeader >(0);
+        if(!p_header || std::memcmp(p_header->magic, ArchiveHeader::magic_value, sizeof(p_header->magic)) != 0) {
+            throw std::runtime_error("Not a game archive: " + path);
+        }
+        if(p_header->version != ArchiveHeader::current_version || p_header->zobrist_seed != standard_zobrist_seed) {
+            throw std::runtime_error("Incompatible game archive: " + path);
+        }
+
+        std::uint64_t offset = 0;
+        const auto map_section = [&]< typename T >(std::span< const T >& section, std::uint64_t count) {
+            offset = archive_align(offset);
+            const T* p = file.view_as< T >(offset, count);
+            if(!p) {
+                throw std::runtime_error("Truncated game archive: " + path);
+            }
+            section = { p, count };
+            offset += count * sizeof(T);
+        };
+        offset = sizeof(ArchiveHeader);
+        map_section(games, p_header->num_games);
+        map_section(ops, p_header->num_plies);
+        map_section(op_code2s, p_header->num_plies);
+        map_section(hashes, p_header->num_positions);
+        map_section(positions, p_header->num_positions);
+    }
+
+    GameView game_at(std::size_t index) const {
+        const auto& r = games[index];
+        return {
+            &r,
+            ops.subspan(r.first_ply, r.num_plies),
+            op_code2s.subspan(r.first_ply, r.num_plies),
+            hashes.subspan(r.first_position, r.num_plies + 1)
+        };
+    }
+
+    // Returns null if the game is not found.
+    std::optional< GameView > find_game(std::uint64_t game_id) const {
+        const auto it = std::lower_bound(games.begin(), games.end(), game_id, [](const ArchiveGameRecord& r, std::uint64_t id) { return r.game_id < id; });
+        if(it == games.end() || it->game_id != game_id) return {};
+        return game_at(it - games.begin());
+    }
+
+    // All occurrences of a position, sorted by game index and ply.
+    std::span< const ArchivePositionEntry > find_position(HashInt position_hash) const {
+        const auto [first, last] = std::equal_range(
+            positions.begin(), positions.end(), position_hash,
+            [](const auto& a, const auto& b) {
+                if constexpr(std::is_same_v< std::decay_t< decltype(a) >, HashInt >) return a < b.hash;
+                else return a.hash < b;
+            }
+        );
+        return { first, last };
+    }
+
+    // Calls func(GameView, ply) once for every game that reached the position,
+    // at the first ply reaching it.
+    template< typename Func >
+    void for_each_game_reaching(HashInt position_hash, Func&& func) const {
+        const auto entries = find_position(position_hash);
+        for(std::size_t i = 0; i < entries.size(); ++i) {
+            if(i == 0 || entries[i].game_index != entries[i - 1].game_index) {
+                func(game_at(entries[i].game_index), entries[i].ply);
+            }
+        }
+    }
+
+    // Reconstructs the game history by replaying the operations.
+    GameHistory load_game_history(const GameView& game) const {
+        GameHistory gh;
+        for(std::size_t i = 0; i < game.ops.size(); ++i) {
+            const auto op = unpack_operation(game.ops[i], game.op_code2s[i]);
+            if(i + 1 < game.ops.size()) {
+                game_round_trusted(gh, op);
+            }
+            else {
+                std::ostream null_os(nullptr);
+                game_round(gh, op, null_os);
+            }
+        }
+        return gh;
+    }
+};
+
+} // namespace chess
+
+#endif
@@ -0,0 +1,179 @@
+#ifndef CHESS_BOOK_HPP
+#define CHESS_BOOK_HPP
+
+#include <algorithm> // clamp, lower_bound, sort
+#include <bit> // bit_width
+#include <cstdint>
+#include <cstdio>
+#include <cstring> // memcmp, memcpy
+#include <limits>
+#include <optional>
+#include <random>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "chess/operation.hpp"
+#include "mapped_file.hpp"
+
+namespace chess {
+
+//-----------------------------------------------------------------------------
+// Opening book.
+//
+// The book is a file of fixed-size entries sorted by position hash, in the
+// manner of Polyglot books, memory-mapped read-only and shared by all games
+// and threads. Position hashes are computed with standard_zobrist_table().
+//
+// Layout (native byte order):
+//   - OpeningBookHeader
+//   - OpeningBookEntry[num_entries], sorted by hash, then by weight in
+//     descending order
+//-----------------------------------------------------------------------------
+
+struct OpeningBookHeader {
+    inline static constexpr char          magic_value[8] { 'C', 'H', 'E', 'S', 'S', 'B', 'O', 'K' };
+    inline static constexpr std::uint32_t current_version = 1;
+
+    char          magic[8] {};
+    std::uint32_t version = current_version;
+    std::uint32_t reserved = 0;
+    std::uint64_t zobrist_seed = standard_zobrist_seed;
+    std::uint64_t num_entries = 0;
+};
+
+struct OpeningBookEntry {
+    BoardStateZobristTable::HashInt hash = 0;
+    PackedOperation                 op = 0;
+    // Relative preference among the moves of the position.
+    std::uint16_t                   weight = 0;
+    // Number of games the move was played in, saturated.
+    std::uint32_t                   num_games = 0;
+};
+static_assert(sizeof(OpeningBookEntry) == 16);
+
+// Writes a book. Entries are sorted before writing.
+inline void write_opening_book(const std::string& path, std::vector< OpeningBookEntry > entries) {
+    std::sort(entries.begin(), entries.end(), [](const auto& a, const auto& b) {
+        return a.hash != b.hash ? a.hash < b.hash : a.weight > b.weight;
+    });
+
+    OpeningBookHeader header;
+    std::memcpy(header.magic, OpeningBookHeader::magic_value, sizeof(header.magic));
+    header.num_entries = entries.size();
+
+    std::FILE* file = std::fopen(path.c_str(), "wb");
+    if(!file) {
+        throw std::runtime_error("Cannot open book " + path);
+    }
+    std::fwrite(&header, sizeof(header), 1, file);
+    std::fwrite(entries.data(), sizeof(OpeningBookEntry), entries.size(), file);
+    const bool failed = std::ferror(file);
+    std::fclose(file);
+    if(failed) {
+        throw std::runtime_error("Cannot write book " + path);
+    }
+}
+
+// Read-only memory-mapped book.
+struct OpeningBook {
+    using HashInt = BoardStateZobristTable::HashInt;
+
+    MappedFile                          file;
+    std::span< const OpeningBookEntry > entries;
+
+    // Hashes are uniformly distributed, so the entries are split into buckets
+    // by the leading bits of the hash, with about 8 entries in each bucket.
+    // A lookup then touches the index and a few cache lines of entries,
+    // rather than log2(n) cache lines of a plain binary search.
+    //
+    // Bucket i holds entries [bucket_index[i], bucket_index[i + 1]).
+    int                                 index_shift = 64;
+    std::vector< std::uint32_t >        bucket_index;
+
+    explicit OpeningBook(const std::string& path) : file(path) {
+        const auto p_header = file.view_as< OpeningBookHeader >(0);
+        if(!p_header || std::memcmp(p_header->magic, OpeningBookHeader::magic_value, sizeof(p_header->magic)) != 0) {
+            throw std::runtime_error("Not an opening book: " + path);
+        }
+        if(p_header->version != OpeningBookHeader::current_version || p_header->zobrist_seed != standard_zobrist_seed) {
+            throw std::runtime_error("Incompatible opening book: " + path);
+        }
+        const auto p_entries = file.view_as< OpeningBookEntry >(sizeof(OpeningBookHeader), p_header->num_entries);
+        if(!p_entries) {
+            throw std::runtime_error("Truncated opening book: " + path);
+        }
+        if(p_header->num_entries > std::numeric_limits< std::uint32_t >::max()) {
+            throw std::runtime_error("Too many entries in opening book: " + path);
+        }
+        entries = { p_entries, p_header->num_entries };
+
+        const int index_bits = std::clamp(static_cast< int >(std::bit_width(entries.size() / 8)), 0, 24);
+        index_shift = 64 - index_bits;
+        const std::size_t num_buckets = std::size_t(1) << index_bits;
+        bucket_index.resize(num_buckets + 1);
+        std::size_t e = 0;
+        for(std::size_t bucket = 0; bucket < num_buckets; ++bucket) {
+            bucket_index[bucket] = e;
+            while(e < entries.size() && (index_shift < 64 ? entries[e].hash >> index_shift : 0) == bucket) ++e;
+        }
+        bucket_index[num_buckets] = e;
+    }
+
+    // All entries of a position, by weight in descending order.
+    std::span< const OpeningBookEntry > find(HashInt position_hash) const {
+        // Narrow down by the bucket index, then binary search in the bucket.
+        const auto bucket = index_shift < 64 ? position_hash >> index_shift : 0;
+        const auto bucket_begin = entries.begin() + bucket_index[bucket];
+        const auto bucket_end   = entries.begin() + bucket_index[bucket + 1];
+
+        const auto first = std::lower_bound(bucket_begin, bucket_end, position_hash, [](const OpeningBookEntry& e, HashInt h) { return e.hash < h; });
+        auto last = first;
+        while(last != bucket_end && last->hash == position_hash) ++last;
+        return { first, last };
+    }
+
+    std::span< const OpeningBookEntry > find(const GameState& game_state) const {
+        return find(hash(game_state.board_state, standard_zobrist_table()));
+    }
+
+    // Picks a legal book move at random, with probability proportional to its
+    // weight. Returns empty if the position has no legal book move.
+    //
+    // Entries of illegal moves, from hash collisions, are skipped.
+    template< typename Rng >
+    std::optional< Operation > pick(const GameState& game_state, Rng& rng) const {
+        const auto found = find(game_state);
+        const auto is_legal = [&](const OpeningBookEntry& e) { return e.weight > 0 && is_operation_legal(game_state, unpack_operation(e.op)); };
+
+        std::uint64_t total = 0;
+        for(const auto& e : found) {
+            if(is_legal(e)) total += e.weight;
+        }
+        if(total == 0) return {};
+
+        auto r = std::uniform_int_distribution< std::uint64_t >(0, total - 1)(rng);
+        for(const auto& e : found) {
+            if(!is_legal(e)) continue;
+            if(r < e.weight) return unpack_operation(e.op);
+            r -= e.weight;
+        }
+        return {};
+    }
+
+    // The legal book move of the highest weight. Moves of zero weight are
+    // never chosen.
+    std::optional< Operation > best(const GameState& game_state) const {
+        for(const auto& e : find(game_state)) {
+            if(e.weight == 0) break;
+            const auto op = unpack_operation(e.op);
+            if(is_operation_legal(game_state, op)) return op;
+        }
+        return {};
+    }
+};
+
+} // namespace chess
+
+#endif
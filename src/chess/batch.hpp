@@ -0,0 +1,192 @@
+#ifndef CHESS_CHESS_BATCH_HPP
+#define CHESS_CHESS_BATCH_HPP
+
+#include <algorithm> // max, min
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <stdexcept>
+#include <thread>
+#include <type_traits>
+
+#include "chess/operation.hpp"
+#include "worker_pool.hpp"
+
+namespace chess {
+
+//-----------------------------------------------------------------------------
+// Batch operation validation.
+//
+// Validates many independent (position, operation) pairs at once, for offline
+// workloads. Each pair is checked as game_round checks an operation before
+// ending the game: the operation must be valid and must not leave the king
+// attacked. No game history is involved, so draw claims are not supported.
+//-----------------------------------------------------------------------------
+
+struct OperationBatchStats {
+    std::size_t num_operations = 0;
+    std::size_t num_valid = 0;
+};
+
+// Pool shared by batch validations without their own pool, with a thread for
+// each hardware thread besides the calling one. Started on first use.
+inline WorkerPool& batch_worker_pool() {
+    static WorkerPool pool(std::max(1u, std::thread::hardware_concurrency()) - 1, 256);
+    return pool;
+}
+
+// Validates ops[i] in positions[i] for each i, on the calling thread and the
+// threads of the pool. The pool must not be one running this call, as the
+// call waits for the tasks it submits.
+//
+// Outputs:
+//   - valid_bits: bit (i % 64) of word (i / 64) is set if ops[i] is valid.
+//     Must hold at least (n + 63) / 64 words.
+//   - result_hashes: the board state hash after ops[i] as in game_round,
+//     using standard_zobrist_table(), or 0 if invalid. May be empty if not
+//     needed, or otherwise must hold n hashes.
+//
+// OnError: function type with signature
+//   (std::size_t index, OperationError error) -> void
+//   It is called serially, in no particular order. Pass nullptr to skip
+//   error reporting.
+//
+// No memory is allocated, and no thread is started except by the first use
+// of batch_worker_pool().
+template< typename OnError >
+inline OperationBatchStats validate_operation_batch(
+    std::span< const PackedPosition >            positions,
+    std::span< const PackedOperation >           ops,
+    std::span< std::uint64_t >                   valid_bits,
+    std::span< BoardStateZobristTable::HashInt > result_hashes,
+    WorkerPool&                                  pool,
+    OnError&&                                    on_error
+) {
+    constexpr bool report_errors = !std::is_null_pointer_v< std::remove_cvref_t< OnError > >;
+
+    const auto n = positions.size();
+    if(ops.size() != n || valid_bits.size() < (n + 63) / 64 || (!result_hashes.empty() && result_hashes.size() != n)) {
+        throw std::invalid_argument("Batch validation spans do not match.");
+    }
+
+    const auto& table = standard_zobrist_table();
+
+    std::atomic< std::size_t > next_word { 0 };
+    std::atomic< std::size_t > num_valid { 0 };
+    std::mutex                 error_mutex;
+
+    const auto report = [&](std::size_t i, OperationError error) {
+        if constexpr(report_errors) {
+            std::lock_guard lk(error_mutex);
+            on_error(i, error);
+        }
+    };
+
+    // Returns the hash after the operation, or empty if invalid.
+    const auto validate_one = [&](std::size_t i) -> std::optional< BoardStateZobristTable::HashInt > {
+        GameState game_state;
+        if(!unpack_position(positions[i], game_state)) {
+            report(i, OperationError::invalid_position);
+            return {};
+        }
+
+        const auto op = unpack_operation(ops[i]);
+        const auto op_validation = validate_operation(game_state, op);
+        if(!op_validation.okay) {
+            report(i, op_validation.error);
+            return {};
+        }
+
+        // The hash is computed once from the final board.
+        apply_operation_in_place(game_state, 0, op, table);
+        if(game_state.status == GameState::Status::active) {
+            if(game_state.board_state.position_attacked(game_state.friend_king_x(), game_state.friend_king_y(), !game_state.board_state.black_turn)) {
+                report(i, OperationError::king_attacked);
+                return {};
+            }
+        }
+        game_state.board_state.black_turn = !game_state.board_state.black_turn;
+        return hash(game_state.board_state, table);
+    };
+
+    const auto work = [&] {
+        // Words are taken in batches, and each word of valid_bits is written
+        // by one thread only.
+        constexpr std::size_t batch_words = 16;
+        const std::size_t num_words = (n + 63) / 64;
+        std::size_t local_valid = 0;
+        while(true) {
+            const auto first_word = next_word.fetch_add(batch_words, std::memory_order_relaxed);
+            if(first_word >= num_words) break;
+            const auto last_word = std::min(first_word + batch_words, num_words);
+            for(auto w = first_word; w < last_word; ++w) {
+                std::uint64_t bits = 0;
+                const auto last = std::min(w * 64 + 64, n);
+                for(auto i = w * 64; i < last; ++i) {
+                    const auto res = validate_one(i);
+                    if(res) {
+                        bits |= std::uint64_t(1) << (i % 64);
+                        ++local_valid;
+                    }
+                    if(!result_hashes.empty()) result_hashes[i] = res.value_or(0);
+                }
+                valid_bits[w] = bits;
+            }
+        }
+        num_valid += local_valid;
+    };
+
+    // Small batches are not worth the threads. Words are taken dynamically, so
+    // helpers that start late or are not queued only leave more work to the
+    // others.
+    const auto num_helpers = std::min< std::size_t >(pool.num_threads(), std::max< std::size_t >(1, n / 4096) - 1);
+
+    std::mutex              done_mutex;
+    std::condition_variable done_cv;
+    std::size_t             num_running = 0;
+    // Notified under the lock, as the waiting call may return and destroy the
+    // condition variable as soon as the lock is released.
+    const auto help = [&] {
+        work();
+        std::scoped_lock lock(done_mutex);
+        if(--num_running == 0) done_cv.notify_one();
+    };
+    for(std::size_t t = 0; t < num_helpers; ++t) {
+        {
+            std::scoped_lock lock(done_mutex);
+            ++num_running;
+        }
+        // Captures a pointer only, which std::function stores without allocation.
+        if(!pool.try_submit([&help] { help(); })) {
+            std::scoped_lock lock(done_mutex);
+            --num_running;
+            break;
+        }
+    }
+    work();
+    {
+        std::unique_lock lock(done_mutex);
+        done_cv.wait(lock, [&] { return num_running == 0; });
+    }
+
+    return OperationBatchStats { n, num_valid.load() };
+}
+
+// Validates without error messages.
+inline OperationBatchStats validate_operation_batch(
+    std::span< const PackedPosition >            positions,
+    std::span< const PackedOperation >           ops,
+    std::span< std::uint64_t >                   valid_bits,
+    std::span< BoardStateZobristTable::HashInt > result_hashes,
+    WorkerPool&                                  pool = batch_worker_pool()
+) {
+    return validate_operation_batch(positions, ops, valid_bits, result_hashes, pool, nullptr);
+}
+
+} // namespace chess
+
+#endif
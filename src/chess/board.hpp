@@ -2,8 +2,11 @@
 #define CHESS_CHESS_BOARD_HPP
 
 #include <algorithm> // max
+#include <array>
+#include <cstddef>
 #include <cstdint>
 #include <iostream>
+#include <random>
 #include <ranges>
 #include <stdexcept>
 #include <tuple>
@@ -54,6 +57,19 @@ constexpr const char* occupation_text[] {
 };
 constexpr auto text(Occupation o) { return occupation_text[underlying(o)]; }
 
+// Piece letters regardless of color, as used in algebraic notation.
+constexpr char occupation_letter[] {
+    ' ',
+    'K', 'Q', 'R', 'B', 'N', 'P',
+    'K', 'Q', 'R', 'B', 'N', 'P'
+};
+constexpr auto letter(Occupation o) { return occupation_letter[underlying(o)]; }
+
+// Side of a piece or a player. Rules code is specialized on the side to move
+// at compile time (see ColorTraits), and dispatched once per call.
+enum class Color { white, black };
+constexpr Color opposite(Color c) { return c == Color::white ? Color::black : Color::white; }
+
 // Board state definition
 struct BoardState {
     inline static constexpr int width = 8;
@@ -123,90 +139,161 @@ struct BoardState {
     //
     // Note:
     //   - not counting en passant
+    template< Color by >
+    bool position_attacked(int x, int y) const;
     bool position_attacked(int x, int y, bool by_black) const {
-        using enum Occupation;
+        return by_black ? position_attacked< Color::black >(x, y) : position_attacked< Color::white >(x, y);
+    }
+};
 
-        if(by_black) {
-            if(
-                (is_location_valid(x-1, y+1) && (*this)(x-1, y+1) == black_pawn) ||
-                (is_location_valid(x+1, y+1) && (*this)(x+1, y+1) == black_pawn)
-            ) return true;
+//-----------------------------------------------------------------------------
+// Precomputed targets of leaper pieces
+//-----------------------------------------------------------------------------
+
+// Squares reachable from a square by fixed offsets, skipping those off the
+// board.
+struct SquareTargets {
+    int         num = 0;
+    std::int8_t squares[8] {};
+
+    constexpr const std::int8_t* begin() const { return squares; }
+    constexpr const std::int8_t* end() const { return squares + num; }
+};
+using SquareTargetTable = std::array< SquareTargets, BoardState::size >;
+
+// Targets in the order of the offsets.
+template< std::size_t n >
+constexpr SquareTargetTable make_square_target_table(const int (&offsets)[n][2]) {
+    SquareTargetTable res {};
+    for(int i = 0; i < BoardState::size; ++i) {
+        const auto [x, y] = BoardState::index_to_coord(i);
+        for(const auto& [dx, dy] : offsets) {
+            if(BoardState::is_location_valid(x + dx, y + dy)) {
+                res[i].squares[res[i].num++] = static_cast< std::int8_t >(BoardState::coord_to_index(x + dx, y + dy));
+            }
         }
-        else {
-            if(
-                (is_location_valid(x-1, y-1) && (*this)(x-1, y-1) == white_pawn) ||
-                (is_location_valid(x+1, y-1) && (*this)(x+1, y-1) == white_pawn)
-            ) return true;
+    }
+    return res;
+}
+
+// Single and double pushes of a pawn of the color. Pawns cannot stand on the
+// last rank, and the double push is only from the initial rank.
+constexpr SquareTargetTable make_pawn_push_target_table(bool black) {
+    SquareTargetTable res {};
+    const int dy = black ? -1 : 1;
+    const int initial_y = black ? BoardState::height - 2 : 1;
+    for(int i = 0; i < BoardState::size; ++i) {
+        const auto [x, y] = BoardState::index_to_coord(i);
+        if(!BoardState::is_location_valid(x, y + dy)) continue;
+        res[i].squares[res[i].num++] = static_cast< std::int8_t >(BoardState::coord_to_index(x, y + dy));
+        if(y == initial_y) {
+            res[i].squares[res[i].num++] = static_cast< std::int8_t >(BoardState::coord_to_index(x, y + 2 * dy));
         }
+    }
+    return res;
+}
+
+inline constexpr SquareTargetTable knight_targets = make_square_target_table({
+    { 2, 1 }, { 1, 2 }, { -1, 2 }, { -2, 1 }, { -2, -1 }, { -1, -2 }, { 1, -2 }, { 2, -1 },
+});
+inline constexpr SquareTargetTable king_targets = make_square_target_table({
+    { -1, -1 }, { -1, 0 }, { -1, 1 }, { 0, -1 }, { 0, 1 }, { 1, -1 }, { 1, 0 }, { 1, 1 },
+});
+// Indexed by whether the pawn is black.
+inline constexpr SquareTargetTable pawn_attack_targets[2] {
+    make_square_target_table({ { -1, 1 }, { 1, 1 } }),
+    make_square_target_table({ { -1, -1 }, { 1, -1 } }),
+};
+inline constexpr SquareTargetTable pawn_push_targets[2] {
+    make_pawn_push_target_table(false),
+    make_pawn_push_target_table(true),
+};
 
-        const auto enemy_bishop = by_black ? black_bishop : white_bishop;
-        const auto enemy_rook = by_black ? black_rook : white_rook;
-        const auto enemy_queen = by_black ? black_queen : white_queen;
-        const auto is_diag_enemy = [&](Occupation o) { return o == enemy_bishop || o == enemy_queen; };
-        const auto is_cross_enemy = [&](Occupation o) { return o == enemy_rook || o == enemy_queen; };
-
-        const auto has_enemy_dir = [&, this](int x_dir, int y_dir, auto&& pred_o) -> bool {
-            for(int step = 1; step < max_side_size; ++step) {
-                const int nx = x + step * x_dir;
-                const int ny = y + step * y_dir;
-                if(is_location_valid(nx, ny)) {
-                    const auto o = (*this)(nx, ny);
-                    if(o != Occupation::empty) {
-                        return pred_o(o);
-                    }
-                } else {
-                    // out of bound, terminate diag search
-                    return false;
+static_assert(knight_targets[0].num == 2 && knight_targets[BoardState::coord_to_index(3, 3)].num == 8);
+static_assert(king_targets[0].num == 3 && king_targets[BoardState::coord_to_index(3, 3)].num == 8);
+static_assert(pawn_push_targets[0][BoardState::coord_to_index(4, 1)].num == 2 && pawn_push_targets[1][BoardState::coord_to_index(4, 1)].num == 1);
+
+// Constants of the rules for one side.
+template< Color c >
+struct ColorTraits {
+    inline static constexpr bool       black = c == Color::black;
+
+    inline static constexpr Occupation king   = black ? Occupation::black_king   : Occupation::white_king;
+    inline static constexpr Occupation queen  = black ? Occupation::black_queen  : Occupation::white_queen;
+    inline static constexpr Occupation rook   = black ? Occupation::black_rook   : Occupation::white_rook;
+    inline static constexpr Occupation bishop = black ? Occupation::black_bishop : Occupation::white_bishop;
+    inline static constexpr Occupation knight = black ? Occupation::black_knight : Occupation::white_knight;
+    inline static constexpr Occupation pawn   = black ? Occupation::black_pawn   : Occupation::white_pawn;
+
+    // Rank of the king and the rooks before castling.
+    inline static constexpr int back_y = black ? BoardState::height - 1 : 0;
+    inline static constexpr int pawn_dy = black ? -1 : 1;
+    inline static constexpr int pawn_initial_y = back_y + pawn_dy;
+    // Rank of a pawn that can capture en passant.
+    inline static constexpr int pawn_en_passant_y = black ? 3 : 4;
+    inline static constexpr int promotion_y = black ? 0 : BoardState::height - 1;
+
+    static constexpr bool is_friend(Occupation o) { return black ? is_black_piece(o) : is_white_piece(o); }
+    static constexpr bool is_enemy(Occupation o) { return black ? is_white_piece(o) : is_black_piece(o); }
+};
+
+template< Color by >
+inline bool BoardState::position_attacked(int x, int y) const {
+    using enum Occupation;
+    using Enemy = ColorTraits< by >;
+
+    const int i = coord_to_index(x, y);
+
+    // An enemy pawn attacks the square exactly where a friendly pawn on the
+    // square would attack.
+    for(const int t : pawn_attack_targets[!Enemy::black][i]) {
+        if(board[t] == Enemy::pawn) return true;
+    }
+
+    const auto is_diag_enemy = [](Occupation o) { return o == Enemy::bishop || o == Enemy::queen; };
+    const auto is_cross_enemy = [](Occupation o) { return o == Enemy::rook || o == Enemy::queen; };
+
+    const auto has_enemy_dir = [&, this](int x_dir, int y_dir, auto&& pred_o) -> bool {
+        for(int step = 1; step < max_side_size; ++step) {
+            const int nx = x + step * x_dir;
+            const int ny = y + step * y_dir;
+            if(is_location_valid(nx, ny)) {
+                const auto o = (*this)(nx, ny);
+                if(o != Occupation::empty) {
+                    return pred_o(o);
                 }
+            } else {
+                // out of bound, terminate diag search
+                return false;
             }
-            return false;
-        };
-        if(
-            has_enemy_dir(1, 1, is_diag_enemy)
-            || has_enemy_dir(-1, 1, is_diag_enemy)
-            || has_enemy_dir(-1, -1, is_diag_enemy)
-            || has_enemy_dir(1, -1, is_diag_enemy)
-
-            || has_enemy_dir(1, 0, is_cross_enemy)
-            || has_enemy_dir(0, 1, is_cross_enemy)
-            || has_enemy_dir(-1, 0, is_cross_enemy)
-            || has_enemy_dir(0, -1, is_cross_enemy)
-        ) {
-            return true;
         }
-
-        const auto has_enemy_knight = [&, this](int nx, int ny) {
-            return is_location_valid(nx, ny) && (*this)(nx, ny) == (by_black ? black_knight : white_knight);
-        };
-        if(
-            has_enemy_knight(x+2, y+1) ||
-            has_enemy_knight(x+1, y+2) ||
-            has_enemy_knight(x-1, y+2) ||
-            has_enemy_knight(x-2, y+1) ||
-            has_enemy_knight(x-2, y-1) ||
-            has_enemy_knight(x-1, y-2) ||
-            has_enemy_knight(x+1, y-2) ||
-            has_enemy_knight(x+2, y-1)
-        ) return true;
-
-        const auto has_enemy_king = [&, this](int nx, int ny) {
-            return is_location_valid(nx, ny) && (*this)(nx, ny) == (by_black ? black_king : white_king);
-        };
-        if(
-            has_enemy_king(x+1, y) ||
-            has_enemy_king(x+1, y+1) ||
-            has_enemy_king(x, y+1) ||
-            has_enemy_king(x-1, y+1) ||
-            has_enemy_king(x-1, y) ||
-            has_enemy_king(x-1, y-1) ||
-            has_enemy_king(x, y-1) ||
-            has_enemy_king(x+1, y-1)
-        ) return true;
-
-        // not attacked
         return false;
+    };
+    if(
+        has_enemy_dir(1, 1, is_diag_enemy)
+        || has_enemy_dir(-1, 1, is_diag_enemy)
+        || has_enemy_dir(-1, -1, is_diag_enemy)
+        || has_enemy_dir(1, -1, is_diag_enemy)
+
+        || has_enemy_dir(1, 0, is_cross_enemy)
+        || has_enemy_dir(0, 1, is_cross_enemy)
+        || has_enemy_dir(-1, 0, is_cross_enemy)
+        || has_enemy_dir(0, -1, is_cross_enemy)
+    ) {
+        return true;
+    }
+
+    for(const int t : knight_targets[i]) {
+        if(board[t] == Enemy::knight) return true;
     }
-};
+
+    for(const int t : king_targets[i]) {
+        if(board[t] == Enemy::king) return true;
+    }
+
+    // not attacked
+    return false;
+}
 
 struct BoardStateZobristTable {
     using HashInt = std::uint64_t;
@@ -222,30 +309,52 @@ struct BoardStateZobristTable {
 
     HashInt en_passant_column[BoardState::width] {};
 
-    static auto generate() {
+    // Next: function type with signature () -> HashInt
+    template< typename Next >
+    static auto generate_by(Next&& next) {
         BoardStateZobristTable res;
 
-        std::uniform_int_distribution< HashInt > dis;
-
         for(int i = 0; i < BoardState::size; ++i) {
             for(int j = 0; j < num_occupation_state(); ++j) {
-                res.board[i][j] = dis(rand_gen);
+                res.board[i][j] = next();
             }
         }
-        res.black_turn         = dis(rand_gen);
-        res.white_castle_queen = dis(rand_gen);
-        res.white_castle_king  = dis(rand_gen);
-        res.black_castle_queen = dis(rand_gen);
-        res.black_castle_king  = dis(rand_gen);
+        res.black_turn         = next();
+        res.white_castle_queen = next();
+        res.white_castle_king  = next();
+        res.black_castle_queen = next();
+        res.black_castle_king  = next();
 
         for(int i = 0; i < BoardState::width; ++i) {
-            res.en_passant_column[i] = dis(rand_gen);
+            res.en_passant_column[i] = next();
         }
 
         return res;
     }
+
+    static auto generate() {
+        std::uniform_int_distribution< HashInt > dis;
+        return generate_by([&] { return dis(rand_gen); });
+    }
+
+    // Deterministic table, such that hash values can be stored and compared
+    // across processes and platforms.
+    static auto generate_with_seed(std::uint64_t seed) {
+        std::mt19937_64 gen(seed);
+        return generate_by([&] { return static_cast< HashInt >(gen()); });
+    }
 };
 
+// The seed of the standard table. Changing it invalidates all stored hashes.
+inline constexpr std::uint64_t standard_zobrist_seed = 0x6368657373ull;
+
+// Shared deterministic table for hash values that are persisted, such as in
+// game archives and opening books.
+inline const BoardStateZobristTable& standard_zobrist_table() {
+    static const auto table = BoardStateZobristTable::generate_with_seed(standard_zobrist_seed);
+    return table;
+}
+
 constexpr auto hash(const BoardState& board_state, const BoardStateZobristTable& hash_table) {
     BoardStateZobristTable::HashInt res = 0;
 
@@ -316,6 +425,77 @@ inline void aux_hash_set_en_passant_column(
     old_val = new_val;
 }
 
+// Piece counts of a board, in 4-bit fields of an integer, so that the
+// signature is cheap to update and compare. Bishops on light squares are
+// counted in fields of their own, as bishops on squares of one color can
+// never mate.
+struct MaterialSignature {
+    std::uint64_t packed = 0;
+
+    // Light-squared bishops, after all occupation states.
+    inline static constexpr int white_light_bishop_field = 13;
+    inline static constexpr int black_light_bishop_field = 14;
+
+    static constexpr int field(Occupation o, int x, int y) {
+        using enum Occupation;
+        if((x + y) % 2 == 1) {
+            if(o == white_bishop) return white_light_bishop_field;
+            if(o == black_bishop) return black_light_bishop_field;
+        }
+        return underlying(o);
+    }
+
+    constexpr int count_field(int f) const { return static_cast< int >((packed >> (4 * f)) & 0xf); }
+
+    constexpr void add(Occupation o, int x, int y) {
+        if(o != Occupation::empty) packed += std::uint64_t(1) << (4 * field(o, x, y));
+    }
+    constexpr void remove(Occupation o, int x, int y) {
+        if(o != Occupation::empty) packed -= std::uint64_t(1) << (4 * field(o, x, y));
+    }
+
+    // Number of pieces of an occupation state, bishops on both colors included.
+    constexpr int count(Occupation o) const {
+        using enum Occupation;
+        return count_field(underlying(o))
+            + (o == white_bishop ? count_field(white_light_bishop_field) : 0)
+            + (o == black_bishop ? count_field(black_light_bishop_field) : 0);
+    }
+
+    // Number of pieces on the board, kings included.
+    constexpr int num_pieces() const {
+        int res = 0;
+        for(int f = 1; f <= black_light_bishop_field; ++f) res += count_field(f);
+        return res;
+    }
+
+    // Whether neither side can checkmate by any sequence of legal moves,
+    // which is the case with only kings and either at most one minor piece
+    // or bishops all on squares of one color.
+    constexpr bool insufficient() const {
+        using enum Occupation;
+        if(count(white_queen) || count(white_rook) || count(white_pawn) || count(black_queen) || count(black_rook) || count(black_pawn)) {
+            return false;
+        }
+        const int knights       = count(white_knight) + count(black_knight);
+        const int dark_bishops  = count_field(underlying(white_bishop)) + count_field(underlying(black_bishop));
+        const int light_bishops = count_field(white_light_bishop_field) + count_field(black_light_bishop_field);
+        return knights + dark_bishops + light_bishops <= 1
+            || (knights == 0 && (dark_bishops == 0 || light_bishops == 0));
+    }
+
+    friend bool operator==(const MaterialSignature&, const MaterialSignature&) = default;
+};
+
+constexpr MaterialSignature material_signature(const BoardState& board_state) {
+    MaterialSignature res;
+    for(int i = 0; i < BoardState::size; ++i) {
+        const auto [x, y] = BoardState::index_to_coord(i);
+        res.add(board_state.board[i], x, y);
+    }
+    return res;
+}
+
 struct GameState {
     enum class Status {
         active, white_win, black_win, draw
@@ -332,6 +512,8 @@ struct GameState {
     int        black_king_y = 0;
     bool       check = false;
     Status     status = Status::active;
+    // Maintained incrementally when applying operations.
+    MaterialSignature material;
 
     int        friend_king_x() const { return board_state.black_turn ? black_king_x : white_king_x; }
     int        friend_king_y() const { return board_state.black_turn ? black_king_y : white_king_y; }
@@ -372,6 +554,93 @@ struct GameState {
     }
 };
 
+// Compact encoding of the board state of a game state, for bulk storage and
+// transfer. Derived fields are not stored.
+struct PackedPosition {
+    inline static constexpr std::uint8_t flag_black_turn         = 1 << 0;
+    inline static constexpr std::uint8_t flag_white_castle_queen = 1 << 1;
+    inline static constexpr std::uint8_t flag_white_castle_king  = 1 << 2;
+    inline static constexpr std::uint8_t flag_black_castle_queen = 1 << 3;
+    inline static constexpr std::uint8_t flag_black_castle_king  = 1 << 4;
+    inline static constexpr std::uint8_t flag_draw_offer         = 1 << 5;
+
+    // Occupation of each square in 4 bits, the lower bits for even squares.
+    std::uint8_t  board[BoardState::size / 2] {};
+    std::uint8_t  flags = 0;
+    std::int8_t   en_passant_column = -1;
+    std::uint16_t no_capture_no_pawn_move_streak = 0;
+
+    friend bool operator==(const PackedPosition&, const PackedPosition&) = default;
+};
+static_assert(sizeof(PackedPosition) == 36);
+
+constexpr PackedPosition pack_position(const GameState& game_state) {
+    const auto& board_state = game_state.board_state;
+
+    PackedPosition res;
+    for(int i = 0; i < BoardState::size; ++i) {
+        res.board[i / 2] |= static_cast< std::uint8_t >(underlying(board_state.board[i]) << (i % 2 * 4));
+    }
+    res.flags = static_cast< std::uint8_t >(
+        (board_state.black_turn           ? PackedPosition::flag_black_turn         : 0)
+        | (board_state.white_castle_queen ? PackedPosition::flag_white_castle_queen : 0)
+        | (board_state.white_castle_king  ? PackedPosition::flag_white_castle_king  : 0)
+        | (board_state.black_castle_queen ? PackedPosition::flag_black_castle_queen : 0)
+        | (board_state.black_castle_king  ? PackedPosition::flag_black_castle_king  : 0)
+        | (game_state.draw_offer          ? PackedPosition::flag_draw_offer         : 0)
+    );
+    res.en_passant_column = static_cast< std::int8_t >(board_state.en_passant_column);
+    res.no_capture_no_pawn_move_streak = static_cast< std::uint16_t >(game_state.no_capture_no_pawn_move_streak);
+    return res;
+}
+
+// Unpacks a position into an active game state. King positions, check and
+// material are derived, but the status is not.
+//
+// Returns false if the position is malformed, or does not have exactly one
+// king of each color.
+inline bool unpack_position(const PackedPosition& packed, GameState& game_state) {
+    using enum Occupation;
+
+    game_state = GameState {};
+    auto& board_state = game_state.board_state;
+
+    int num_white_kings = 0, num_black_kings = 0;
+    for(int i = 0; i < BoardState::size; ++i) {
+        const int o = (packed.board[i / 2] >> (i % 2 * 4)) & 0xf;
+        if(o >= num_occupation_state()) return false;
+
+        const auto piece = static_cast< Occupation >(o);
+        const auto [x, y] = BoardState::index_to_coord(i);
+        board_state.board[i] = piece;
+        game_state.material.add(piece, x, y);
+        if(piece == white_king) {
+            ++num_white_kings;
+            game_state.white_king_x = x;
+            game_state.white_king_y = y;
+        }
+        else if(piece == black_king) {
+            ++num_black_kings;
+            game_state.black_king_x = x;
+            game_state.black_king_y = y;
+        }
+    }
+    if(num_white_kings != 1 || num_black_kings != 1) return false;
+    if(packed.en_passant_column < -1 || packed.en_passant_column >= BoardState::width) return false;
+
+    board_state.black_turn         = packed.flags & PackedPosition::flag_black_turn;
+    board_state.white_castle_queen = packed.flags & PackedPosition::flag_white_castle_queen;
+    board_state.white_castle_king  = packed.flags & PackedPosition::flag_white_castle_king;
+    board_state.black_castle_queen = packed.flags & PackedPosition::flag_black_castle_queen;
+    board_state.black_castle_king  = packed.flags & PackedPosition::flag_black_castle_king;
+    board_state.en_passant_column  = packed.en_passant_column;
+    game_state.draw_offer          = packed.flags & PackedPosition::flag_draw_offer;
+    game_state.no_capture_no_pawn_move_streak = packed.no_capture_no_pawn_move_streak;
+
+    game_state.check = board_state.position_attacked(game_state.friend_king_x(), game_state.friend_king_y(), !board_state.black_turn);
+    return true;
+}
+
 constexpr GameState game_standard_opening() {
     using enum Occupation;
 
@@ -398,6 +667,7 @@ constexpr GameState game_standard_opening() {
     game_state.white_king_y = 0;
     game_state.black_king_x = 4;
     game_state.black_king_y = 7;
+    game_state.material = material_signature(state);
 
     return game_state;
 }
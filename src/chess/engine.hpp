@@ -0,0 +1,255 @@
+#ifndef CHESS_CHESS_ENGINE_HPP
+#define CHESS_CHESS_ENGINE_HPP
+
+#include <algorithm> // max, stable_sort
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <optional>
+#include <vector>
+
+#include "chess/operation.hpp"
+#include "chess/tablebase.hpp"
+#include "utility.hpp"
+
+namespace chess {
+
+//-----------------------------------------------------------------------------
+// Game playing engine for server-side bot players.
+//
+// Iterative deepening alpha-beta search over material and piece placement,
+// with a capture search at the leaves. The search only reads its own copy of
+// the game state, so it can run on any thread. It stops at the deadline or
+// when cancelled, and returns the best operation of the last completed depth.
+//
+// If tablebases are given and cover all positions after the operations, the
+// operation is chosen by probing them instead, which is exact.
+//
+// Note:
+//   - Repetitions are not detected in the search. game_round still applies
+//     all draw rules to the operation played.
+//-----------------------------------------------------------------------------
+
+struct EngineLimits {
+    std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::time_point::max();
+    int                                   max_depth = 64;
+    // Set by another thread to stop the search. May be null.
+    const std::atomic_bool*               p_cancel = nullptr;
+    // Nodes searched at most. 0 for no limit.
+    std::uint64_t                         max_nodes = 0;
+    // Probed at the root if not null. Probing is thread-safe.
+    const Tablebases*                     p_tablebases = nullptr;
+};
+
+struct EngineResult {
+    // Empty if there is no valid move.
+    std::optional< Operation > op;
+    // Last completed depth.
+    int                        depth = 0;
+    // From the side to move, in centipawns.
+    int                        score = 0;
+    std::uint64_t              num_nodes = 0;
+    bool                       cancelled = false;
+};
+
+struct EngineSearch {
+    inline static constexpr int mate_score = 1000000;
+    inline static constexpr int infinity = 2 * mate_score;
+    // Nodes between checks of the deadline and the cancel flag.
+    inline static constexpr std::uint64_t check_interval = 1024;
+
+    struct Aborted {};
+
+    EngineLimits  limits;
+    std::uint64_t num_nodes = 0;
+    bool          cancelled = false;
+
+    static constexpr int piece_value(Occupation o) {
+        using enum Occupation;
+        switch(o) {
+            case white_queen:  case black_queen:  return 900;
+            case white_rook:   case black_rook:   return 500;
+            case white_bishop: case black_bishop: return 330;
+            case white_knight: case black_knight: return 320;
+            case white_pawn:   case black_pawn:   return 100;
+            default:                              return 0;
+        }
+    }
+
+    // From white, in centipawns. Minor pieces gain toward the center, and
+    // pawns as they advance.
+    static int evaluate_white(const BoardState& board_state) {
+        using enum Occupation;
+        int res = 0;
+        for(int i = 0; i < BoardState::size; ++i) {
+            const auto o = board_state.board[i];
+            if(o == empty) continue;
+
+            const auto [x, y] = BoardState::index_to_coord(i);
+            int value = piece_value(o);
+            if(o == white_knight || o == black_knight || o == white_bishop || o == black_bishop) {
+                const int dx = x < 4 ? x : 7 - x;
+                const int dy = y < 4 ? y : 7 - y;
+                value += 5 * std::min(dx, dy);
+            }
+            else if(o == white_pawn) value += 4 * (y - 1);
+            else if(o == black_pawn) value += 4 * (6 - y);
+
+            res += is_white_piece(o) ? value : -value;
+        }
+        return res;
+    }
+
+    static int evaluate(const GameState& game_state) {
+        const int v = evaluate_white(game_state.board_state);
+        return game_state.board_state.black_turn ? -v : v;
+    }
+
+    static bool is_capture(const GameState& game_state, const Operation& op) {
+        return op.category != Operation::Category::castle
+            && game_state.board_state(op.x1, op.y1) != Occupation::empty;
+    }
+
+    // Valid moves, captures of the most valuable pieces first.
+    static std::vector< Operation > ordered_operations(const GameState& game_state) {
+        std::vector< Operation > res;
+        valid_operation_generator(game_state, standard_zobrist_table(), 0, [&](Operation op) {
+            if(op.category != Operation::Category::resign && op.category != Operation::Category::draw_accept) {
+                res.push_back(op);
+            }
+        });
+        std::ranges::stable_sort(res, [&](const Operation& a, const Operation& b) {
+            return piece_value(game_state.board_state(a.x1, a.y1)) > piece_value(game_state.board_state(b.x1, b.y1));
+        });
+        return res;
+    }
+
+    void count_node() {
+        if(++num_nodes == limits.max_nodes) throw Aborted {};
+        if(num_nodes % check_interval == 0) {
+            if(limits.p_cancel && limits.p_cancel->load(std::memory_order_relaxed)) {
+                cancelled = true;
+                throw Aborted {};
+            }
+            if(std::chrono::steady_clock::now() >= limits.deadline) throw Aborted {};
+        }
+    }
+
+    // Searches captures only, standing pat on the static evaluation.
+    int quiescence(const GameState& game_state, int alpha, int beta) {
+        count_node();
+
+        const int stand_pat = evaluate(game_state);
+        if(stand_pat >= beta) return stand_pat;
+        alpha = std::max(alpha, stand_pat);
+
+        for(const auto& op : ordered_operations(game_state)) {
+            if(!is_capture(game_state, op)) break;
+            const int score = -quiescence(game_state_after(game_state, op), -beta, -alpha);
+            if(score >= beta) return score;
+            alpha = std::max(alpha, score);
+        }
+        return alpha;
+    }
+
+    int negamax(const GameState& game_state, int depth, int ply, int alpha, int beta) {
+        if(game_state.material.insufficient() || game_state.no_capture_no_pawn_move_streak >= 100) return 0;
+        if(depth == 0) return quiescence(game_state, alpha, beta);
+        count_node();
+
+        const auto ops = ordered_operations(game_state);
+        if(ops.empty()) {
+            const auto& board_state = game_state.board_state;
+            const bool check = board_state.position_attacked(game_state.friend_king_x(), game_state.friend_king_y(), !board_state.black_turn);
+            // Sooner mates score higher.
+            return check ? -mate_score + ply : 0;
+        }
+
+        int best = -infinity;
+        for(const auto& op : ops) {
+            const int score = -negamax(game_state_after(game_state, op), depth - 1, ply + 1, -beta, -alpha);
+            best = std::max(best, score);
+            alpha = std::max(alpha, score);
+            if(alpha >= beta) break;
+        }
+        return best;
+    }
+
+    // The operation of the best result in the tablebases, or empty if any
+    // position after an operation is not covered.
+    std::optional< Operation > tablebase_operation(const GameState& game_state, const std::vector< Operation >& ops) const {
+        if(!limits.p_tablebases || game_state.material.num_pieces() > max_tablebase_pieces) return {};
+
+        // From the side to move: wins by the fewest plies, then draws, then
+        // losses by the most plies.
+        std::optional< Operation > res;
+        int best = -infinity;
+        for(const auto& op : ops) {
+            const auto next = game_state_after(game_state, op);
+            int score = 0;
+            if(!next.material.insufficient()) {
+                const auto tb_res = limits.p_tablebases->probe(next);
+                if(!tb_res) return {};
+                using enum TablebaseResult::Wdl;
+                // The result is from the opponent.
+                score =
+                    tb_res->wdl == loss ? mate_score - tb_res->plies_to_mate
+                    : tb_res->wdl == win ? -mate_score + tb_res->plies_to_mate
+                    : 0;
+            }
+            if(score > best) {
+                best = score;
+                res = op;
+            }
+        }
+        return res;
+    }
+
+    EngineResult run(const GameState& game_state) {
+        EngineResult res;
+        auto ops = ordered_operations(game_state);
+        if(ops.empty()) return res;
+
+        if(const auto op = tablebase_operation(game_state, ops)) {
+            res.op = op;
+            return res;
+        }
+        // Played if even the first depth does not complete.
+        res.op = ops.front();
+
+        try {
+            for(int depth = 1; depth <= limits.max_depth; ++depth) {
+                int alpha = -infinity;
+                std::size_t best_index = 0;
+                for(std::size_t i = 0; i < ops.size(); ++i) {
+                    const int score = -negamax(game_state_after(game_state, ops[i]), depth - 1, 1, -infinity, -alpha);
+                    if(score > alpha) {
+                        alpha = score;
+                        best_index = i;
+                    }
+                }
+                // The best operation is searched first at the next depth.
+                std::rotate(ops.begin(), ops.begin() + best_index, ops.begin() + best_index + 1);
+                res.op = ops.front();
+                res.depth = depth;
+                res.score = alpha;
+
+                // A forced mate is not improved by searching deeper.
+                if(alpha >= mate_score - limits.max_depth) break;
+            }
+        }
+        catch(const Aborted&) {}
+
+        res.num_nodes = num_nodes;
+        res.cancelled = cancelled;
+        return res;
+    }
+};
+
+inline EngineResult engine_search(const GameState& game_state, const EngineLimits& limits) {
+    return EngineSearch { limits }.run(game_state);
+}
+
+} // namespace chess
+
+#endif
@@ -0,0 +1,238 @@
+#ifndef CHESS_CHESS_FEN_HPP
+#define CHESS_CHESS_FEN_HPP
+
+#include <charconv> // from_chars
+#include <string>
+#include <string_view>
+
+#include "chess/operation.hpp"
+
+namespace chess {
+
+//-----------------------------------------------------------------------------
+// Forsyth-Edwards Notation (FEN)
+//
+// Example (the standard opening):
+//   rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1
+//
+// The en passant square is only kept if a pawn of the player to move can
+// capture there, which is how en_passant_column is defined. The full move
+// number is not part of GameState, and is returned separately.
+//-----------------------------------------------------------------------------
+
+inline constexpr const char* standard_opening_fen = "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1";
+
+struct FenParseResult {
+    bool        okay = false;
+    std::string error_message;
+    // Derived fields are up to date.
+    GameState   game_state;
+    int         fullmove_number = 1;
+};
+
+// Parses a FEN record. The halfmove clock and the full move number are
+// optional.
+inline FenParseResult parse_fen(std::string_view fen) {
+    using enum Occupation;
+
+    FenParseResult res;
+    auto& game_state = res.game_state;
+    auto& board_state = game_state.board_state;
+    const auto error = [&](const char* message) {
+        res.error_message = message;
+        return res;
+    };
+
+    // Split fields.
+    std::string_view fields[6];
+    int num_fields = 0;
+    for(std::size_t pos = 0; pos < fen.size();) {
+        if(fen[pos] == ' ') { ++pos; continue; }
+        auto end = fen.find(' ', pos);
+        if(end == std::string_view::npos) end = fen.size();
+        if(num_fields == 6) return error("Too many fields.");
+        fields[num_fields++] = fen.substr(pos, end - pos);
+        pos = end;
+    }
+    if(num_fields < 4) return error("Too few fields.");
+
+    // Piece placement, from rank 8 to rank 1.
+    {
+        int x = 0, y = BoardState::height - 1;
+        for(const char c : fields[0]) {
+            if(c == '/') {
+                if(x != BoardState::width || y == 0) return error("Invalid rank.");
+                x = 0;
+                --y;
+            }
+            else if('1' <= c && c <= '8') {
+                x += c - '0';
+                if(x > BoardState::width) return error("Invalid rank.");
+            }
+            else {
+                Occupation piece = empty;
+                switch(c) {
+                    case 'K': piece = white_king;   break;
+                    case 'Q': piece = white_queen;  break;
+                    case 'R': piece = white_rook;   break;
+                    case 'B': piece = white_bishop; break;
+                    case 'N': piece = white_knight; break;
+                    case 'P': piece = white_pawn;   break;
+                    case 'k': piece = black_king;   break;
+                    case 'q': piece = black_queen;  break;
+                    case 'r': piece = black_rook;   break;
+                    case 'b': piece = black_bishop; break;
+                    case 'n': piece = black_knight; break;
+                    case 'p': piece = black_pawn;   break;
+                    default:  return error("Invalid piece.");
+                }
+                if(x >= BoardState::width) return error("Invalid rank.");
+                if((piece == white_pawn || piece == black_pawn) && (y == 0 || y == BoardState::height - 1)) {
+                    return error("Pawn on the first or last rank.");
+                }
+                board_state(x++, y) = piece;
+            }
+        }
+        if(x != BoardState::width || y != 0) return error("Invalid piece placement.");
+    }
+
+    // Active color.
+    if(fields[1] == "w")      board_state.black_turn = false;
+    else if(fields[1] == "b") board_state.black_turn = true;
+    else                      return error("Invalid active color.");
+
+    // Castling availability. Each right requires the king and the rook on
+    // their initial squares.
+    board_state.white_castle_queen = board_state.white_castle_king = false;
+    board_state.black_castle_queen = board_state.black_castle_king = false;
+    if(fields[2] != "-") {
+        for(const char c : fields[2]) {
+            switch(c) {
+                case 'K': board_state.white_castle_king  = true; break;
+                case 'Q': board_state.white_castle_queen = true; break;
+                case 'k': board_state.black_castle_king  = true; break;
+                case 'q': board_state.black_castle_queen = true; break;
+                default:  return error("Invalid castling availability.");
+            }
+        }
+    }
+    if(
+        ((board_state.white_castle_king || board_state.white_castle_queen) && board_state(4, 0) != white_king)
+        || (board_state.white_castle_king  && board_state(7, 0) != white_rook)
+        || (board_state.white_castle_queen && board_state(0, 0) != white_rook)
+        || ((board_state.black_castle_king || board_state.black_castle_queen) && board_state(4, 7) != black_king)
+        || (board_state.black_castle_king  && board_state(7, 7) != black_rook)
+        || (board_state.black_castle_queen && board_state(0, 7) != black_rook)
+    ) {
+        return error("Castling availability does not match the pieces.");
+    }
+
+    // En passant target square.
+    if(fields[3] != "-") {
+        const auto& ep = fields[3];
+        const int   ep_y = board_state.black_turn ? 2 : 5;
+        if(ep.size() != 2 || ep[0] < 'a' || ep[0] > 'h' || ep[1] - '1' != ep_y) {
+            return error("Invalid en passant square.");
+        }
+        const int  ep_x = ep[0] - 'a';
+        // The pawn that skipped, and the friendly pawns that may capture it.
+        const int  pawn_y = board_state.black_turn ? 3 : 4;
+        const auto enemy_pawn  = board_state.black_turn ? white_pawn : black_pawn;
+        const auto friend_pawn = board_state.black_turn ? black_pawn : white_pawn;
+        if(board_state(ep_x, pawn_y) != enemy_pawn || board_state(ep_x, ep_y) != empty) {
+            return error("No pawn to capture en passant.");
+        }
+        if(
+            (BoardState::is_location_valid(ep_x - 1, pawn_y) && board_state(ep_x - 1, pawn_y) == friend_pawn)
+            || (BoardState::is_location_valid(ep_x + 1, pawn_y) && board_state(ep_x + 1, pawn_y) == friend_pawn)
+        ) {
+            board_state.en_passant_column = ep_x;
+        }
+    }
+
+    // Move counters.
+    const auto parse_int = [](std::string_view s, int& val) {
+        const auto [p, ec] = std::from_chars(s.data(), s.data() + s.size(), val);
+        return ec == std::errc {} && p == s.data() + s.size();
+    };
+    if(num_fields >= 5 && (!parse_int(fields[4], game_state.no_capture_no_pawn_move_streak) || game_state.no_capture_no_pawn_move_streak < 0)) {
+        return error("Invalid halfmove clock.");
+    }
+    if(num_fields >= 6 && (!parse_int(fields[5], res.fullmove_number) || res.fullmove_number < 1)) {
+        return error("Invalid fullmove number.");
+    }
+
+    // Derived state.
+    if(!update_derived_state(game_state, standard_zobrist_table())) {
+        return error("Each side must have exactly one king.");
+    }
+    if(board_state.position_attacked(game_state.enemy_king_x(), game_state.enemy_king_y(), board_state.black_turn)) {
+        return error("The king of the player not to move is in check.");
+    }
+
+    res.okay = true;
+    return res;
+}
+
+// Formats a game state in FEN.
+inline std::string fen_text(const GameState& game_state, int fullmove_number = 1) {
+    using enum Occupation;
+
+    const auto& board_state = game_state.board_state;
+    std::string res;
+
+    for(int y = BoardState::height - 1; y >= 0; --y) {
+        int num_empty = 0;
+        for(int x = 0; x < BoardState::width; ++x) {
+            const auto piece = board_state(x, y);
+            if(piece == empty) {
+                ++num_empty;
+                continue;
+            }
+            if(num_empty) {
+                res += static_cast< char >('0' + num_empty);
+                num_empty = 0;
+            }
+            res += is_black_piece(piece) ? static_cast< char >(letter(piece) - 'A' + 'a') : letter(piece);
+        }
+        if(num_empty) res += static_cast< char >('0' + num_empty);
+        if(y > 0) res += '/';
+    }
+
+    res += board_state.black_turn ? " b " : " w ";
+
+    const auto castle_begin = res.size();
+    if(board_state.white_castle_king)  res += 'K';
+    if(board_state.white_castle_queen) res += 'Q';
+    if(board_state.black_castle_king)  res += 'k';
+    if(board_state.black_castle_queen) res += 'q';
+    if(res.size() == castle_begin)     res += '-';
+
+    res += ' ';
+    if(board_state.en_passant_column >= 0) {
+        res += static_cast< char >('a' + board_state.en_passant_column);
+        res += board_state.black_turn ? '3' : '6';
+    }
+    else {
+        res += '-';
+    }
+
+    res += ' ';
+    res += std::to_string(game_state.no_capture_no_pawn_move_streak);
+    res += ' ';
+    res += std::to_string(fullmove_number);
+    return res;
+}
+
+// Formats the current game state of a game history in FEN.
+inline std::string fen_text(const GameHistory& game_history) {
+    const auto  num_items = static_cast< int >(game_history.num_items());
+    const auto& initial = game_history.current_items().front().game_state;
+    // Plies counted from the white move of the initial full move.
+    const int   plies = num_items - 1 + (initial.board_state.black_turn ? 1 : 0);
+    return fen_text(game_history.ptr_current_item()->game_state, game_history.initial_fullmove_number + plies / 2);
+}
+
+} // namespace chess
+
+#endif
@@ -1,20 +1,106 @@
 #ifndef CHESS_CHESS_GAME_HPP
 #define CHESS_CHESS_GAME_HPP
 
+#include <algorithm> // min
+#include <cctype> // isspace, tolower
+#include <cstddef>
+#include <cstdint>
+#include <functional>
 #include <iostream>
 #include <optional>
+#include <span>
 #include <sstream>
-#include <vector>
+#include <stdexcept>
+#include <string>
+#include <string_view>
 
+#include "chess/fen.hpp"
 #include "chess/operation.hpp"
+#include "metrics.hpp"
 #include "utility.hpp"
 
 namespace chess {
 
+// Suggests a move for the player to move, such as from an opening book.
+// Returns empty if there is no suggestion.
+using MoveHintFunc = std::function< std::optional< Operation >(const GameState&) >;
+
+// Formats an operation as a command of server_game_step, such as "mv e2 e4".
+inline std::string command_text(const Operation& op) {
+    if(op.category == Operation::Category::castle) {
+        return op.x1 == 2 ? "0-0-0" : "0-0";
+    }
+    if(op.category == Operation::Category::resign)      return "resign";
+    if(op.category == Operation::Category::draw_accept) return "da";
+
+    std::string res =
+        op.code2 == Operation::code2_draw_claim ? "dcmv "
+        : op.code2 == Operation::code2_draw_offer ? "domv "
+        : "mv ";
+    res += static_cast< char >('a' + op.x0);
+    res += static_cast< char >('1' + op.y0);
+    res += ' ';
+    res += static_cast< char >('a' + op.x1);
+    res += static_cast< char >('1' + op.y1);
+    if(op.category == Operation::Category::promote) {
+        res += ' ';
+        res += static_cast< char >(std::tolower(letter(static_cast< Occupation >(op.code))));
+    }
+    return res;
+}
+
+// Rendered status of the current item of a game, reused until the game
+// history changes, such as for spectators requesting the board repeatedly.
+struct GameStatusCache {
+    // Key of the cached item. The item count and hash guard against a cache
+    // used with another game history.
+    std::uint64_t                   version = 0;
+    std::size_t                     num_items = 0;
+    BoardStateZobristTable::HashInt board_state_hash = 0;
+
+    // Output of pretty_print_to.
+    std::string                     board_text;
+    int                             num_repetition = 0;
+
+    // Renders the current item if the cached one is stale.
+    const GameStatusCache& update(const GameHistory& gh) {
+        const auto& item = *gh.ptr_current_item();
+        if(version != gh.version || num_items != gh.num_items() || board_state_hash != item.board_state_hash) {
+            version = gh.version;
+            num_items = gh.num_items();
+            board_state_hash = item.board_state_hash;
+
+            std::ostringstream oss;
+            item.game_state.pretty_print_to(oss);
+            board_text = std::move(oss).str();
+            num_repetition = gh.count_board_state_repetition(item.game_state.board_state, item.board_state_hash);
+        }
+        else if constexpr(debug) {
+            std::ostringstream oss;
+            item.game_state.pretty_print_to(oss);
+            if(oss.view() != board_text || gh.count_board_state_repetition(item.game_state.board_state, item.board_state_hash) != num_repetition) {
+                throw std::logic_error("Game status cache is stale.");
+            }
+        }
+        return *this;
+    }
+};
+
 // Validates and progresses the game.
 // Returns whether the command is valid and progresses the game.
 // If the game progresses, contents in os_message will be displayed to everyone. Otherwise, they will be returned to the sender only.
-inline bool server_game_step(GameHistory& gh, bool from_black, std::string command, std::ostream& os_message) {
+// If p_game_round_latency is not null, the time spent in game_round is recorded.
+// If p_hint is not null, hints are given by it.
+// If p_status_cache is not null, the rendered status is cached in it.
+inline bool server_game_step(
+    GameHistory&        gh,
+    bool                from_black,
+    std::string_view    command,
+    std::ostream&       os_message,
+    LatencyHistogram*   p_game_round_latency = nullptr,
+    const MoveHintFunc* p_hint = nullptr,
+    GameStatusCache*    p_status_cache = nullptr
+) {
     using namespace std;
 
     const auto gs = [&]() -> const GameState& { return gh.ptr_current_item()->game_state; };
@@ -24,20 +110,39 @@ inline bool server_game_step(GameHistory& gh, bool from_black, std::string comma
 
         // Print board status
         const auto print_status = [&] {
-            gs().pretty_print_to(os_message);
-            os_message << "board hash: " << bh() << '\n';
-            os_message << "board repetition: " << gh.count_board_state_repetition(gs().board_state, bh()) << '\n';
+            if(p_status_cache) {
+                const auto& status = p_status_cache->update(gh);
+                os_message << status.board_text;
+                os_message << "board hash: " << bh() << '\n';
+                os_message << "board repetition: " << status.num_repetition << '\n';
+            }
+            else {
+                gs().pretty_print_to(os_message);
+                os_message << "board hash: " << bh() << '\n';
+                os_message << "board repetition: " << gh.count_board_state_repetition(gs().board_state, bh()) << '\n';
+            }
             os_message << endl;
         };
         const auto command_prompt = [&] { return from_black ? "black> " : "white> "; };
+        const auto timed_game_round = [&](const Operation& op) {
+            ScopedLatency timer(p_game_round_latency);
+            return game_round(gh, op, os_message);
+        };
 
-        // parse input
-        istringstream iss(command);
-        vector< string > words;
-        string tmp_word;
-        while(iss >> tmp_word) {
-            words.push_back(tmp_word);
+        // Parse input into words, viewing the command in place. No command
+        // takes more than max_words words, so the rest are only counted.
+        constexpr size_t max_words = 4;
+        string_view words_buffer[max_words];
+        size_t      num_words = 0;
+        for(size_t pos = 0; pos < command.size();) {
+            if(isspace(static_cast< unsigned char >(command[pos]))) { ++pos; continue; }
+            size_t end = pos;
+            while(end < command.size() && !isspace(static_cast< unsigned char >(command[end]))) ++end;
+            if(num_words < max_words) words_buffer[num_words] = command.substr(pos, end - pos);
+            ++num_words;
+            pos = end;
         }
+        const span< const string_view > words(words_buffer, min(num_words, max_words));
 
         // General commands.
         if(words.empty()) return false;
@@ -56,6 +161,8 @@ inline bool server_game_step(GameHistory& gh, bool from_black, std::string comma
                 << "    resign: resign\n"
                 << "\n"
                 << "    print board: show\n"
+                << "    print FEN: fen\n"
+                << "    suggest a move: hint\n"
                 << "    quit: exit\n"
                 << endl;
             return false;
@@ -64,6 +171,10 @@ inline bool server_game_step(GameHistory& gh, bool from_black, std::string comma
             print_status();
             return false;
         }
+        else if(words[0] == "fen") {
+            os_message << fen_text(gh) << endl;
+            return false;
+        }
 
         // Commands below require one's turn.
         if(gs().board_state.black_turn != from_black) {
@@ -72,20 +183,25 @@ inline bool server_game_step(GameHistory& gh, bool from_black, std::string comma
         }
 
 
-        if(words[0] == "resign") {
-            bool valid = game_round(
-                gh,
-                Operation { Operation::Category::resign },
-                os_message
+        if(words[0] == "hint") {
+            const auto op = p_hint ? (*p_hint)(gs()) : std::nullopt;
+            if(op) {
+                os_message << "Book move: " << command_text(*op) << endl;
+            } else {
+                os_message << "No book move." << endl;
+            }
+            return false;
+        }
+        else if(words[0] == "resign") {
+            bool valid = timed_game_round(
+                Operation { Operation::Category::resign }
             );
             if(valid) os_message << command_prompt() << " resigned.";
             return valid;
         }
         else if(words[0] == "da") {
-            bool valid = game_round(
-                gh,
-                Operation { Operation::Category::draw_accept },
-                os_message
+            bool valid = timed_game_round(
+                Operation { Operation::Category::draw_accept }
             );
             if(valid) os_message << command_prompt() << " accepted draw.";
             return valid;
@@ -97,12 +213,12 @@ inline bool server_game_step(GameHistory& gh, bool from_black, std::string comma
                 : words[0] == "domv" ? Operation::code2_draw_offer
                 : Operation::code2_normal;
 
-            if(words.size() < 3 || words.size() > 4) {
+            if(num_words < 3 || num_words > 4) {
                 os_message << "Invalid mv command." << endl;
                 return false;
             }
             else {
-                const auto get_coord = [&](const string& s) -> optional< tuple<int, int> > {
+                const auto get_coord = [&](string_view s) -> optional< tuple<int, int> > {
                     if(s.size() != 2 || s[0] < 'a' || s[0] > 'h' || s[1] < '1' || s[1] > '8') {
                         os_message << "Unrecognized coordinate " << s << endl;
                         return {};
@@ -146,35 +262,31 @@ inline bool server_game_step(GameHistory& gh, bool from_black, std::string comma
                     }
                 }
 
-                bool valid = game_round(gh, op, os_message);
+                bool valid = timed_game_round(op);
                 if(valid) print_status();
                 return valid;
             }
         }
         else if(words[0] == "0-0") {
             const int king_y = gs().board_state.black_turn ? 7 : 0;
-            bool valid = game_round(
-                gh,
+            bool valid = timed_game_round(
                 Operation {
                     Operation::Category::castle,
                     4, king_y,
                     6, king_y
-                },
-                os_message
+                }
             );
             if(valid) print_status();
             return valid;
         }
         else if(words[0] == "0-0-0") {
             const int king_y = gs().board_state.black_turn ? 7 : 0;
-            bool valid = game_round(
-                gh,
+            bool valid = timed_game_round(
                 Operation {
                     Operation::Category::castle,
                     4, king_y,
                     2, king_y
-                },
-                os_message
+                }
             );
             if(valid) print_status();
             return valid;
@@ -189,7 +301,8 @@ inline bool server_game_step(GameHistory& gh, bool from_black, std::string comma
 
     else {
         // Not active game status.
-        gs().pretty_print_to(os_message);
+        if(p_status_cache) os_message << p_status_cache->update(gh).board_text;
+        else               gs().pretty_print_to(os_message);
         os_message << endl;
         return false;
     }
@@ -0,0 +1,196 @@
+#ifndef CHESS_CHESS_GAME_TREE_HPP
+#define CHESS_CHESS_GAME_TREE_HPP
+
+#include <algorithm> // reverse
+#include <cstddef>
+#include <iostream>
+#include <stdexcept>
+#include <vector>
+
+#include "chess/operation.hpp"
+#include "utility.hpp"
+
+namespace chess {
+
+//-----------------------------------------------------------------------------
+// Tree of variations from one initial game state, for analysis.
+//
+// Each node stores one ply and refers to its parent, so variations share
+// their common history, and memory grows only with the plies added. All
+// nodes share the Zobrist table of the tree.
+//
+// Nodes are never removed, so node ids stay valid for the lifetime of the
+// tree.
+//-----------------------------------------------------------------------------
+
+struct GameTree {
+    using Item = GameHistory::GameHistoryItem;
+
+    inline static constexpr int root = 0;
+
+    struct Node {
+        Item item;
+        // -1 for the root.
+        int  parent = -1;
+        // Number of plies from the root.
+        int  ply = 0;
+        // Children in the order they were added, as a linked list.
+        int  first_child = -1;
+        int  last_child = -1;
+        int  next_sibling = -1;
+    };
+
+    std::vector< Node > nodes;
+
+    BoardStateZobristTable zobrist_table = BoardStateZobristTable::generate();
+
+    // The full move number of the root, as in FEN.
+    int initial_fullmove_number = 1;
+
+    // If not null, game_round adjudicates positions found in the endgame
+    // tablebases. Not owned.
+    const Tablebases* p_tablebases = nullptr;
+
+    // Default constructor to start from the standard opening.
+    GameTree() {
+        const auto initial_game_state = game_standard_opening();
+        nodes.push_back({ { Operation {}, initial_game_state, hash(initial_game_state.board_state, zobrist_table) } });
+    }
+    // Starts from an arbitrary game state. The derived fields of the game
+    // state are recomputed.
+    //
+    // Throws std::invalid_argument if the board does not have exactly one
+    // king of each color.
+    explicit GameTree(const GameState& initial_game_state, int initial_fullmove_number = 1) :
+        initial_fullmove_number(initial_fullmove_number)
+    {
+        auto new_game_state = initial_game_state;
+        if(!update_derived_state(new_game_state, zobrist_table)) {
+            throw std::invalid_argument("Game state must have exactly one king of each color.");
+        }
+        nodes.push_back({ { Operation {}, new_game_state, hash(new_game_state.board_state, zobrist_table) } });
+    }
+
+    const Node& node(int id) const { return nodes[id]; }
+    auto num_nodes() const { return nodes.size(); }
+
+    // Returns the child reached by the operation, or -1 if there is none.
+    int find_child(int parent, const Operation& op) const {
+        for(int child = nodes[parent].first_child; child != -1; child = nodes[child].next_sibling) {
+            const auto& child_op = nodes[child].item.op;
+            if(
+                child_op.category == op.category
+                && child_op.x0 == op.x0 && child_op.y0 == op.y0
+                && child_op.x1 == op.x1 && child_op.y1 == op.y1
+                && child_op.code == op.code && child_op.code2 == op.code2
+            ) {
+                return child;
+            }
+        }
+        return -1;
+    }
+
+    int add_child(int parent, const Operation& op, const GameState& game_state, BoardStateZobristTable::HashInt board_state_hash) {
+        if constexpr(debug) {
+            if(hash(game_state.board_state, zobrist_table) != board_state_hash) {
+                throw std::logic_error("Board state hash does not match.");
+            }
+        }
+
+        const int id = static_cast< int >(nodes.size());
+        nodes.push_back({ { op, game_state, board_state_hash }, parent, nodes[parent].ply + 1 });
+
+        auto& p = nodes[parent];
+        if(p.last_child == -1) p.first_child = id;
+        else                   nodes[p.last_child].next_sibling = id;
+        p.last_child = id;
+        return id;
+    }
+
+    // Counts the board states equal to the given one on the path from the
+    // node to the root.
+    //
+    // A capture or pawn move is irreversible, so no board state before it can
+    // repeat after it. The walk stops at the first node reached by such a move,
+    // which bounds it by the 75-move rule instead of the game length.
+    int count_board_state_repetition(int id, const BoardState& board_state, BoardStateZobristTable::HashInt board_state_hash) const {
+        if constexpr(debug) {
+            if(hash(board_state, zobrist_table) != board_state_hash) {
+                throw std::logic_error("Board state hash does not match.");
+            }
+        }
+
+        int res = 0;
+        for(; id != -1; id = nodes[id].parent) {
+            const auto& item = nodes[id].item;
+            if(item.board_state_hash == board_state_hash && item.game_state.board_state == board_state) ++res;
+            if(item.game_state.no_capture_no_pawn_move_streak == 0) break;
+        }
+        return res;
+    }
+
+    // Node ids from the root to the node.
+    std::vector< int > path(int id) const {
+        std::vector< int > res;
+        for(; id != -1; id = nodes[id].parent) res.push_back(id);
+        std::ranges::reverse(res);
+        return res;
+    }
+
+    // Copies the line from the root to the node into a game history, such as
+    // for export in PGN. The history uses the Zobrist table of the tree.
+    GameHistory line(int id) const {
+        GameHistory res;
+        res.zobrist_table = zobrist_table;
+        res.p_tablebases = p_tablebases;
+        const auto ids = path(id);
+        res.reset(nodes[root].item.game_state, initial_fullmove_number);
+        for(std::size_t i = 1; i < ids.size(); ++i) {
+            const auto& item = nodes[ids[i]].item;
+            res.push_game_state(item.op, item.game_state, item.board_state_hash);
+        }
+        return res;
+    }
+};
+
+// A position in a game tree, advanced by game_round like a game history.
+//
+// Pushing an operation that was already played from the current node moves
+// to the existing child instead of adding another.
+struct GameTreeCursor {
+    GameTree*                     p_tree = nullptr;
+    int                           id = GameTree::root;
+
+    // Members read by game_round.
+    const BoardStateZobristTable& zobrist_table;
+    const Tablebases*             p_tablebases = nullptr;
+
+    explicit GameTreeCursor(GameTree& tree, int id = GameTree::root) :
+        p_tree(&tree),
+        id(id),
+        zobrist_table(tree.zobrist_table),
+        p_tablebases(tree.p_tablebases)
+    {}
+
+    const GameTree::Item* ptr_current_item() const { return &p_tree->nodes[id].item; }
+
+    int count_board_state_repetition(const BoardState& board_state, BoardStateZobristTable::HashInt board_state_hash) const {
+        return p_tree->count_board_state_repetition(id, board_state, board_state_hash);
+    }
+
+    void push_game_state(const Operation& op, const GameState& game_state, BoardStateZobristTable::HashInt board_state_hash) {
+        const int child = p_tree->find_child(id, op);
+        id = child != -1 ? child : p_tree->add_child(id, op, game_state, board_state_hash);
+    }
+};
+
+// Plays the operation from the node. Returns the child reached, or -1 if the
+// operation is invalid.
+inline int game_tree_round(GameTree& tree, int id, const Operation& op, std::ostream& os) {
+    GameTreeCursor cursor(tree, id);
+    return game_round(cursor, op, os) ? cursor.id : -1;
+}
+
+} // namespace chess
+
+#endif
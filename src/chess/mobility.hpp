@@ -0,0 +1,420 @@
+#ifndef CHESS_CHESS_MOBILITY_HPP
+#define CHESS_CHESS_MOBILITY_HPP
+
+#include <algorithm> // min
+#include <bit>       // popcount
+#include <cstddef>
+#include <cstdint>
+#include <iterator>  // size
+#include <span>
+#include <stdexcept>
+#include <utility>   // index_sequence
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+#include "chess/operation.hpp"
+#include "utility.hpp"
+
+namespace chess {
+
+//-----------------------------------------------------------------------------
+// Batch mobility counting.
+//
+// Counts the valid operations of many positions, giving the same result as
+// count_valid_operations for each, for bulk analytics. Positions are
+// converted to bitboards in structure-of-arrays form, and 4 positions are
+// processed together, one in each 64-bit lane of a vector.
+//
+// Each position is oriented so that the side to move plays upwards, and the
+// legal moves are counted with the usual bitboard rules: squares attacked by
+// the enemy with the king removed, checkers, and pieces pinned along each of
+// the 4 lines through the king. Positions with an en passant column, or with
+// castling rights whose king or rook is not on its initial square, are
+// rare, and counted with the scalar generator instead.
+//
+// In debug builds, every count is cross-checked against the scalar path.
+//-----------------------------------------------------------------------------
+
+// 4 bitboards, without SIMD.
+struct MobilityLanesScalar {
+    std::uint64_t v[4] {};
+
+    static MobilityLanesScalar broadcast(std::uint64_t x) { return { { x, x, x, x } }; }
+    static MobilityLanesScalar load(const std::uint64_t* p) { return { { p[0], p[1], p[2], p[3] } }; }
+    void store(std::uint64_t* p) const { for(int i = 0; i < 4; ++i) p[i] = v[i]; }
+
+    template< typename Op >
+    friend MobilityLanesScalar map(MobilityLanesScalar a, MobilityLanesScalar b, Op&& op) {
+        for(int i = 0; i < 4; ++i) a.v[i] = op(a.v[i], b.v[i]);
+        return a;
+    }
+    friend MobilityLanesScalar operator&(MobilityLanesScalar a, MobilityLanesScalar b) { return map(a, b, [](std::uint64_t x, std::uint64_t y) { return x & y; }); }
+    friend MobilityLanesScalar operator|(MobilityLanesScalar a, MobilityLanesScalar b) { return map(a, b, [](std::uint64_t x, std::uint64_t y) { return x | y; }); }
+    friend MobilityLanesScalar operator+(MobilityLanesScalar a, MobilityLanesScalar b) { return map(a, b, [](std::uint64_t x, std::uint64_t y) { return x + y; }); }
+    friend MobilityLanesScalar operator-(MobilityLanesScalar a, MobilityLanesScalar b) { return map(a, b, [](std::uint64_t x, std::uint64_t y) { return x - y; }); }
+    // ~a & b
+    friend MobilityLanesScalar andnot(MobilityLanesScalar a, MobilityLanesScalar b) { return map(a, b, [](std::uint64_t x, std::uint64_t y) { return ~x & y; }); }
+
+    template< int n > friend MobilityLanesScalar shift_left(MobilityLanesScalar a) { for(auto& x : a.v) x <<= n; return a; }
+    template< int n > friend MobilityLanesScalar shift_right(MobilityLanesScalar a) { for(auto& x : a.v) x >>= n; return a; }
+
+    // All ones in lanes that are not zero.
+    friend MobilityLanesScalar nonzero_mask(MobilityLanesScalar a) { for(auto& x : a.v) x = x ? ~std::uint64_t(0) : 0; return a; }
+    // Number of set bits in each lane.
+    friend MobilityLanesScalar popcount(MobilityLanesScalar a) { for(auto& x : a.v) x = std::popcount(x); return a; }
+};
+
+#if defined(__AVX2__)
+// 4 bitboards in an AVX2 register.
+struct MobilityLanesAvx2 {
+    __m256i v;
+
+    static MobilityLanesAvx2 broadcast(std::uint64_t x) { return { _mm256_set1_epi64x(static_cast< long long >(x)) }; }
+    static MobilityLanesAvx2 load(const std::uint64_t* p) { return { _mm256_loadu_si256(reinterpret_cast< const __m256i* >(p)) }; }
+    void store(std::uint64_t* p) const { _mm256_storeu_si256(reinterpret_cast< __m256i* >(p), v); }
+
+    friend MobilityLanesAvx2 operator&(MobilityLanesAvx2 a, MobilityLanesAvx2 b) { return { _mm256_and_si256(a.v, b.v) }; }
+    friend MobilityLanesAvx2 operator|(MobilityLanesAvx2 a, MobilityLanesAvx2 b) { return { _mm256_or_si256(a.v, b.v) }; }
+    friend MobilityLanesAvx2 operator+(MobilityLanesAvx2 a, MobilityLanesAvx2 b) { return { _mm256_add_epi64(a.v, b.v) }; }
+    friend MobilityLanesAvx2 operator-(MobilityLanesAvx2 a, MobilityLanesAvx2 b) { return { _mm256_sub_epi64(a.v, b.v) }; }
+    // ~a & b
+    friend MobilityLanesAvx2 andnot(MobilityLanesAvx2 a, MobilityLanesAvx2 b) { return { _mm256_andnot_si256(a.v, b.v) }; }
+
+    template< int n > friend MobilityLanesAvx2 shift_left(MobilityLanesAvx2 a) { return { _mm256_slli_epi64(a.v, n) }; }
+    template< int n > friend MobilityLanesAvx2 shift_right(MobilityLanesAvx2 a) { return { _mm256_srli_epi64(a.v, n) }; }
+
+    // All ones in lanes that are not zero.
+    friend MobilityLanesAvx2 nonzero_mask(MobilityLanesAvx2 a) {
+        const auto zero = _mm256_cmpeq_epi64(a.v, _mm256_setzero_si256());
+        return { _mm256_xor_si256(zero, _mm256_set1_epi64x(-1)) };
+    }
+    // Number of set bits in each lane, by looking up each nibble and summing
+    // the bytes of each lane.
+    friend MobilityLanesAvx2 popcount(MobilityLanesAvx2 a) {
+        const auto lut = _mm256_setr_epi8(
+            0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+            0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4
+        );
+        const auto low_mask = _mm256_set1_epi8(0x0f);
+        const auto lo = _mm256_and_si256(a.v, low_mask);
+        const auto hi = _mm256_and_si256(_mm256_srli_epi16(a.v, 4), low_mask);
+        const auto counts = _mm256_add_epi8(_mm256_shuffle_epi8(lut, lo), _mm256_shuffle_epi8(lut, hi));
+        return { _mm256_sad_epu8(counts, _mm256_setzero_si256()) };
+    }
+};
+using MobilityLanes = MobilityLanesAvx2;
+#else
+using MobilityLanes = MobilityLanesScalar;
+#endif
+
+namespace mobility_detail {
+
+    inline constexpr std::uint64_t file_a = 0x0101010101010101;
+    inline constexpr std::uint64_t file_b = file_a << 1;
+    inline constexpr std::uint64_t file_g = file_a << 6;
+    inline constexpr std::uint64_t file_h = file_a << 7;
+    inline constexpr std::uint64_t rank_3 = std::uint64_t(0xff) << 16;
+    inline constexpr std::uint64_t rank_8 = std::uint64_t(0xff) << 56;
+
+    // Shift of each square index, and the squares that can be reached
+    // without wrapping around the board.
+    struct Step {
+        int           offset;
+        std::uint64_t valid;
+    };
+    inline constexpr Step north      {  8, ~std::uint64_t(0) };
+    inline constexpr Step south      { -8, ~std::uint64_t(0) };
+    inline constexpr Step east       {  1, ~file_a };
+    inline constexpr Step west       { -1, ~file_h };
+    inline constexpr Step north_east {  9, ~file_a };
+    inline constexpr Step north_west {  7, ~file_h };
+    inline constexpr Step south_east { -7, ~file_a };
+    inline constexpr Step south_west { -9, ~file_h };
+
+    inline constexpr Step knight_steps[] {
+        {  17, ~file_a },            {  15, ~file_h },
+        {  10, ~(file_a | file_b) }, {   6, ~(file_g | file_h) },
+        {  -6, ~(file_a | file_b) }, { -10, ~(file_g | file_h) },
+        { -15, ~file_a },            { -17, ~file_h },
+    };
+
+    // Lines through the king, along which pieces can be pinned.
+    enum class PinLine { vertical, horizontal, diagonal, anti_diagonal };
+
+    template< int offset, typename V >
+    V shift_raw(V b) {
+        if constexpr(offset > 0) return shift_left< offset >(b);
+        else                     return shift_right< -offset >(b);
+    }
+
+    template< Step step, typename V >
+    V shift(V b) {
+        return shift_raw< step.offset >(b) & V::broadcast(step.valid);
+    }
+
+    // Squares reachable by sliding from the sources through empty squares,
+    // including the first blocker (Kogge-Stone fill).
+    template< Step step, typename V >
+    V slide(V sources, V empty) {
+        auto pro = empty & V::broadcast(step.valid);
+        sources = sources | (pro & shift_raw< step.offset >(sources));
+        pro = pro & shift_raw< step.offset >(pro);
+        sources = sources | (pro & shift_raw< 2 * step.offset >(sources));
+        pro = pro & shift_raw< 2 * step.offset >(pro);
+        sources = sources | (pro & shift_raw< 4 * step.offset >(sources));
+        return shift< step >(sources);
+    }
+
+    template< typename V >
+    V king_attacks(V b) {
+        return shift< north >(b) | shift< south >(b) | shift< east >(b) | shift< west >(b)
+            | shift< north_east >(b) | shift< north_west >(b) | shift< south_east >(b) | shift< south_west >(b);
+    }
+
+    template< typename V >
+    V knight_attacks(V b) {
+        V res = V::broadcast(0);
+        [&]< std::size_t... i >(std::index_sequence< i... >) {
+            ((res = res | shift< knight_steps[i] >(b)), ...);
+        }(std::make_index_sequence< std::size(knight_steps) >{});
+        return res;
+    }
+
+    // Piece bitboards of 4 positions, from the side to move, which plays
+    // upwards. Pieces are indexed by (Occupation - white_king).
+    struct PositionLanes {
+        inline static constexpr int num_piece_types = 6;
+
+        std::uint64_t own[num_piece_types][4] {};
+        std::uint64_t enemy[num_piece_types][4] {};
+        // Castling rights of the side to move, which are on rank 1.
+        bool          castle_queen[4] {};
+        bool          castle_king[4] {};
+    };
+
+    enum class LaneKind { bitboard, scalar, invalid };
+
+    // Adds a position to a lane. The lane must be cleared before.
+    inline LaneKind set_lane(PositionLanes& lanes, int lane, const PackedPosition& packed) {
+        using enum Occupation;
+
+        if(packed.en_passant_column < -1 || packed.en_passant_column >= BoardState::width) return LaneKind::invalid;
+
+        const bool black_turn = packed.flags & PackedPosition::flag_black_turn;
+        int num_kings[2] {};
+        for(int i = 0; i < BoardState::size; ++i) {
+            const int o = (packed.board[i / 2] >> (i % 2 * 4)) & 0xf;
+            if(o == underlying(empty)) continue;
+            if(o >= num_occupation_state()) return LaneKind::invalid;
+
+            const bool black_piece = o >= underlying(black_king);
+            const int  type = o - underlying(black_piece ? black_king : white_king);
+            if(type == 0) ++num_kings[black_piece];
+            // Flipping the ranks turns black into the side playing upwards.
+            const int  square = black_turn ? i ^ 56 : i;
+            auto&      bitboards = black_piece == black_turn ? lanes.own : lanes.enemy;
+            bitboards[type][lane] |= std::uint64_t(1) << square;
+        }
+        if(num_kings[0] != 1 || num_kings[1] != 1) return LaneKind::invalid;
+
+        lanes.castle_queen[lane] = packed.flags & (black_turn ? PackedPosition::flag_black_castle_queen : PackedPosition::flag_white_castle_queen);
+        lanes.castle_king[lane]  = packed.flags & (black_turn ? PackedPosition::flag_black_castle_king  : PackedPosition::flag_white_castle_king);
+
+        // Castling is only generated with the king on its initial square,
+        // and then counted from the bitboards if the rook is also there.
+        constexpr int type_rook = underlying(white_rook) - underlying(white_king);
+        const auto    king = lanes.own[0][lane];
+        const auto    rooks = lanes.own[type_rook][lane];
+        if(king == std::uint64_t(1) << 4) {
+            if(lanes.castle_queen[lane] && !(rooks & 1))                       return LaneKind::scalar;
+            if(lanes.castle_king[lane]  && !(rooks & (std::uint64_t(1) << 7))) return LaneKind::scalar;
+        }
+        else {
+            lanes.castle_queen[lane] = lanes.castle_king[lane] = false;
+        }
+
+        return packed.en_passant_column >= 0 ? LaneKind::scalar : LaneKind::bitboard;
+    }
+
+    // Counts the valid operations in each lane.
+    template< typename V >
+    void count_lanes(const PositionLanes& lanes, std::int64_t (&counts)[4]) {
+        constexpr int k = 0, q = 1, r = 2, b = 3, n = 4, p = 5;
+
+        V own[6], enemy[6];
+        for(int t = 0; t < 6; ++t) {
+            own[t] = V::load(lanes.own[t]);
+            enemy[t] = V::load(lanes.enemy[t]);
+        }
+        const auto own_all   = own[k] | own[q] | own[r] | own[b] | own[n] | own[p];
+        const auto enemy_all = enemy[k] | enemy[q] | enemy[r] | enemy[b] | enemy[n] | enemy[p];
+        const auto all_ones  = V::broadcast(~std::uint64_t(0));
+        const auto empty     = andnot(own_all | enemy_all, all_ones);
+        const auto king      = own[k];
+
+        const auto own_cross    = own[r] | own[q];
+        const auto own_diag     = own[b] | own[q];
+        const auto enemy_cross  = enemy[r] | enemy[q];
+        const auto enemy_diag   = enemy[b] | enemy[q];
+
+        // Squares attacked by the enemy, with the king removed so that it
+        // cannot hide behind itself.
+        const auto empty_without_king = empty | king;
+        const auto danger =
+            shift< south_east >(enemy[p]) | shift< south_west >(enemy[p])
+            | knight_attacks(enemy[n])
+            | king_attacks(enemy[k])
+            | slide< north >(enemy_cross, empty_without_king) | slide< south >(enemy_cross, empty_without_king)
+            | slide< east >(enemy_cross, empty_without_king)  | slide< west >(enemy_cross, empty_without_king)
+            | slide< north_east >(enemy_diag, empty_without_king) | slide< north_west >(enemy_diag, empty_without_king)
+            | slide< south_east >(enemy_diag, empty_without_king) | slide< south_west >(enemy_diag, empty_without_king);
+
+        // Checkers, the squares between the king and sliding checkers, and
+        // pinned pieces for each line through the king. An adjacent enemy
+        // king only occurs in malformed positions, but is counted as the
+        // scalar rules do.
+        auto checkers = (knight_attacks(king) & enemy[n])
+            | ((shift< north_east >(king) | shift< north_west >(king)) & enemy[p])
+            | (king_attacks(king) & enemy[k]);
+        auto check_rays = V::broadcast(0);
+        V    pinned[4] { V::broadcast(0), V::broadcast(0), V::broadcast(0), V::broadcast(0) };
+        const auto scan_line = [&]< Step step >(PinLine line, V enemy_sliders) {
+            const auto ray = slide< step >(king, empty);
+            const auto blocker = ray & andnot(empty, all_ones);
+            const auto checker = blocker & enemy_sliders;
+            checkers = checkers | checker;
+            check_rays = check_rays | (ray & nonzero_mask(checker));
+
+            const auto own_blocker = blocker & own_all;
+            const auto pinner = slide< step >(own_blocker, empty) & enemy_sliders;
+            pinned[underlying(line)] = pinned[underlying(line)] | (own_blocker & nonzero_mask(pinner));
+        };
+        scan_line.template operator()< north >(PinLine::vertical, enemy_cross);
+        scan_line.template operator()< south >(PinLine::vertical, enemy_cross);
+        scan_line.template operator()< east >(PinLine::horizontal, enemy_cross);
+        scan_line.template operator()< west >(PinLine::horizontal, enemy_cross);
+        scan_line.template operator()< north_east >(PinLine::diagonal, enemy_diag);
+        scan_line.template operator()< south_west >(PinLine::diagonal, enemy_diag);
+        scan_line.template operator()< north_west >(PinLine::anti_diagonal, enemy_diag);
+        scan_line.template operator()< south_east >(PinLine::anti_diagonal, enemy_diag);
+
+        // Non-king moves must capture or block a single checker, and are
+        // impossible in double check.
+        const auto in_check     = nonzero_mask(checkers);
+        const auto double_check = nonzero_mask(checkers & (checkers - V::broadcast(1)));
+        const auto check_mask   = andnot(in_check, all_ones) | andnot(double_check, checkers | check_rays);
+        const auto target_mask  = andnot(own_all, check_mask);
+        const auto pinned_all   = pinned[0] | pinned[1] | pinned[2] | pinned[3];
+        // Pieces that can move along the line.
+        const auto movable = [&](PinLine line) { return andnot(pinned_all, all_ones) | pinned[underlying(line)]; };
+
+        auto total = V::broadcast(0);
+
+        // Queens, rooks and bishops. The rays of sources in the same
+        // direction never overlap, so the targets are counted together.
+        const auto count_slides = [&]< Step step >(PinLine line, V sources) {
+            total = total + popcount(slide< step >(sources & movable(line), empty) & target_mask);
+        };
+        count_slides.template operator()< north >(PinLine::vertical, own_cross);
+        count_slides.template operator()< south >(PinLine::vertical, own_cross);
+        count_slides.template operator()< east >(PinLine::horizontal, own_cross);
+        count_slides.template operator()< west >(PinLine::horizontal, own_cross);
+        count_slides.template operator()< north_east >(PinLine::diagonal, own_diag);
+        count_slides.template operator()< south_west >(PinLine::diagonal, own_diag);
+        count_slides.template operator()< north_west >(PinLine::anti_diagonal, own_diag);
+        count_slides.template operator()< south_east >(PinLine::anti_diagonal, own_diag);
+
+        // Knights. Pinned knights cannot move.
+        const auto knights = andnot(pinned_all, own[n]);
+        [&]< std::size_t... i >(std::index_sequence< i... >) {
+            ((total = total + popcount(shift< knight_steps[i] >(knights) & target_mask)), ...);
+        }(std::make_index_sequence< std::size(knight_steps) >{});
+
+        // Pawns. Moves to the last rank are promotions to each of 4 pieces.
+        const auto last_rank = V::broadcast(rank_8);
+        const auto count_pawn_targets = [&](V targets) {
+            const auto promotions = popcount(targets & last_rank);
+            total = total + popcount(andnot(last_rank, targets)) + shift_left< 2 >(promotions);
+        };
+        const auto single_push = shift< north >(own[p] & movable(PinLine::vertical)) & empty;
+        const auto double_push = shift< north >(single_push & V::broadcast(rank_3)) & empty;
+        count_pawn_targets(single_push & check_mask);
+        count_pawn_targets(double_push & check_mask);
+        count_pawn_targets(shift< north_east >(own[p] & movable(PinLine::diagonal)) & enemy_all & check_mask);
+        count_pawn_targets(shift< north_west >(own[p] & movable(PinLine::anti_diagonal)) & enemy_all & check_mask);
+
+        // King.
+        total = total + popcount(king_attacks(king) & andnot(own_all | danger, all_ones));
+
+        std::uint64_t total_out[4], danger_out[4], empty_out[4], in_check_out[4];
+        total.store(total_out);
+        danger.store(danger_out);
+        empty.store(empty_out);
+        in_check.store(in_check_out);
+
+        // Castling, with the king and the rook on their initial squares.
+        for(int lane = 0; lane < 4; ++lane) {
+            counts[lane] = static_cast< std::int64_t >(total_out[lane]);
+            if(in_check_out[lane]) continue;
+            const auto is_empty = [&](int x) { return (empty_out[lane] >> x) & 1; };
+            const auto is_safe  = [&](int x) { return !((danger_out[lane] >> x) & 1); };
+            if(lanes.castle_queen[lane] && is_empty(1) && is_empty(2) && is_empty(3) && is_safe(2) && is_safe(3)) ++counts[lane];
+            if(lanes.castle_king[lane] && is_empty(5) && is_empty(6) && is_safe(5) && is_safe(6)) ++counts[lane];
+        }
+    }
+
+    inline int count_scalar(const PackedPosition& packed) {
+        GameState game_state;
+        if(!unpack_position(packed, game_state)) return -1;
+        return count_valid_operations(game_state, standard_zobrist_table(), 0);
+    }
+
+} // namespace mobility_detail
+
+// Counts the valid operations of each position into counts, which must have
+// the same size as positions. A count is -1 if the position is malformed as
+// in unpack_position.
+//
+// Lanes: MobilityLanes, or MobilityLanesScalar to avoid SIMD.
+template< typename Lanes = MobilityLanes >
+inline void count_valid_operations_batch(std::span< const PackedPosition > positions, std::span< int > counts) {
+    using namespace mobility_detail;
+
+    if(counts.size() != positions.size()) {
+        throw std::invalid_argument("Batch mobility spans do not match.");
+    }
+
+    for(std::size_t first = 0; first < positions.size(); first += 4) {
+        const int num_lanes = static_cast< int >(std::min< std::size_t >(4, positions.size() - first));
+
+        PositionLanes lanes;
+        LaneKind      kinds[4] { LaneKind::invalid, LaneKind::invalid, LaneKind::invalid, LaneKind::invalid };
+        for(int lane = 0; lane < num_lanes; ++lane) {
+            kinds[lane] = set_lane(lanes, lane, positions[first + lane]);
+        }
+
+        std::int64_t lane_counts[4];
+        count_lanes< Lanes >(lanes, lane_counts);
+
+        for(int lane = 0; lane < num_lanes; ++lane) {
+            auto& count = counts[first + lane];
+            switch(kinds[lane]) {
+                case LaneKind::bitboard: count = static_cast< int >(lane_counts[lane]); break;
+                case LaneKind::scalar:   count = count_scalar(positions[first + lane]); break;
+                case LaneKind::invalid:  count = -1; break;
+            }
+
+            if constexpr(debug) {
+                if(count != count_scalar(positions[first + lane])) {
+                    throw std::logic_error("Batch mobility count does not match the scalar count.");
+                }
+            }
+        }
+    }
+}
+
+} // namespace chess
+
+#endif
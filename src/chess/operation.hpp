@@ -1,11 +1,16 @@
 #ifndef CHESS_CHESS_OPERATION_HPP
 #define CHESS_CHESS_OPERATION_HPP
 
+#include <array>
+#include <cstdint>
 #include <iostream>
-#include <string>
+#include <span>
+#include <stdexcept>
 #include <tuple>
 
 #include "chess/board.hpp"
+#include "chess/tablebase.hpp"
+#include "trace.hpp"
 #include "utility.hpp"
 
 namespace chess {
@@ -39,25 +44,161 @@ struct Operation {
     int code2 = code2_normal;
 };
 
+// Compact 16-bit encoding of an operation, excluding code2.
+//   bits 0-5:   source square index
+//   bits 6-11:  destination square index
+//   bits 12-15: kind
+//
+// The color of a promoted piece is implied by the destination rank.
+using PackedOperation = std::uint16_t;
+enum class PackedOperationKind {
+    none, move, castle,
+    promote_queen, promote_rook, promote_bishop, promote_knight,
+    resign, draw_accept
+};
+
+constexpr PackedOperation pack_operation(const Operation& op) {
+    using enum Occupation;
+    using K = PackedOperationKind;
+
+    K kind = K::none;
+    switch(op.category) {
+        case Operation::Category::none:        kind = K::none;        break;
+        case Operation::Category::move:        kind = K::move;        break;
+        case Operation::Category::castle:      kind = K::castle;      break;
+        case Operation::Category::resign:      kind = K::resign;      break;
+        case Operation::Category::draw_accept: kind = K::draw_accept; break;
+        case Operation::Category::promote:
+            switch(static_cast< Occupation >(op.code)) {
+                case white_queen:  case black_queen:  kind = K::promote_queen;  break;
+                case white_rook:   case black_rook:   kind = K::promote_rook;   break;
+                case white_bishop: case black_bishop: kind = K::promote_bishop; break;
+                default:                              kind = K::promote_knight; break;
+            }
+            break;
+    }
+
+    // Squares of operations without board coordinates are not stored.
+    if(kind == K::none || kind == K::resign || kind == K::draw_accept) {
+        return static_cast< PackedOperation >(underlying(kind) << 12);
+    }
+    return static_cast< PackedOperation >(
+        BoardState::coord_to_index(op.x0, op.y0)
+        | (BoardState::coord_to_index(op.x1, op.y1) << 6)
+        | (underlying(kind) << 12)
+    );
+}
+
+constexpr Operation unpack_operation(PackedOperation packed, int code2 = Operation::code2_normal) {
+    using enum Occupation;
+    using K = PackedOperationKind;
+
+    Operation op;
+    std::tie(op.x0, op.y0) = BoardState::index_to_coord(packed & 63);
+    std::tie(op.x1, op.y1) = BoardState::index_to_coord((packed >> 6) & 63);
+    op.code2 = code2;
+
+    const bool black_promote = op.y1 == 0;
+    switch(static_cast< K >(packed >> 12)) {
+        case K::move:           op.category = Operation::Category::move;   break;
+        case K::castle:         op.category = Operation::Category::castle; break;
+        case K::promote_queen:  op.category = Operation::Category::promote; op.code = underlying(black_promote ? black_queen  : white_queen);  break;
+        case K::promote_rook:   op.category = Operation::Category::promote; op.code = underlying(black_promote ? black_rook   : white_rook);   break;
+        case K::promote_bishop: op.category = Operation::Category::promote; op.code = underlying(black_promote ? black_bishop : white_bishop); break;
+        case K::promote_knight: op.category = Operation::Category::promote; op.code = underlying(black_promote ? black_knight : white_knight); break;
+        case K::resign:         op = Operation { Operation::Category::resign };      op.code2 = code2; break;
+        case K::draw_accept:    op = Operation { Operation::Category::draw_accept }; op.code2 = code2; break;
+        default:                op = Operation {}; break;
+    }
+    return op;
+}
+
+// Reasons for rejecting an operation. The text is only looked up when shown,
+// so that rejections on hot paths, such as move generation, stay cheap.
+enum class OperationError {
+    none,
+
+    // validate_operation
+    null_operation,
+    draw_not_offered,
+    not_a_piece,
+    not_a_valid_move,
+    black_turn,
+    white_turn,
+    destination_out_of_range,
+    invalid_king_move,
+    invalid_king_castle,
+    invalid_king_operation,
+    invalid_queen_operation,
+    invalid_queen_move,
+    invalid_bishop_operation,
+    invalid_bishop_move,
+    invalid_rook_operation,
+    invalid_rook_move,
+    invalid_knight_operation,
+    invalid_knight_move,
+    invalid_pawn_promote,
+    invalid_pawn_move,
+
+    // game_round and batch validation
+    king_attacked,
+    cannot_claim_draw,
+    invalid_position,
+
+    last_
+};
+constexpr const char* operation_error_text[] {
+    "",
+
+    "Null operation not allowed.",
+    "Draw not offered.",
+    "Not a piece.",
+    "Not a valid move.",
+    "Black turn.",
+    "White turn.",
+    "Dst out of range.",
+    "Invalid king move.",
+    "Invalid king castle.",
+    "Invalid king operation.",
+    "Invalid queen operation.",
+    "Invalid queen move.",
+    "Invalid bishop operation.",
+    "Invalid bishop move.",
+    "Invalid rook operation.",
+    "Invalid rook move.",
+    "Invalid knight operation.",
+    "Invalid knight move.",
+    "Invalid pawn promote.",
+    "Invalid pawn move.",
+
+    "King will be attacked.",
+    "Cannot claim draw.",
+    "Invalid position.",
+};
+static_assert(std::size(operation_error_text) == underlying(OperationError::last_));
+constexpr auto text(OperationError e) { return operation_error_text[underlying(e)]; }
+
 struct OperationValidationResult {
-    bool okay = false;
-    std::string error_message;
+    bool           okay = false;
+    OperationError error = OperationError::none;
 };
 // This function assumes that
 //   - The game is not in the checkmate state.
+//   - c is the side to move.
 //
 // Note:
 //   - This function does not check whether the move would leave the king in a
 //     checked state.
 //   - This function does not check whether a draw claim is valid.
-inline auto validate_operation(const GameState& game_state, Operation op) {
+template< Color c >
+inline OperationValidationResult validate_operation(const GameState& game_state, Operation op) {
     using enum Occupation;
-
-    const bool black_turn = game_state.board_state.black_turn;
+    using Friend = ColorTraits< c >;
+    constexpr Color enemy = opposite(c);
 
     // early termination with special categories
     if(op.category == Operation::Category::none) {
-        return OperationValidationResult { false, "Null operation not allowed." };
+        return OperationValidationResult { false, OperationError::null_operation };
     }
     else if(op.category == Operation::Category::resign) {
         return OperationValidationResult { true };
@@ -67,7 +208,7 @@ inline auto validate_operation(const GameState& game_state, Operation op) {
             return OperationValidationResult { true };
         }
         else {
-            return OperationValidationResult { false, "Draw not offered." };
+            return OperationValidationResult { false, OperationError::draw_not_offered };
         }
     }
 
@@ -75,93 +216,53 @@ inline auto validate_operation(const GameState& game_state, Operation op) {
     auto occu_before = game_state.board_state(op.x0, op.y0);
 
     if(occu_before == empty) {
-        return OperationValidationResult { false, "Not a piece." };
+        return OperationValidationResult { false, OperationError::not_a_piece };
     }
     if(op.x0 == op.x1 && op.y0 == op.y1) {
-        return OperationValidationResult { false, "Not a valid move." };
-    }
-    if(is_white_piece(occu_before) && black_turn) {
-        return OperationValidationResult { false, "Black turn." };
+        return OperationValidationResult { false, OperationError::not_a_valid_move };
     }
-    if(is_black_piece(occu_before) && !black_turn) {
-        return OperationValidationResult { false, "White turn." };
+    if(!Friend::is_friend(occu_before)) {
+        return OperationValidationResult { false, Friend::black ? OperationError::black_turn : OperationError::white_turn };
     }
     // check target valid
     if(!BoardState::is_location_valid(op.x1, op.y1)) {
-        return OperationValidationResult { false, "Dst out of range." };
+        return OperationValidationResult { false, OperationError::destination_out_of_range };
     }
 
     auto occu_after = game_state.board_state(op.x1, op.y1);
 
-    const bool target_occupied_by_friend = black_turn ? is_black_piece(occu_after) : is_white_piece(occu_after);
-    const bool target_occupied_by_enemy  = black_turn ? is_white_piece(occu_after) : is_black_piece(occu_after);
+    const bool target_occupied_by_friend = Friend::is_friend(occu_after);
+    const bool target_occupied_by_enemy  = Friend::is_enemy(occu_after);
 
     // auxiliary functions
     const auto check_king_move = [&] {
         return (abs(op.x0 - op.x1) <= 1 && abs(op.y0 - op.y1) <= 1)
             && !target_occupied_by_friend
-            && !game_state.board_state.position_attacked(op.x1, op.y1, !black_turn);
+            && !game_state.board_state.position_attacked< enemy >(op.x1, op.y1);
     };
     const auto check_king_castle = [&] {
-        return 
-            (
-                // white castle
-                (
-                    !black_turn && (
-                        // white queen
-                        (
-                            game_state.board_state.white_castle_queen
-                            && !game_state.check
-                            && op.x0 == 4 && op.y0 == 0
-                            && op.x1 == 2 && op.y1 == 0
-                            && game_state.board_state(1, 0) == empty
-                            && game_state.board_state(2, 0) == empty
-                            && game_state.board_state(3, 0) == empty
-                            && !game_state.board_state.position_attacked(2, 0, true)
-                            && !game_state.board_state.position_attacked(3, 0, true)
-                        )
-                        // white king
-                        || (
-                            game_state.board_state.white_castle_king
-                            && !game_state.check
-                            && op.x0 == 4 && op.y0 == 0
-                            && op.x1 == 6 && op.y1 == 0
-                            && game_state.board_state(5, 0) == empty
-                            && game_state.board_state(6, 0) == empty
-                            && !game_state.board_state.position_attacked(5, 0, true)
-                            && !game_state.board_state.position_attacked(6, 0, true)
-                        )
-                    )
-                )
-                // or black castle
-                || (
-                    black_turn && (
-                        // black queen
-                        (
-                            game_state.board_state.black_castle_queen
-                            && !game_state.check
-                            && op.x0 == 4 && op.y0 == 7
-                            && op.x1 == 2 && op.y1 == 7
-                            && game_state.board_state(1, 7) == empty
-                            && game_state.board_state(2, 7) == empty
-                            && game_state.board_state(3, 7) == empty
-                            && !game_state.board_state.position_attacked(2, 7, false)
-                            && !game_state.board_state.position_attacked(3, 7, false)
-                        )
-                        // black king
-                        || (
-                            game_state.board_state.black_castle_king
-                            && !game_state.check
-                            && op.x0 == 4 && op.y0 == 7
-                            && op.x1 == 6 && op.y1 == 7
-                            && game_state.board_state(5, 0) == empty
-                            && game_state.board_state(6, 0) == empty
-                            && !game_state.board_state.position_attacked(5, 7, false)
-                            && !game_state.board_state.position_attacked(6, 7, false)
-                        )
-                    )
-                )
-            );
+        constexpr int y = Friend::back_y;
+        const auto& board_state = game_state.board_state;
+        if(game_state.check || op.x0 != 4 || op.y0 != y || op.y1 != y) return false;
+
+        // queen side
+        if(op.x1 == 2) {
+            return (Friend::black ? board_state.black_castle_queen : board_state.white_castle_queen)
+                && board_state(1, y) == empty
+                && board_state(2, y) == empty
+                && board_state(3, y) == empty
+                && !board_state.position_attacked< enemy >(2, y)
+                && !board_state.position_attacked< enemy >(3, y);
+        }
+        // king side
+        if(op.x1 == 6) {
+            return (Friend::black ? board_state.black_castle_king : board_state.white_castle_king)
+                && board_state(5, y) == empty
+                && board_state(6, y) == empty
+                && !board_state.position_attacked< enemy >(5, y)
+                && !board_state.position_attacked< enemy >(6, y);
+        }
+        return false;
     };
 
     const auto check_diag_move = [&] {
@@ -235,7 +336,7 @@ inline auto validate_operation(const GameState& game_state, Operation op) {
             &&
                 (
                     (abs(op.y1 - op.y0) == 2 && abs(op.x1 - op.x0) == 1) ||
-                    (abs(op.y1 - op.y0) == 1 && abs(op.x1 - op.x0) == 1)
+                    (abs(op.y1 - op.y0) == 1 && abs(op.x1 - op.x0) == 2)
                 );
     };
 
@@ -243,132 +344,114 @@ inline auto validate_operation(const GameState& game_state, Operation op) {
         return
             // move forward
             (
-                op.y1 - op.y0 == (black_turn ? -1 : 1)
+                op.y1 - op.y0 == Friend::pawn_dy
                 && op.x1 == op.x0
                 && !target_occupied_by_friend
                 && !target_occupied_by_enemy
             )
             // or skip forward
             || (
-                op.y0    == (black_turn ? 6 : 1)
-                && op.y1 == (black_turn ? 4 : 3)
+                op.y0    == Friend::pawn_initial_y
+                && op.y1 == Friend::pawn_initial_y + 2 * Friend::pawn_dy
                 && op.x1 == op.x0
                 && !target_occupied_by_friend
                 && !target_occupied_by_enemy
-                && game_state.board_state(op.x0, op.y0 + (black_turn ? -1 : 1)) == empty
+                && game_state.board_state(op.x0, op.y0 + Friend::pawn_dy) == empty
             )
             // or capture
             || (
-                op.y1 - op.y0 == (black_turn ? -1 : 1)
+                op.y1 - op.y0 == Friend::pawn_dy
                 && abs(op.x1 - op.x0) == 1
                 && target_occupied_by_enemy
             )
             // or en passant capture
             || (
-                op.y0    == (black_turn ? 3 : 4)
-                && op.y1 == (black_turn ? 2 : 5)
+                op.y0    == Friend::pawn_en_passant_y
+                && op.y1 == Friend::pawn_en_passant_y + Friend::pawn_dy
                 && abs(op.x1 - op.x0) == 1
                 && op.x1 == game_state.board_state.en_passant_column
-                && game_state.board_state(op.x1, op.y0) == (black_turn ? white_pawn : black_pawn)
+                && game_state.board_state(op.x1, op.y0) == ColorTraits< enemy >::pawn
                 && !target_occupied_by_friend
                 && !target_occupied_by_enemy
             );
     };
     const auto check_pawn_promote = [&] {
         return
-            (
-                !black_turn && (
-                    op.code == underlying(white_queen) ||
-                    op.code == underlying(white_rook) ||
-                    op.code == underlying(white_bishop) ||
-                    op.code == underlying(white_knight)
-                )
-            )
-            || (
-                black_turn && (
-                    op.code == underlying(black_queen) ||
-                    op.code == underlying(black_rook) ||
-                    op.code == underlying(black_bishop) ||
-                    op.code == underlying(black_knight)
-                )
-            );
+            op.code == underlying(Friend::queen) ||
+            op.code == underlying(Friend::rook) ||
+            op.code == underlying(Friend::bishop) ||
+            op.code == underlying(Friend::knight);
     };
 
 
     switch(occu_before) {
         // king
-        case white_king: [[fallthrough]];
-        case black_king:
+        case Friend::king:
 
             if(op.category == Operation::Category::move) {
                 if(!check_king_move()) {
-                    return OperationValidationResult { false, "Invalid king move." };
+                    return OperationValidationResult { false, OperationError::invalid_king_move };
                 }
             }
             else if(op.category == Operation::Category::castle) {
                 if(!check_king_castle()) {
-                    return OperationValidationResult { false, "Invalid king castle." };
+                    return OperationValidationResult { false, OperationError::invalid_king_castle };
                 }
             }
             else {
-                return OperationValidationResult { false, "Invalid king operation." };
+                return OperationValidationResult { false, OperationError::invalid_king_operation };
             }
             break;
 
-        case white_queen: [[fallthrough]];
-        case black_queen:
+        case Friend::queen:
 
             if(op.category != Operation::Category::move) {
-                return OperationValidationResult { false, "Invalid queen operation." };
+                return OperationValidationResult { false, OperationError::invalid_queen_operation };
             }
             if(!check_diag_move() && !check_cross_move()) {
-                return OperationValidationResult { false, "Invalid queen move." };
+                return OperationValidationResult { false, OperationError::invalid_queen_move };
             }
             break;
 
-        case white_bishop: [[fallthrough]];
-        case black_bishop:
+        case Friend::bishop:
 
             if(op.category != Operation::Category::move) {
-                return OperationValidationResult { false, "Invalid bishop operation." };
+                return OperationValidationResult { false, OperationError::invalid_bishop_operation };
             }
             if(!check_diag_move()) {
-                return OperationValidationResult { false, "Invalid bishop move." };
+                return OperationValidationResult { false, OperationError::invalid_bishop_move };
             }
             break;
 
-        case white_rook: [[fallthrough]];
-        case black_rook:
+        case Friend::rook:
 
             if(op.category != Operation::Category::move) {
-                return OperationValidationResult { false, "Invalid rook operation." };
+                return OperationValidationResult { false, OperationError::invalid_rook_operation };
             }
             if(!check_cross_move()) {
-                return OperationValidationResult { false, "Invalid rook move." };
+                return OperationValidationResult { false, OperationError::invalid_rook_move };
             }
             break;
 
-        case white_knight: [[fallthrough]];
-        case black_knight:
+        case Friend::knight:
 
             if(op.category != Operation::Category::move) {
-                return OperationValidationResult { false, "Invalid knight operation." };
+                return OperationValidationResult { false, OperationError::invalid_knight_operation };
             }
             if(!check_knight_move()) {
-                return OperationValidationResult { false, "Invalid knight move." };
+                return OperationValidationResult { false, OperationError::invalid_knight_move };
             }
             break;
 
-        case white_pawn: [[fallthrough]];
-        case black_pawn:
+        case Friend::pawn:
 
-            if(op.y1 == (black_turn ? 0 : 7)) {
+            if(op.y1 == Friend::promotion_y) {
                 if(
                     op.category != Operation::Category::promote
                     || !check_pawn_move()
                     || !check_pawn_promote()
                 ) {
-                    return OperationValidationResult { false, "Invalid pawn promote." };
+                    return OperationValidationResult { false, OperationError::invalid_pawn_promote };
                 }
             }
             else {
@@ -376,39 +459,73 @@ inline auto validate_operation(const GameState& game_state, Operation op) {
                     op.category != Operation::Category::move
                     || !check_pawn_move()
                 ) {
-                    return OperationValidationResult { false, "Invalid pawn move." };
+                    return OperationValidationResult { false, OperationError::invalid_pawn_move };
                 }
             }
             break;
+
+        default:
+            break;
     }
 
     return OperationValidationResult { true };
 }
 
+inline OperationValidationResult validate_operation(const GameState& game_state, Operation op) {
+    return game_state.board_state.black_turn
+        ? validate_operation< Color::black >(game_state, op)
+        : validate_operation< Color::white >(game_state, op);
+}
+
 // Apply an operation in place without checking for validity.
 //
+// c must be the side to move.
+//
 // Returns the new board state hash
-inline auto apply_operation_in_place(
+template< Color c >
+inline BoardStateZobristTable::HashInt apply_operation_in_place(
     GameState&                      game_state,
     BoardStateZobristTable::HashInt board_state_hash,
     Operation                       op,
     const BoardStateZobristTable&   hash_table
 ) {
     using enum Occupation;
+    using Friend = ColorTraits< c >;
+    constexpr int back_y = Friend::back_y;
 
     auto& board_state = game_state.board_state;
-    const bool black_turn = board_state.black_turn;
+    auto& friend_king_x = Friend::black ? game_state.black_king_x : game_state.white_king_x;
+    auto& friend_king_y = Friend::black ? game_state.black_king_y : game_state.white_king_y;
 
-    const auto is_enemy = [&](Occupation o) {
-        return (black_turn ? is_white_piece(o) : is_black_piece(o));
-    };
     const auto set_piece = [&](int x, int y, Occupation o) {
+        game_state.material.remove(board_state(x, y), x, y);
+        game_state.material.add(o, x, y);
         aux_hash_set_board_piece(board_state_hash, board_state, hash_table, x, y, o);
     };
     const auto disable_white_castle_queen = [&] { aux_hash_set_bool(board_state_hash, board_state.white_castle_queen, hash_table.white_castle_queen, false); };
     const auto disable_white_castle_king  = [&] { aux_hash_set_bool(board_state_hash, board_state.white_castle_king,  hash_table.white_castle_king,  false); };
     const auto disable_black_castle_queen = [&] { aux_hash_set_bool(board_state_hash, board_state.black_castle_queen, hash_table.black_castle_queen, false); };
     const auto disable_black_castle_king  = [&] { aux_hash_set_bool(board_state_hash, board_state.black_castle_king,  hash_table.black_castle_king,  false); };
+    const auto disable_friend_castle_queen = [&] {
+        if constexpr(Friend::black) disable_black_castle_queen();
+        else                        disable_white_castle_queen();
+    };
+    const auto disable_friend_castle_king = [&] {
+        if constexpr(Friend::black) disable_black_castle_king();
+        else                        disable_white_castle_king();
+    };
+    // A rook captured on its initial square can no longer castle. Only enemy
+    // rooks can be captured.
+    const auto disable_castle_of_captured_rook = [&](int x, int y) {
+        if constexpr(Friend::black) {
+            if(x == 0 && y == 0) disable_white_castle_queen();
+            if(x == 7 && y == 0) disable_white_castle_king();
+        }
+        else {
+            if(x == 0 && y == 7) disable_black_castle_queen();
+            if(x == 7 && y == 7) disable_black_castle_king();
+        }
+    };
 
     const auto piece0 = board_state(op.x0, op.y0);
 
@@ -425,7 +542,7 @@ inline auto apply_operation_in_place(
         const auto piece1 = board_state(op.x1, op.y1);
 
         // pawn special
-        if(piece0 == black_pawn || piece0 == white_pawn) {
+        if(piece0 == Friend::pawn) {
             // en passant
             if(piece1 == empty && op.x0 != op.x1) {
                 // captured
@@ -437,7 +554,7 @@ inline auto apply_operation_in_place(
                 // check enemy pawn immediately at left or right
                 const auto has_enemy_pawn = [&](int nx, int ny) {
                     return BoardState::is_location_valid(nx, ny)
-                        && board_state(nx, ny) == (black_turn ? white_pawn : black_pawn);
+                        && board_state(nx, ny) == ColorTraits< opposite(c) >::pawn;
                 };
                 if(has_enemy_pawn(op.x1 - 1, op.y1) || has_enemy_pawn(op.x1 + 1, op.y1)) {
                     // set en passant column
@@ -449,29 +566,20 @@ inline auto apply_operation_in_place(
         }
 
         // castle disabling
-        if(piece0 == white_rook) {
-            if(op.x0 == 0 && op.y0 == 0) disable_white_castle_queen();
-            if(op.x0 == 7 && op.y0 == 0) disable_white_castle_king();
-        }
-        if(piece0 == black_rook) {
-            if(op.x0 == 0 && op.y0 == 7) disable_black_castle_queen();
-            if(op.x0 == 7 && op.y0 == 7) disable_black_castle_king();
-        }
-        if(piece0 == white_king) {
-            disable_white_castle_queen();
-            disable_white_castle_king();
-            game_state.white_king_x = op.x1;
-            game_state.white_king_y = op.y1;
+        if(piece0 == Friend::rook) {
+            if(op.x0 == 0 && op.y0 == back_y) disable_friend_castle_queen();
+            if(op.x0 == 7 && op.y0 == back_y) disable_friend_castle_king();
         }
-        if(piece0 == black_king) {
-            disable_black_castle_queen();
-            disable_black_castle_king();
-            game_state.black_king_x = op.x1;
-            game_state.black_king_y = op.y1;
+        if(piece0 == Friend::king) {
+            disable_friend_castle_queen();
+            disable_friend_castle_king();
+            friend_king_x = op.x1;
+            friend_king_y = op.y1;
         }
 
         // check capture
         if(piece1 != empty) { capture_made = true; }
+        disable_castle_of_captured_rook(op.x1, op.y1);
 
         set_piece(op.x1, op.y1, piece0);
         set_piece(op.x0, op.y0, empty);
@@ -483,50 +591,25 @@ inline auto apply_operation_in_place(
 
     }
     else if(op.category == Operation::Category::castle) {
-        if(op.y1 == 0) {
-            if(op.x1 == 2) {
-                // white queen
-                set_piece(op.x0, op.y0, empty);
-                set_piece(0,     0,     empty);
-                set_piece(2,     0,     white_king);
-                set_piece(3,     0,     white_rook);
-                game_state.white_king_x = 2;
-                game_state.white_king_y = 0;
-            }
-            else {
-                // white king
-                set_piece(op.x0, op.y0, empty);
-                set_piece(7,     0,     empty);
-                set_piece(6,     0,     white_king);
-                set_piece(5,     0,     white_rook);
-                game_state.white_king_x = 6;
-                game_state.white_king_y = 0;
-            }
-            disable_white_castle_queen();
-            disable_white_castle_king();
+        if(op.x1 == 2) {
+            // queen side
+            set_piece(op.x0, op.y0, empty);
+            set_piece(0,     back_y, empty);
+            set_piece(2,     back_y, Friend::king);
+            set_piece(3,     back_y, Friend::rook);
+            friend_king_x = 2;
         }
         else {
-            if(op.x1 == 2) {
-                // black queen
-                set_piece(op.x0, op.y0, empty);
-                set_piece(0,     7,     empty);
-                set_piece(2,     7,     black_king);
-                set_piece(3,     7,     black_rook);
-                game_state.black_king_x = 2;
-                game_state.black_king_y = 7;
-            }
-            else {
-                // black king
-                set_piece(op.x0, op.y0, empty);
-                set_piece(7,     7,     empty);
-                set_piece(6,     7,     black_king);
-                set_piece(5,     7,     black_rook);
-                game_state.black_king_x = 6;
-                game_state.black_king_y = 7;
-            }
-            disable_black_castle_queen();
-            disable_black_castle_king();
+            // king side
+            set_piece(op.x0, op.y0, empty);
+            set_piece(7,     back_y, empty);
+            set_piece(6,     back_y, Friend::king);
+            set_piece(5,     back_y, Friend::rook);
+            friend_king_x = 6;
         }
+        friend_king_y = back_y;
+        disable_friend_castle_queen();
+        disable_friend_castle_king();
 
         // draw offer
         if(op.code2 == Operation::code2_draw_offer) {
@@ -536,6 +619,7 @@ inline auto apply_operation_in_place(
     else if(op.category == Operation::Category::promote) {
         pawn_moved = true;
         if(board_state(op.x1, op.y1) != empty) { capture_made = true; }
+        disable_castle_of_captured_rook(op.x1, op.y1);
 
         set_piece(op.x1, op.y1, static_cast<Occupation>(op.code));
         set_piece(op.x0, op.y0, empty);
@@ -546,7 +630,7 @@ inline auto apply_operation_in_place(
         }
     }
     else if(op.category == Operation::Category::resign) {
-        game_state.status = black_turn ? GameState::Status::white_win : GameState::Status::black_win;
+        game_state.status = Friend::black ? GameState::Status::white_win : GameState::Status::black_win;
     }
     else if(op.category == Operation::Category::draw_accept) {
         game_state.status = GameState::Status::draw;
@@ -562,20 +646,31 @@ inline auto apply_operation_in_place(
     return board_state_hash;
 }
 
+inline BoardStateZobristTable::HashInt apply_operation_in_place(
+    GameState&                      game_state,
+    BoardStateZobristTable::HashInt board_state_hash,
+    Operation                       op,
+    const BoardStateZobristTable&   hash_table
+) {
+    return game_state.board_state.black_turn
+        ? apply_operation_in_place< Color::black >(game_state, board_state_hash, op, hash_table)
+        : apply_operation_in_place< Color::white >(game_state, board_state_hash, op, hash_table);
+}
+
 
 // This function generates all valid moves without checking king checked
 // status.
 //
-// Func: function type with signature (Operation) -> void
+// c must be the side to move.
 //
-// Note:
-//   - This function does not generate promotion operation for pawns
-template< typename Func >
+// Func: function type with signature (Operation) -> void
+template< Color c, typename Func >
 inline void pseudo_valid_operation_generator(const GameState& game_state, Func&& func) {
     using enum Occupation;
+    using Friend = ColorTraits< c >;
 
     const auto validate_and_run_func = [&](Operation op) {
-        if(validate_operation(game_state, op).okay) {
+        if(validate_operation< c >(game_state, op).okay) {
             func(op);
         }
     };
@@ -585,6 +680,32 @@ inline void pseudo_valid_operation_generator(const GameState& game_state, Func&&
             Operation { Operation::Category::move, x, y, x + dx, y + dy }
         );
     };
+    const auto gen_targets_move = [&](int x, int y, const SquareTargets& targets) {
+        for(const int t : targets) {
+            const auto [x1, y1] = BoardState::index_to_coord(t);
+            validate_and_run_func(
+                Operation { Operation::Category::move, x, y, x1, y1 }
+            );
+        }
+    };
+    // Pawn moves to the last rank are generated as promotions to each piece.
+    const auto gen_pawn_targets_move = [&](int x, int y, const SquareTargets& targets) {
+        for(const int t : targets) {
+            const auto [x1, y1] = BoardState::index_to_coord(t);
+            if(y1 == Friend::promotion_y) {
+                for(const auto piece : { Friend::queen, Friend::rook, Friend::bishop, Friend::knight }) {
+                    validate_and_run_func(
+                        Operation { Operation::Category::promote, x, y, x1, y1, underlying(piece) }
+                    );
+                }
+            }
+            else {
+                validate_and_run_func(
+                    Operation { Operation::Category::move, x, y, x1, y1 }
+                );
+            }
+        }
+    };
     const auto gen_dir_move = [&](int x, int y, int x_dir, int y_dir) {
         for(int step = 1; step < BoardState::max_side_size; ++step) {
             gen_move(x, y, step * x_dir, step * y_dir);
@@ -605,101 +726,170 @@ inline void pseudo_valid_operation_generator(const GameState& game_state, Func&&
 
     for(int i = 0; i < BoardState::size; ++i) {
         const auto piece = game_state.board_state.board[i];
-        if(game_state.board_state.black_turn ? is_black_piece(piece) : is_white_piece(piece)) {
-            const auto [x, y] = BoardState::index_to_coord(i);
-
-            switch(piece) {
-                case white_king: [[fallthrough]];
-                case black_king:
+        if(!Friend::is_friend(piece)) continue;
 
-                    // generate move
-                    for(int dx = -1; dx <= 1; ++dx) for(int dy = -1; dy <= 1; ++dy) if(dx || dy) {
-                        gen_move(x, y, dx, dy);
-                    }
-                    // generate castle
-                    if(piece == white_king && x == 4 && y == 0) {
-                        validate_and_run_func(Operation { Operation::Category::castle, 4, 0, 2, 0 });
-                        validate_and_run_func(Operation { Operation::Category::castle, 4, 0, 6, 0 });
-                    }
-                    if(piece == black_king && x == 4 && y == 7) {
-                        validate_and_run_func(Operation { Operation::Category::castle, 4, 7, 2, 7 });
-                        validate_and_run_func(Operation { Operation::Category::castle, 4, 7, 6, 7 });
-                    }
-                    break;
+        const auto [x, y] = BoardState::index_to_coord(i);
 
-                case white_queen: [[fallthrough]];
-                case black_queen:
+        switch(piece) {
+            case Friend::king:
 
-                    // generate move
-                    gen_cross_move(x, y);
-                    gen_diag_move(x, y);
-                    break;
+                // generate move
+                gen_targets_move(x, y, king_targets[i]);
+                // generate castle
+                if(x == 4 && y == Friend::back_y) {
+                    validate_and_run_func(Operation { Operation::Category::castle, 4, Friend::back_y, 2, Friend::back_y });
+                    validate_and_run_func(Operation { Operation::Category::castle, 4, Friend::back_y, 6, Friend::back_y });
+                }
+                break;
 
-                case white_rook: [[fallthrough]];
-                case black_rook:
+            case Friend::queen:
 
-                    gen_cross_move(x, y);
-                    break;
+                // generate move
+                gen_cross_move(x, y);
+                gen_diag_move(x, y);
+                break;
 
-                case white_bishop: [[fallthrough]];
-                case black_bishop:
+            case Friend::rook:
 
-                    gen_diag_move(x, y);
-                    break;
+                gen_cross_move(x, y);
+                break;
 
-                case white_knight: [[fallthrough]];
-                case black_knight:
+            case Friend::bishop:
 
-                    gen_move(x, y, 2, 1);
-                    gen_move(x, y, 1, 2);
-                    gen_move(x, y, -1, 2);
-                    gen_move(x, y, -2, 1);
-                    gen_move(x, y, -2, -1);
-                    gen_move(x, y, -1, -2);
-                    gen_move(x, y, 1, -2);
-                    gen_move(x, y, 2, -1);
-                    break;
+                gen_diag_move(x, y);
+                break;
 
-                case white_pawn:
+            case Friend::knight:
 
-                    gen_move(x, y, 0, 2);
-                    gen_move(x, y, -1, 1);
-                    gen_move(x, y, 0, 1);
-                    gen_move(x, y, 1, 1);
-                    break;
+                gen_targets_move(x, y, knight_targets[i]);
+                break;
 
-                case black_pawn:
+            case Friend::pawn:
 
-                    gen_move(x, y, 0, -2);
-                    gen_move(x, y, -1, -1);
-                    gen_move(x, y, 0, -1);
-                    gen_move(x, y, 1, -1);
-                    break;
+                gen_pawn_targets_move(x, y, pawn_push_targets[Friend::black][i]);
+                gen_pawn_targets_move(x, y, pawn_attack_targets[Friend::black][i]);
+                break;
 
-            }
+            default:
+                break;
         }
     }
 }
 
+template< typename Func >
+inline void pseudo_valid_operation_generator(const GameState& game_state, Func&& func) {
+    if(game_state.board_state.black_turn) pseudo_valid_operation_generator< Color::black >(game_state, func);
+    else                                  pseudo_valid_operation_generator< Color::white >(game_state, func);
+}
+
+// This function generates all valid moves that do not leave the king in a
+// checked state.
+//
+// Func: function type with signature (Operation) -> void
+template< typename Func >
+inline void valid_operation_generator(
+    const GameState&                game_state,
+    const BoardStateZobristTable&   hash_table,
+    BoardStateZobristTable::HashInt board_state_hash,
+    Func&&                          func
+) {
+    // The side to move is dispatched once for all operations.
+    const auto generate = [&]< Color c >() {
+        pseudo_valid_operation_generator< c >(
+            game_state,
+            [&](Operation op) {
+                auto new_game_state = game_state;
+                apply_operation_in_place< c >(new_game_state, board_state_hash, op, hash_table);
+
+                // The side to move is not switched yet.
+                if(!new_game_state.board_state.position_attacked< opposite(c) >(new_game_state.friend_king_x(), new_game_state.friend_king_y())) {
+                    func(op);
+                }
+            }
+        );
+    };
+    if(game_state.board_state.black_turn) generate.template operator()< Color::black >();
+    else                                  generate.template operator()< Color::white >();
+}
+
+// Returns whether the operation is valid and does not leave the king in a
+// checked state.
+//
+// Note:
+//   - This function does not check whether a draw claim is valid.
+inline bool is_operation_legal(const GameState& game_state, const Operation& op) {
+    if(!validate_operation(game_state, op).okay) return false;
+    if(op.category == Operation::Category::resign || op.category == Operation::Category::draw_accept) return true;
+
+    // The hash value is not needed.
+    auto new_game_state = game_state;
+    apply_operation_in_place(new_game_state, 0, op, standard_zobrist_table());
+    return !new_game_state.board_state.position_attacked(new_game_state.friend_king_x(), new_game_state.friend_king_y(), !new_game_state.board_state.black_turn);
+}
+
+// Applies a valid operation and passes the turn, for searches that do not
+// need the hash value. The check state is updated for the next player, as
+// operation validation reads it, but the status is not.
+inline GameState game_state_after(const GameState& game_state, const Operation& op) {
+    auto res = game_state;
+    apply_operation_in_place(res, 0, op, standard_zobrist_table());
+    auto& board_state = res.board_state;
+    board_state.black_turn = !board_state.black_turn;
+    res.check = board_state.position_attacked(res.friend_king_x(), res.friend_king_y(), !board_state.black_turn);
+    return res;
+}
+
 inline int count_valid_operations(
     const GameState&                game_state,
     const BoardStateZobristTable&   hash_table,
     BoardStateZobristTable::HashInt board_state_hash
 ) {
+    TraceScope trace("count_valid_operations");
+
     int count = 0;
+    valid_operation_generator(game_state, hash_table, board_state_hash, [&](Operation) { ++count; });
+    return count;
+}
 
-    pseudo_valid_operation_generator(
-        game_state,
-        [&](Operation op) {
-            auto new_game_state = game_state;
-            apply_operation_in_place(new_game_state, board_state_hash, op, hash_table);
+// Recomputes the derived fields of a game state from the board: king
+// positions, check, material, and the status if the player to move has no
+// valid operation or neither side can mate.
+//
+// Returns false if the board does not have exactly one king of each color.
+inline bool update_derived_state(GameState& game_state, const BoardStateZobristTable& hash_table) {
+    using enum Occupation;
 
-            if(!new_game_state.board_state.position_attacked(new_game_state.friend_king_x(), new_game_state.friend_king_y(), !new_game_state.board_state.black_turn)) {
-                ++count;
-            }
+    int num_white_kings = 0, num_black_kings = 0;
+    for(int i = 0; i < BoardState::size; ++i) {
+        const auto [x, y] = BoardState::index_to_coord(i);
+        if(game_state.board_state.board[i] == white_king) {
+            ++num_white_kings;
+            game_state.white_king_x = x;
+            game_state.white_king_y = y;
         }
-    );
-    return count;
+        else if(game_state.board_state.board[i] == black_king) {
+            ++num_black_kings;
+            game_state.black_king_x = x;
+            game_state.black_king_y = y;
+        }
+    }
+    if(num_white_kings != 1 || num_black_kings != 1) return false;
+
+    game_state.check = game_state.board_state.position_attacked(game_state.friend_king_x(), game_state.friend_king_y(), !game_state.board_state.black_turn);
+    game_state.material = material_signature(game_state.board_state);
+
+    if(game_state.status == GameState::Status::active) {
+        if(game_state.material.insufficient()) {
+            game_state.status = GameState::Status::draw;
+        }
+        else if(count_valid_operations(game_state, hash_table, hash(game_state.board_state, hash_table)) == 0) {
+            game_state.status =
+                !game_state.check                   ? GameState::Status::draw
+                : game_state.board_state.black_turn ? GameState::Status::white_win
+                :                                     GameState::Status::black_win;
+        }
+    }
+    return true;
 }
 
 //-----------------------------------------------------------------------------
@@ -735,12 +925,19 @@ struct GameHistory {
         BoardStateZobristTable::HashInt board_state_hash = 0;
     };
 
+    // Items of the current line, followed by the items undone, which can be
+    // redone until another item is pushed.
     std::vector< GameHistoryItem > history;
+    // Number of items in the current line. The current item is the last one.
+    std::size_t                    num_current_items = 0;
+    // Incremented whenever the current line changes, so that data derived
+    // from the current item can be cached.
+    std::uint64_t                  version = 0;
 
     // The board state hash.
     //
     // Each item refers to the board state corresponding to a game state with
-    // index in the game history.
+    // index in the current line. Items undone are not referred to.
     //
     // The equal range of any key represents the possible range of board states
     // that may compare equal.
@@ -754,24 +951,93 @@ struct GameHistory {
     //   - Changing this value may break the board_state_ref multiset.
     BoardStateZobristTable zobrist_table = BoardStateZobristTable::generate();
 
+    // The full move number of the first item, as in FEN.
+    int initial_fullmove_number = 1;
+
+    // If not null, game_round adjudicates positions found in the endgame
+    // tablebases. Not owned.
+    const Tablebases* p_tablebases = nullptr;
+
     // Default constructor to initialize with the standard opening.
     GameHistory() {
-        auto new_game_state = game_standard_opening();
+        reset(game_standard_opening());
+    }
+    // Starts from an arbitrary game state. The derived fields of the game
+    // state are recomputed.
+    //
+    // Throws std::invalid_argument if the board does not have exactly one
+    // king of each color.
+    explicit GameHistory(const GameState& initial_game_state, int initial_fullmove_number = 1) {
+        auto new_game_state = initial_game_state;
+        if(!update_derived_state(new_game_state, zobrist_table)) {
+            throw std::invalid_argument("Game state must have exactly one king of each color.");
+        }
+        reset(new_game_state, initial_fullmove_number);
+    }
+
+    // Clears the history and starts from the game state, whose derived fields
+    // should be up to date. The Zobrist table is kept.
+    void reset(const GameState& initial_game_state, int initial_fullmove_number = 1) {
+        history.clear();
+        num_current_items = 0;
+        board_state_ref.clear();
+        this->initial_fullmove_number = initial_fullmove_number;
         push_game_state(
             Operation {},
-            new_game_state,
-            hash_board_state(new_game_state.board_state)
+            initial_game_state,
+            hash_board_state(initial_game_state.board_state)
         );
     }
 
     // This function gives the current game_state situation. This function
     // hides the implementation detail of the history vector. For example, if
-    // the game allows undoing and redoing moves, the current state might be
-    // not at the back of the vector.
+    // moves have been undone, the current state is not at the back of the
+    // vector.
     //
     // Returns null if there is no current item.
     auto ptr_current_item() const {
-        return history.empty() ? nullptr : &history.back();
+        return num_current_items == 0 ? nullptr : &history[num_current_items - 1];
+    }
+
+    // The items from the initial game state to the current item.
+    std::span< const GameHistoryItem > current_items() const {
+        return { history.data(), num_current_items };
+    }
+    auto num_items() const { return num_current_items; }
+
+    auto can_undo() const { return num_current_items > 1; }
+    auto can_redo() const { return num_current_items < history.size(); }
+
+    // Takes back the current item, keeping it for redo. The initial item is
+    // never undone. Returns false if there is nothing to undo.
+    bool undo() {
+        if(!can_undo()) return false;
+        --num_current_items;
+        erase_board_state_ref(num_current_items);
+        ++version;
+        return true;
+    }
+
+    // Restores the item last undone. Returns false if there is nothing to redo.
+    bool redo() {
+        if(!can_redo()) return false;
+        board_state_ref.insert({ history[num_current_items].board_state_hash, static_cast<int>(num_current_items) });
+        ++num_current_items;
+        ++version;
+        return true;
+    }
+
+    // Moves the current item to the given number of items along the current
+    // line and the items undone, by undoing or redoing one item at a time.
+    // Pushing an item afterwards branches from there, discarding the items
+    // after it.
+    //
+    // Returns false, without moving, if the number of items is out of range.
+    bool seek(std::size_t num_items) {
+        if(num_items == 0 || num_items > history.size()) return false;
+        while(num_current_items > num_items) undo();
+        while(num_current_items < num_items) redo();
+        return true;
     }
 
     BoardStateZobristTable::HashInt hash_board_state(const BoardState& board_state) const {
@@ -783,13 +1049,36 @@ struct GameHistory {
             if(hash_board_state(game_state.board_state) != board_state_hash) {
                 throw std::logic_error("Board state hash does not match.");
             }
+            if(material_signature(game_state.board_state) != game_state.material) {
+                throw std::logic_error("Material signature does not match.");
+            }
         }
 
+        // Pushing after undo starts a new line.
+        history.resize(num_current_items);
+
         board_state_ref.insert({
             board_state_hash,
             static_cast<int>(history.size())
         });
         history.push_back({ op, game_state, board_state_hash });
+        ++num_current_items;
+        ++version;
+    }
+
+    // Removes the reference to the item at the index, among the references
+    // with the same hash.
+    void erase_board_state_ref(std::size_t index) {
+        const auto same_hash_range = board_state_ref.equal_range({ history[index].board_state_hash });
+        for(auto it = same_hash_range.first; it != same_hash_range.second; ++it) {
+            if(it->index == static_cast<int>(index)) {
+                board_state_ref.erase(it);
+                return;
+            }
+        }
+        if constexpr(debug) {
+            throw std::logic_error("Board state reference is not found.");
+        }
     }
 
     auto count_board_state_repetition(const BoardState& board_state, BoardStateZobristTable::HashInt board_state_hash) const {
@@ -813,12 +1102,18 @@ struct GameHistory {
 
 // Returns whether the operation is valid.
 //
+// History: GameHistory, or a line of a game tree (GameTreeCursor), which
+// provides the members used here in the same way.
+//
 // Note:
 //   - New game state will be pushed only if the operation is valid. Otherwise,
 //     no progress will be made in game.
-inline bool game_round(GameHistory& game_history, const Operation& op, std::ostream& os) {
+template< typename History >
+inline bool game_round(History& game_history, const Operation& op, std::ostream& os) {
     using enum Occupation;
 
+    TraceScope trace("game_round");
+
     auto p_current_item = game_history.ptr_current_item();
     if(p_current_item == nullptr) {
         os << "Game history is empty." << std::endl;
@@ -831,15 +1126,17 @@ inline bool game_round(GameHistory& game_history, const Operation& op, std::ostr
     //---------------------------------
     // operation pre-validation
     //---------------------------------
+    TraceScope trace_phase("game_round/pre_validation");
     const auto op_validation = validate_operation(game_state, op);
     if(!op_validation.okay) {
-        os << "Invalid operation: " << op_validation.error_message << std::endl;
+        os << "Invalid operation: " << text(op_validation.error) << std::endl;
         return false;
     }
 
     //---------------------------------
     // apply the operation
     //---------------------------------
+    trace_phase.next("game_round/apply");
 
     auto new_game_state = game_state;
     auto new_board_state_hash = apply_operation_in_place(new_game_state, board_state_hash, op, game_history.zobrist_table);
@@ -847,10 +1144,11 @@ inline bool game_round(GameHistory& game_history, const Operation& op, std::ostr
     //---------------------------------
     // post validation
     //---------------------------------
+    trace_phase.next("game_round/post_validation");
     if(new_game_state.status == GameState::Status::active) {
         // check whether king is under attack
         if(new_game_state.board_state.position_attacked(new_game_state.friend_king_x(), new_game_state.friend_king_y(), !new_game_state.board_state.black_turn)) {
-            os << "Invalid operation: king will be attacked." << std::endl;
+            os << "Invalid operation: " << text(OperationError::king_attacked) << std::endl;
             // reject new game state
             return false;
         }
@@ -860,6 +1158,7 @@ inline bool game_round(GameHistory& game_history, const Operation& op, std::ostr
     // toggle turn
     aux_hash_set_bool(new_board_state_hash, new_game_state.board_state.black_turn, game_history.zobrist_table.black_turn, !new_game_state.board_state.black_turn);
 
+    trace_phase.next("game_round/repetition");
     const int num_repetition = game_history.count_board_state_repetition(new_game_state.board_state, new_board_state_hash);
 
     if(new_game_state.status == GameState::Status::active) {
@@ -876,7 +1175,7 @@ inline bool game_round(GameHistory& game_history, const Operation& op, std::ostr
             }
             else {
                 // draw claim invalid
-                os << "Invalid operation: cannot claim draw." << std::endl;
+                os << "Invalid operation: " << text(OperationError::cannot_claim_draw) << std::endl;
                 return false;
             }
         }
@@ -886,15 +1185,20 @@ inline bool game_round(GameHistory& game_history, const Operation& op, std::ostr
     //---------------------------------
     // post processing
     //---------------------------------
+    // Includes the valid operation count, traced on its own.
+    trace_phase.next("game_round/post_processing");
 
     if(new_game_state.status == GameState::Status::active) {
 
         // update check status
         new_game_state.check = new_game_state.board_state.position_attacked(new_game_state.friend_king_x(), new_game_state.friend_king_y(), !new_game_state.board_state.black_turn);
 
-        // check whether this player can make any valid move
-        const int num_valid_op = count_valid_operations(new_game_state, game_history.zobrist_table, new_board_state_hash);
-        if(num_valid_op == 0) {
+        // Dead position by insufficient material. Mate is impossible, so the
+        // valid moves need not be counted.
+        if(new_game_state.material.insufficient()) {
+            new_game_state.status = GameState::Status::draw;
+        }
+        else if(const int num_valid_op = count_valid_operations(new_game_state, game_history.zobrist_table, new_board_state_hash); num_valid_op == 0) {
             if(new_game_state.check) {
                 // checkmate, the opponent (ie the player of this function) wins
                 new_game_state.status = new_game_state.board_state.black_turn ? GameState::Status::white_win : GameState::Status::black_win;
@@ -914,18 +1218,56 @@ inline bool game_round(GameHistory& game_history, const Operation& op, std::ostr
             ) {
                 new_game_state.status = GameState::Status::draw;
             }
+            // tablebase adjudication, by the result under best play
+            else if(game_history.p_tablebases && new_game_state.material.num_pieces() <= max_tablebase_pieces) {
+                if(const auto tb_res = game_history.p_tablebases->probe(new_game_state)) {
+                    using enum TablebaseResult::Wdl;
+                    const bool white_wins = (tb_res->wdl == win) != new_game_state.board_state.black_turn;
+                    if(tb_res->wdl == draw) {
+                        new_game_state.status = GameState::Status::draw;
+                    }
+                    // Once the fifty-move rule lets the defender claim a draw,
+                    // the mate is not forced, so the game goes on.
+                    else if(new_game_state.no_capture_no_pawn_move_streak + tb_res->plies_to_mate < 100) {
+                        new_game_state.status = white_wins ? GameState::Status::white_win : GameState::Status::black_win;
+                    }
+                }
+            }
         }
     }
 
     //---------------------------------
     // prepare for next turn
     //---------------------------------
+    trace_phase.next("game_round/push");
 
     game_history.push_game_state(op, new_game_state, new_board_state_hash);
 
     return true;
 }
 
+// Replays an operation known to be valid and to keep the game active, such as
+// one restored from a journal. Validation and end of game detection are
+// skipped, but otherwise the pushed game state is the same as in game_round.
+//
+// Note:
+//   - The final operation of a game should be replayed with game_round, so
+//     that the game status is computed.
+inline void game_round_trusted(GameHistory& game_history, const Operation& op) {
+    const auto& current_item = *game_history.ptr_current_item();
+
+    auto new_game_state = current_item.game_state;
+    auto new_board_state_hash = apply_operation_in_place(new_game_state, current_item.board_state_hash, op, game_history.zobrist_table);
+
+    // toggle turn
+    aux_hash_set_bool(new_board_state_hash, new_game_state.board_state.black_turn, game_history.zobrist_table.black_turn, !new_game_state.board_state.black_turn);
+
+    // update check status
+    new_game_state.check = new_game_state.board_state.position_attacked(new_game_state.friend_king_x(), new_game_state.friend_king_y(), !new_game_state.board_state.black_turn);
+
+    game_history.push_game_state(op, new_game_state, new_board_state_hash);
+}
+
 
 } // namespace chess
 
@@ -0,0 +1,62 @@
+#ifndef CHESS_CHESS_PERFT_HPP
+#define CHESS_CHESS_PERFT_HPP
+
+#include <cstdint>
+#include <vector>
+
+#include "chess/fen.hpp"
+#include "chess/operation.hpp"
+
+namespace chess {
+
+//-----------------------------------------------------------------------------
+// Move path enumeration (perft)
+//
+// Counts the leaf positions of the move tree to a fixed depth. Known counts
+// of well-studied positions check the move generation and the application of
+// operations together, including castling rights, en passant, promotions and
+// pins.
+//
+// Resignations and accepted draws are not counted, as they are not moves.
+//-----------------------------------------------------------------------------
+
+inline std::uint64_t perft(const GameState& game_state, int depth) {
+    if(depth == 0) return 1;
+
+    std::uint64_t res = 0;
+    valid_operation_generator(game_state, standard_zobrist_table(), 0, [&](Operation op) {
+        if(op.category == Operation::Category::resign || op.category == Operation::Category::draw_accept) return;
+        res += depth == 1 ? 1 : perft(game_state_after(game_state, op), depth - 1);
+    });
+    return res;
+}
+
+struct PerftPosition {
+    const char* name;
+    const char* fen;
+    // Known leaf counts, from depth 1.
+    std::vector< std::uint64_t > counts;
+};
+
+inline const std::vector< PerftPosition >& perft_positions() {
+    static const std::vector< PerftPosition > res {
+        { "opening", standard_opening_fen, { 20, 400, 8902, 197281, 4865609, 119060324 } },
+        // Castling through and out of attacks, pins, en passant and promotions.
+        { "kiwipete", "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1", { 48, 2039, 97862, 4085603, 193690690 } },
+        // Castling rights lost to rook moves and captures on both sides.
+        { "castling", "r3k2r/8/8/8/8/8/8/R3K2R w KQkq - 0 1", { 26, 568, 13744, 314346, 7594526 } },
+        // En passant, discovered checks and pins along ranks in the endgame.
+        { "endgame", "8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 1", { 14, 191, 2812, 43238, 674624, 11030083 } },
+        // Promotions with capture, and castling next to attacked squares.
+        { "promotion", "r3k2r/Pppp1ppp/1b3nbN/nP6/BBP1P3/q4N2/Pp1P2PP/R2Q1RK1 w kq - 0 1", { 6, 264, 9467, 422333, 15833292 } },
+        // Promotion on a square giving check, and knight checks.
+        { "check", "rnbq1k1r/pp1Pbppp/2p5/8/2B5/8/PPP1NnPP/RNBQK2R w KQ - 1 8", { 44, 1486, 62379, 2103487, 89941194 } },
+        // Underpromotion.
+        { "underpromotion", "n1n5/PPPk4/8/8/8/8/4Kppp/5N1N b - - 0 1", { 24, 496, 9483, 182838, 3605103 } },
+    };
+    return res;
+}
+
+} // namespace chess
+
+#endif
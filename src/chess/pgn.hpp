@@ -0,0 +1,568 @@
+#ifndef CHESS_CHESS_PGN_HPP
+#define CHESS_CHESS_PGN_HPP
+
+#include <algorithm> // min
+#include <atomic>
+#include <cstdint>
+#include <iostream>
+#include <limits>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "chess/fen.hpp"
+#include "chess/operation.hpp"
+
+namespace chess {
+
+//-----------------------------------------------------------------------------
+// Portable Game Notation (PGN)
+//
+// Moves are written in standard algebraic notation (SAN). SAN is parsed
+// against the legal operations of the current game state, so a parsed
+// operation can be played with game_round directly.
+//
+// The reader works on a contiguous view of the whole input, typically a
+// MappedFile, so that large databases are scanned without copying. Games are
+// indexed in one pass and then replayed in parallel.
+//
+// Games starting from a custom position use the SetUp and FEN tags.
+// Variations, comments and numeric annotation glyphs are skipped.
+//-----------------------------------------------------------------------------
+
+struct PgnTag {
+    std::string name;
+    std::string value;
+};
+
+constexpr const char* pgn_result_text(GameState::Status status) {
+    using enum GameState::Status;
+    switch(status) {
+        case white_win: return "1-0";
+        case black_win: return "0-1";
+        case draw:      return "1/2-1/2";
+        default:        return "*";
+    }
+}
+constexpr std::optional< GameState::Status > parse_pgn_result(std::string_view s) {
+    using enum GameState::Status;
+    if(s == "1-0")     return white_win;
+    if(s == "0-1")     return black_win;
+    if(s == "1/2-1/2") return draw;
+    if(s == "*")       return active;
+    return {};
+}
+
+//---------------------------------
+// SAN
+//---------------------------------
+
+// Parses a move in SAN, such as "Nbd7", "exd5", "e8=Q+" or "O-O".
+// Returns empty if the move is not recognized or not legal.
+//
+// Check and annotation suffixes are accepted but not verified.
+inline std::optional< Operation > parse_san(const GameState& game_state, std::string_view san) {
+    using enum Occupation;
+
+    const bool black_turn = game_state.board_state.black_turn;
+    const int  home_y = black_turn ? BoardState::height - 1 : 0;
+
+    // Strip suffixes.
+    while(!san.empty() && (san.back() == '+' || san.back() == '#' || san.back() == '!' || san.back() == '?')) {
+        san.remove_suffix(1);
+    }
+    if(san.ends_with("e.p.")) san.remove_suffix(4);
+
+    // Castle.
+    if(san == "O-O" || san == "0-0" || san == "O-O-O" || san == "0-0-0") {
+        const Operation op { Operation::Category::castle, 4, home_y, san.size() == 3 ? 6 : 2, home_y };
+        if(is_operation_legal(game_state, op)) return op;
+        return {};
+    }
+
+    // Piece type, with the color to move.
+    const auto colored = [&](Occupation white_piece) {
+        return black_turn ? static_cast< Occupation >(underlying(white_piece) + underlying(black_king) - underlying(white_king)) : white_piece;
+    };
+    const auto piece_of_letter = [&](char c) -> std::optional< Occupation > {
+        switch(c) {
+            case 'K': return colored(white_king);
+            case 'Q': return colored(white_queen);
+            case 'R': return colored(white_rook);
+            case 'B': return colored(white_bishop);
+            case 'N': return colored(white_knight);
+            default:  return {};
+        }
+    };
+
+    if(san.empty()) return {};
+    auto piece = colored(white_pawn);
+    if(const auto p = piece_of_letter(san.front())) {
+        piece = *p;
+        san.remove_prefix(1);
+    }
+
+    // Promotion, such as "=Q" or "Q".
+    Occupation promote = empty;
+    if(piece == colored(white_pawn) && !san.empty()) {
+        if(const auto p = piece_of_letter(san.back()); p && *p != colored(white_king)) {
+            promote = *p;
+            san.remove_suffix(1);
+            if(!san.empty() && san.back() == '=') san.remove_suffix(1);
+        }
+    }
+
+    // The rest is [file][rank][x|-]<file><rank>.
+    char chars[4] {};
+    int  num_chars = 0;
+    for(const char c : san) {
+        if(c == 'x' || c == '-' || c == ':') continue;
+        if(num_chars == 4) return {};
+        chars[num_chars++] = c;
+    }
+    if(num_chars < 2) return {};
+
+    const auto is_file = [](char c) { return 'a' <= c && c <= 'h'; };
+    const auto is_rank = [](char c) { return '1' <= c && c <= '8'; };
+    if(!is_file(chars[num_chars - 2]) || !is_rank(chars[num_chars - 1])) return {};
+    const int x1 = chars[num_chars - 2] - 'a';
+    const int y1 = chars[num_chars - 1] - '1';
+
+    // Disambiguation.
+    int from_x = -1, from_y = -1;
+    for(int i = 0; i < num_chars - 2; ++i) {
+        if(is_file(chars[i]))      from_x = chars[i] - 'a';
+        else if(is_rank(chars[i])) from_y = chars[i] - '1';
+        else                       return {};
+    }
+
+    std::optional< Operation > res;
+    for(int i = 0; i < BoardState::size; ++i) {
+        if(game_state.board_state.board[i] != piece) continue;
+        const auto [x0, y0] = BoardState::index_to_coord(i);
+        if((from_x >= 0 && x0 != from_x) || (from_y >= 0 && y0 != from_y)) continue;
+
+        const Operation op = promote == empty
+            ? Operation { Operation::Category::move,    x0, y0, x1, y1 }
+            : Operation { Operation::Category::promote, x0, y0, x1, y1, underlying(promote) };
+        if(is_operation_legal(game_state, op)) {
+            // Ambiguous.
+            if(res) return {};
+            res = op;
+        }
+    }
+    return res;
+}
+
+// Formats an operation in SAN, given the game state before and after it.
+// Returns an empty string for operations without a move, such as resignation.
+inline std::string san_text(const GameState& game_state, const Operation& op, const GameState& next_game_state) {
+    using enum Occupation;
+
+    std::string res;
+    const auto square = [&](int x, int y) {
+        res += static_cast< char >('a' + x);
+        res += static_cast< char >('1' + y);
+    };
+
+    if(op.category == Operation::Category::castle) {
+        res = op.x1 == 2 ? "O-O-O" : "O-O";
+    }
+    else if(op.category == Operation::Category::move || op.category == Operation::Category::promote) {
+        const auto piece = game_state.board_state(op.x0, op.y0);
+        const bool is_pawn = piece == white_pawn || piece == black_pawn;
+        const bool capture = game_state.board_state(op.x1, op.y1) != empty || (is_pawn && op.x0 != op.x1);
+
+        if(is_pawn) {
+            if(capture) res += static_cast< char >('a' + op.x0);
+        }
+        else {
+            res += letter(piece);
+
+            // Disambiguate from other pieces of the same type reaching the destination.
+            bool ambiguous = false, same_file = false, same_rank = false;
+            for(int i = 0; i < BoardState::size; ++i) {
+                const auto [x, y] = BoardState::index_to_coord(i);
+                if(game_state.board_state.board[i] != piece || (x == op.x0 && y == op.y0)) continue;
+                if(is_operation_legal(game_state, Operation { Operation::Category::move, x, y, op.x1, op.y1 })) {
+                    ambiguous = true;
+                    same_file |= x == op.x0;
+                    same_rank |= y == op.y0;
+                }
+            }
+            if(ambiguous) {
+                if(!same_file)      res += static_cast< char >('a' + op.x0);
+                else if(!same_rank) res += static_cast< char >('1' + op.y0);
+                else                square(op.x0, op.y0);
+            }
+        }
+
+        if(capture) res += 'x';
+        square(op.x1, op.y1);
+        if(op.category == Operation::Category::promote) {
+            res += '=';
+            res += letter(static_cast< Occupation >(op.code));
+        }
+    }
+    else {
+        return res;
+    }
+
+    if(next_game_state.check) {
+        // Mate is decided from the position, as the game may also end by
+        // adjudication on a check. The hash value is not needed.
+        const bool mate = count_valid_operations(next_game_state, standard_zobrist_table(), 0) == 0;
+        res += mate ? '#' : '+';
+    }
+    return res;
+}
+
+//---------------------------------
+// Writing
+//---------------------------------
+
+// Writes a game in PGN export format.
+//
+// The given tags are written in order. The Result tag is appended from the
+// game status unless given. The SetUp and FEN tags are appended if the game
+// does not start from the standard opening.
+inline void write_pgn(std::ostream& os, const GameHistory& game_history, const std::vector< PgnTag >& tags) {
+    const auto  history = game_history.current_items();
+    const auto  result = pgn_result_text(history.back().game_state.status);
+
+    const auto write_tag = [&](const std::string& name, const std::string& value) {
+        os << '[' << name << " \"";
+        for(const char c : value) {
+            if(c == '"' || c == '\\') os << '\\';
+            os << c;
+        }
+        os << "\"]\n";
+    };
+    bool has_result_tag = false;
+    for(const auto& tag : tags) {
+        write_tag(tag.name, tag.value);
+        has_result_tag |= tag.name == "Result";
+    }
+    if(!has_result_tag) {
+        write_tag("Result", result);
+    }
+    const auto& initial = history.front().game_state;
+    if(initial.board_state != game_standard_opening().board_state || initial.no_capture_no_pawn_move_streak != 0 || game_history.initial_fullmove_number != 1) {
+        write_tag("SetUp", "1");
+        write_tag("FEN", fen_text(initial, game_history.initial_fullmove_number));
+    }
+    os << '\n';
+
+    // Movetext, with lines of at most 80 characters.
+    constexpr std::size_t max_line_length = 80;
+    std::size_t line_length = 0;
+    const auto write_token = [&](const std::string& token) {
+        if(line_length > 0 && line_length + 1 + token.size() > max_line_length) {
+            os << '\n';
+            line_length = 0;
+        }
+        if(line_length > 0) {
+            os << ' ';
+            ++line_length;
+        }
+        os << token;
+        line_length += token.size();
+    };
+
+    // Plies counted from the white move of the initial full move.
+    const std::size_t ply_offset = initial.board_state.black_turn ? 1 : 0;
+    for(std::size_t i = 1; i < history.size(); ++i) {
+        const auto& prev = history[i - 1].game_state;
+        const auto  san = san_text(prev, history[i].op, history[i].game_state);
+        if(san.empty()) continue;
+
+        const auto move_number = std::to_string(game_history.initial_fullmove_number + (i - 1 + ply_offset) / 2);
+        if(!prev.board_state.black_turn) {
+            write_token(move_number + '.');
+        }
+        else if(i == 1) {
+            write_token(move_number + "...");
+        }
+        write_token(san);
+    }
+    write_token(result);
+    os << "\n\n";
+}
+
+//---------------------------------
+// Reading
+//---------------------------------
+
+// A game in the input, referring to the input text.
+struct PgnGameText {
+    std::string_view tags;
+    std::string_view movetext;
+};
+
+// Splits the input into games.
+//
+// Func: function type with signature (PgnGameText) -> void
+//
+// A game starts with a tag line, starting with '[', after the movetext of the
+// previous game. Comments spanning lines are tracked, so that a line in a
+// comment is never taken as a tag.
+template< typename Func >
+inline void for_each_pgn_game(std::string_view text, Func&& func) {
+    std::size_t tags_begin = 0, movetext_begin = std::string_view::npos;
+    int comment_depth = 0;
+
+    const auto emit = [&](std::size_t end) {
+        if(movetext_begin == std::string_view::npos) movetext_begin = end;
+        func(PgnGameText {
+            text.substr(tags_begin, movetext_begin - tags_begin),
+            text.substr(movetext_begin, end - movetext_begin),
+        });
+    };
+
+    std::size_t pos = 0;
+    while(pos < text.size()) {
+        auto line_end = text.find('\n', pos);
+        if(line_end == std::string_view::npos) line_end = text.size();
+        const auto line = text.substr(pos, line_end - pos);
+
+        if(comment_depth == 0 && !line.empty() && line.front() == '[') {
+            if(movetext_begin != std::string_view::npos) {
+                // A new game.
+                emit(pos);
+                tags_begin = pos;
+                movetext_begin = std::string_view::npos;
+            }
+        }
+        else {
+            if(movetext_begin == std::string_view::npos && line.find_first_not_of(" \t\r") != std::string_view::npos) {
+                movetext_begin = pos;
+            }
+            if(movetext_begin != std::string_view::npos) {
+                for(const char c : line) {
+                    if(c == '{') ++comment_depth;
+                    else if(c == '}' && comment_depth > 0) --comment_depth;
+                    // The rest of the line is a comment.
+                    else if(c == ';' && comment_depth == 0) break;
+                }
+            }
+        }
+        pos = line_end + 1;
+    }
+    if(tags_begin < text.size() && text.substr(tags_begin).find_first_not_of(" \t\r\n") != std::string_view::npos) {
+        emit(text.size());
+    }
+}
+
+// Parses the tag pairs of a game.
+inline std::vector< PgnTag > parse_pgn_tags(std::string_view tags) {
+    std::vector< PgnTag > res;
+    std::size_t pos = 0;
+    while((pos = tags.find('[', pos)) != std::string_view::npos) {
+        ++pos;
+        const auto name_end = tags.find_first_of(" \t\"]", pos);
+        if(name_end == std::string_view::npos) break;
+
+        PgnTag tag { std::string(tags.substr(pos, name_end - pos)) };
+        pos = tags.find('"', name_end);
+        if(pos == std::string_view::npos) break;
+        for(++pos; pos < tags.size() && tags[pos] != '"'; ++pos) {
+            if(tags[pos] == '\\' && pos + 1 < tags.size()) ++pos;
+            tag.value += tags[pos];
+        }
+        res.push_back(std::move(tag));
+    }
+    return res;
+}
+
+struct PgnReplayResult {
+    bool        okay = false;
+    // Declared by the result token. Empty if there is no result token.
+    std::optional< GameState::Status > result;
+    std::string error_message;
+};
+
+// Replays the movetext of a game through game_round.
+//
+// The declared result must agree with the game status if the game ended on
+// the board. Otherwise, the game may end by resignation, agreement or
+// adjudication, and stays active in the game history.
+//
+// If max_plies is given, replay stops successfully after that many moves, and
+// the result is not read.
+inline PgnReplayResult replay_pgn_movetext(GameHistory& game_history, std::string_view movetext, std::size_t max_plies = std::numeric_limits< std::size_t >::max()) {
+    PgnReplayResult res;
+    std::ostream null_os(nullptr);
+
+    const auto is_space = [](char c) { return c == ' ' || c == '\t' || c == '\r' || c == '\n'; };
+    const auto is_digit = [](char c) { return '0' <= c && c <= '9'; };
+    const auto error = [&](std::string message) {
+        res.error_message = "ply " + std::to_string(game_history.num_items()) + ": " + std::move(message);
+        return res;
+    };
+
+    std::size_t pos = 0;
+    std::size_t num_plies = 0;
+    const auto size = movetext.size();
+    while(pos < size && num_plies < max_plies) {
+        const char c = movetext[pos];
+        if(is_space(c) || c == '.') {
+            ++pos;
+        }
+        else if(c == '{') {
+            pos = movetext.find('}', pos);
+            if(pos == std::string_view::npos) return error("Unterminated comment.");
+            ++pos;
+        }
+        else if(c == ';') {
+            pos = movetext.find('\n', pos);
+            if(pos == std::string_view::npos) pos = size;
+        }
+        else if(c == '(') {
+            // Skip the variation, which may be nested and contain comments.
+            int depth = 0;
+            for(; pos < size; ++pos) {
+                if(movetext[pos] == '{') {
+                    pos = movetext.find('}', pos);
+                    if(pos == std::string_view::npos) return error("Unterminated comment.");
+                }
+                else if(movetext[pos] == '(') ++depth;
+                else if(movetext[pos] == ')' && --depth == 0) break;
+            }
+            if(depth != 0) return error("Unterminated variation.");
+            ++pos;
+        }
+        else if(c == '$') {
+            for(++pos; pos < size && is_digit(movetext[pos]); ++pos) {}
+        }
+        else {
+            auto token_end = pos;
+            while(token_end < size && !is_space(movetext[token_end]) && movetext[token_end] != '{' && movetext[token_end] != '(' && movetext[token_end] != ';') {
+                ++token_end;
+            }
+            const auto token = movetext.substr(pos, token_end - pos);
+
+            // Move number, such as "12." or "12...", possibly followed by a
+            // move without space.
+            if(is_digit(c)) {
+                auto digit_end = pos;
+                while(digit_end < token_end && is_digit(movetext[digit_end])) ++digit_end;
+                if(digit_end == token_end || movetext[digit_end] == '.') {
+                    pos = digit_end;
+                    continue;
+                }
+            }
+
+            if(const auto result = parse_pgn_result(token)) {
+                res.result = result;
+                pos = token_end;
+                // The result token terminates the game.
+                break;
+            }
+
+            const auto& game_state = game_history.ptr_current_item()->game_state;
+            if(game_state.status != GameState::Status::active) {
+                return error("Move " + std::string(token) + " after the game ended.");
+            }
+            const auto op = parse_san(game_state, token);
+            if(!op) {
+                return error("Illegal or ambiguous move " + std::string(token) + ".");
+            }
+            if(!game_round(game_history, *op, null_os)) {
+                return error("Rejected move " + std::string(token) + ".");
+            }
+            ++num_plies;
+            pos = token_end;
+        }
+    }
+
+    const auto status = game_history.ptr_current_item()->game_state.status;
+    if(status != GameState::Status::active && res.result && *res.result != status) {
+        return error(std::string("Result ") + pgn_result_text(*res.result) + " does not match the game, which ended in " + pgn_result_text(status) + ".");
+    }
+    res.okay = true;
+    return res;
+}
+
+// Replays a whole game. The game history is reset to the start position
+// given by the FEN tag, if any.
+inline PgnReplayResult replay_pgn_game(GameHistory& game_history, const PgnGameText& game, std::size_t max_plies = std::numeric_limits< std::size_t >::max()) {
+    for(const auto& tag : parse_pgn_tags(game.tags)) {
+        if(tag.name == "FEN") {
+            const auto fen = parse_fen(tag.value);
+            if(!fen.okay) {
+                return PgnReplayResult { false, {}, "Invalid FEN: " + fen.error_message };
+            }
+            game_history.reset(fen.game_state, fen.fullmove_number);
+        }
+    }
+    return replay_pgn_movetext(game_history, game.movetext, max_plies);
+}
+
+struct PgnValidationStats {
+    std::uint64_t num_games = 0;
+    std::uint64_t num_valid_games = 0;
+    std::uint64_t num_plies = 0;
+};
+
+// Replays all games of the input in parallel, using num_threads threads (0
+// for hardware concurrency).
+//
+// OnError: function type with signature
+//   (std::size_t game_index, const PgnGameText&, const std::string& error_message) -> void
+//   It is called serially, in no particular order.
+template< typename OnError >
+inline PgnValidationStats validate_pgn_games(std::string_view text, unsigned num_threads, OnError&& on_error) {
+    std::vector< PgnGameText > games;
+    for_each_pgn_game(text, [&](const PgnGameText& game) { games.push_back(game); });
+
+    // The Zobrist table is generated once and shared by copying.
+    const GameHistory initial_game_history;
+
+    std::atomic< std::size_t >   next_game { 0 };
+    std::atomic< std::uint64_t > num_valid_games { 0 };
+    std::atomic< std::uint64_t > num_plies { 0 };
+    std::mutex                   error_mutex;
+
+    const auto work = [&] {
+        // Games are taken in small batches, so that long games do not
+        // unbalance the threads.
+        constexpr std::size_t batch_size = 64;
+        std::uint64_t local_valid = 0, local_plies = 0;
+        while(true) {
+            const auto first = next_game.fetch_add(batch_size, std::memory_order_relaxed);
+            if(first >= games.size()) break;
+            const auto last = std::min(first + batch_size, games.size());
+            for(auto i = first; i < last; ++i) {
+                auto game_history = initial_game_history;
+                const auto res = replay_pgn_game(game_history, games[i]);
+                local_plies += game_history.num_items() - 1;
+                if(res.okay) {
+                    ++local_valid;
+                }
+                else {
+                    std::lock_guard lk(error_mutex);
+                    on_error(i, games[i], res.error_message);
+                }
+            }
+        }
+        num_valid_games += local_valid;
+        num_plies += local_plies;
+    };
+
+    if(num_threads == 0) num_threads = std::max(1u, std::thread::hardware_concurrency());
+    {
+        std::vector< std::thread > workers;
+        for(unsigned t = 1; t < num_threads; ++t) workers.emplace_back(work);
+        work();
+        for(auto& w : workers) w.join();
+    }
+
+    return PgnValidationStats { games.size(), num_valid_games.load(), num_plies.load() };
+}
+
+} // namespace chess
+
+#endif
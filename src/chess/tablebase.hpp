@@ -0,0 +1,309 @@
+#ifndef CHESS_CHESS_TABLEBASE_HPP
+#define CHESS_CHESS_TABLEBASE_HPP
+
+#include <algorithm> // min
+#include <atomic>
+#include <cstdint>
+#include <cstring> // memcmp
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "chess/board.hpp"
+#include "mapped_file.hpp"
+
+namespace chess {
+
+//-----------------------------------------------------------------------------
+// Endgame tablebases.
+//
+// A table holds the exact result of every position of a material set, such
+// as "KQvKR" (white king and queen against black king and rook), with the
+// distance to mate (DTM) in plies under best play. Tables are generated by
+// retrograde analysis (see tools/tablebase.cpp) for pawnless sets of at most
+// max_tablebase_pieces pieces.
+//
+// Positions are indexed by the side to move and the squares of all pieces,
+// in the order of the white king, the black king, then the other white and
+// black pieces as in the name. The board is mirrored horizontally and
+// vertically so that the white king is in the a1-d4 quadrant. This symmetry
+// has no fixed position, so every position has exactly one index.
+//
+// A table with the stronger material on the black side is not stored, but
+// probed through its color-flipped table.
+//
+// Note:
+//   - Sets with pawns are not generated, and positions with pawns are never
+//     probed. Pawn moves reset the 75-move counter and promote into other
+//     sets, which a DTM table of one set does not express. Such endings are
+//     played to the end under the normal rules.
+//   - Positions with castling rights are not probed.
+//   - The DTM ignores the move counters. A mate is only forced if it comes
+//     before the fifty-move rule lets the defender claim a draw, which
+//     game_round checks before adjudicating a win.
+//-----------------------------------------------------------------------------
+
+inline constexpr int max_tablebase_pieces = 4;
+
+struct TablebaseHeader {
+    inline static constexpr char          magic_value[8] { 'C', 'H', 'E', 'S', 'S', 'T', 'B', 'L' };
+    inline static constexpr std::uint32_t current_version = 1;
+
+    char          magic[8] {};
+    std::uint32_t version = current_version;
+    std::uint32_t num_pieces = 0;
+    // Null terminated.
+    char          name[16] {};
+    std::uint64_t num_entries = 0;
+};
+
+// Encoding of an entry.
+//   0:   draw
+//   255: invalid position
+//   v:   mate in v - 1 plies, delivered by the side to move if v - 1 is odd
+namespace tablebase_value {
+    inline constexpr std::uint8_t draw = 0;
+    inline constexpr std::uint8_t invalid = 255;
+    inline constexpr int          max_plies = 253;
+
+    constexpr std::uint8_t mate_in(int plies) { return static_cast< std::uint8_t >(plies + 1); }
+    constexpr int          plies(std::uint8_t v) { return v - 1; }
+    constexpr bool         is_win(std::uint8_t v) { return v != draw && v != invalid && plies(v) % 2 == 1; }
+    constexpr bool         is_loss(std::uint8_t v) { return v != draw && v != invalid && plies(v) % 2 == 0; }
+} // namespace tablebase_value
+
+struct TablebasePiece {
+    Occupation piece = Occupation::empty;
+    int        square = 0;
+};
+
+struct TablebaseResult {
+    enum class Wdl { loss, draw, win };
+
+    // From the side to move.
+    Wdl wdl = Wdl::draw;
+    // Plies until mate with best play. 0 for draws.
+    int plies_to_mate = 0;
+};
+
+// Order of non-king pieces in table names.
+constexpr int tablebase_piece_rank(Occupation o) {
+    using enum Occupation;
+    switch(o) {
+        case white_queen:  case black_queen:  return 0;
+        case white_rook:   case black_rook:   return 1;
+        case white_bishop: case black_bishop: return 2;
+        case white_knight: case black_knight: return 3;
+        default:                              return 4;
+    }
+}
+
+constexpr Occupation flip_color(Occupation o) {
+    if(is_white_piece(o)) return static_cast< Occupation >(underlying(o) + underlying(Occupation::black_king) - underlying(Occupation::white_king));
+    if(is_black_piece(o)) return static_cast< Occupation >(underlying(o) - underlying(Occupation::black_king) + underlying(Occupation::white_king));
+    return o;
+}
+
+constexpr std::uint64_t tablebase_num_entries(int num_pieces) {
+    std::uint64_t res = 2 * 16 * 64;
+    for(int i = 2; i < num_pieces; ++i) res *= 64;
+    return res;
+}
+
+// Index of a position, with pieces in table order.
+inline std::uint64_t tablebase_index(std::span< const TablebasePiece > pieces, bool black_turn) {
+    const auto [kx, ky] = BoardState::index_to_coord(pieces[0].square);
+    const bool flip_x = kx > 3;
+    const bool flip_y = ky > 3;
+    const auto transform = [&](int square) {
+        auto [x, y] = BoardState::index_to_coord(square);
+        if(flip_x) x = 7 - x;
+        if(flip_y) y = 7 - y;
+        return BoardState::coord_to_index(x, y);
+    };
+
+    const auto [qx, qy] = BoardState::index_to_coord(transform(pieces[0].square));
+    std::uint64_t res = (black_turn ? 16 : 0) + qy * 4 + qx;
+    for(std::size_t i = 1; i < pieces.size(); ++i) {
+        res = res * 64 + transform(pieces[i].square);
+    }
+    return res;
+}
+
+// Name of the material set of the pieces, with white as given.
+inline std::string tablebase_name(std::span< const TablebasePiece > pieces) {
+    std::string white = "K", black = "K";
+    for(int rank = 0; rank < 4; ++rank) {
+        for(const auto& p : pieces) {
+            if(tablebase_piece_rank(p.piece) != rank) continue;
+            (is_white_piece(p.piece) ? white : black) += letter(p.piece);
+        }
+    }
+    return white + 'v' + black;
+}
+
+// Whether the white side of the material is at least as strong as the black
+// side, which is the orientation of stored tables.
+inline bool tablebase_white_stronger(std::span< const TablebasePiece > pieces) {
+    std::string white, black;
+    for(int rank = 0; rank < 4; ++rank) {
+        for(const auto& p : pieces) {
+            if(tablebase_piece_rank(p.piece) != rank) continue;
+            // Stronger pieces sort first.
+            (is_white_piece(p.piece) ? white : black) += static_cast< char >('a' + rank);
+        }
+    }
+    if(white.size() != black.size()) return white.size() > black.size();
+    return white <= black;
+}
+
+struct TablebaseFile {
+    MappedFile                      file;
+    const TablebaseHeader*          p_header = nullptr;
+    std::span< const std::uint8_t > values;
+
+    explicit TablebaseFile(const std::string& path) : file(path) {
+        p_header = file.view_as< TablebaseHeader >(0);
+        if(!p_header || std::memcmp(p_header->magic, TablebaseHeader::magic_value, sizeof(p_header->magic)) != 0) {
+            throw std::runtime_error("Not a tablebase: " + path);
+        }
+        if(p_header->version != TablebaseHeader::current_version || p_header->num_entries != tablebase_num_entries(p_header->num_pieces)) {
+            throw std::runtime_error("Incompatible tablebase: " + path);
+        }
+        const auto p_values = file.view_as< std::uint8_t >(sizeof(TablebaseHeader), p_header->num_entries);
+        if(!p_values) {
+            throw std::runtime_error("Truncated tablebase: " + path);
+        }
+        values = { p_values, p_header->num_entries };
+    }
+};
+
+// Tables in a directory, each memory-mapped on first use. Probing is
+// thread-safe, and lock-free once the table is open.
+struct Tablebases {
+    // Tables are identified by the counts of each piece type of each side,
+    // each at most 3 within max_tablebase_pieces.
+    inline static constexpr int num_slots = 6561; // 3^8
+
+    struct Slot {
+        // Null until opened. Missing files are remembered in missing.
+        std::atomic< const TablebaseFile* > p_file { nullptr };
+        std::atomic_bool                    missing { false };
+    };
+
+    std::string                                             directory;
+    mutable std::unique_ptr< Slot[] >                       slots = std::make_unique< Slot[] >(num_slots);
+    mutable std::mutex                                      open_mutex;
+    mutable std::vector< std::unique_ptr< TablebaseFile > > files;
+
+    explicit Tablebases(std::string directory) : directory(std::move(directory)) {}
+
+    static std::string file_name(const std::string& name) { return name + ".ctb"; }
+
+    static int slot_index(std::span< const TablebasePiece > pieces) {
+        int counts[8] {};
+        for(const auto& p : pieces) {
+            const int rank = tablebase_piece_rank(p.piece);
+            if(rank < 4) ++counts[(is_white_piece(p.piece) ? 0 : 4) + rank];
+        }
+        int res = 0;
+        for(const int c : counts) res = res * 3 + std::min(c, 2);
+        return res;
+    }
+
+    // Returns null if the table is not available.
+    const TablebaseFile* table(std::span< const TablebasePiece > pieces) const {
+        auto& slot = slots[slot_index(pieces)];
+        if(const auto p = slot.p_file.load(std::memory_order_acquire)) return p;
+        if(slot.missing.load(std::memory_order_relaxed)) return nullptr;
+
+        std::lock_guard lk(open_mutex);
+        if(const auto p = slot.p_file.load(std::memory_order_acquire)) return p;
+        try {
+            files.push_back(std::make_unique< TablebaseFile >(directory + '/' + file_name(tablebase_name(pieces))));
+        }
+        catch(const std::exception&) {
+            slot.missing = true;
+            return nullptr;
+        }
+        slot.p_file.store(files.back().get(), std::memory_order_release);
+        return files.back().get();
+    }
+
+    // Forgets missing tables, such as after generating them.
+    void rescan() {
+        for(int i = 0; i < num_slots; ++i) slots[i].missing = false;
+    }
+
+    // Probes a position given by its pieces, including both kings.
+    // Returns the raw entry, or empty if the table is not available.
+    std::optional< std::uint8_t > probe_value(std::span< const TablebasePiece > pieces, bool black_turn) const {
+        using enum Occupation;
+
+        // Bare kings.
+        if(pieces.size() == 2) return tablebase_value::draw;
+        if(pieces.size() > max_tablebase_pieces) return {};
+
+        // Arrange in table order, color-flipping if black is stronger.
+        TablebasePiece ordered[max_tablebase_pieces];
+        const bool flip = !tablebase_white_stronger(pieces);
+        int n = 2;
+        for(int side = 0; side < 2; ++side) {
+            for(int rank = 0; rank < 5; ++rank) {
+                for(auto p : pieces) {
+                    if(flip) {
+                        p.piece = flip_color(p.piece);
+                        const auto [x, y] = BoardState::index_to_coord(p.square);
+                        p.square = BoardState::coord_to_index(x, 7 - y);
+                    }
+                    if((side == 0 ? is_white_piece(p.piece) : is_black_piece(p.piece)) && tablebase_piece_rank(p.piece) == rank) {
+                        if(p.piece == white_king)      ordered[0] = p;
+                        else if(p.piece == black_king) ordered[1] = p;
+                        else                           ordered[n++] = p;
+                    }
+                }
+            }
+        }
+        const std::span< const TablebasePiece > table_pieces(ordered, pieces.size());
+
+        const auto p_table = table(table_pieces);
+        if(!p_table || p_table->p_header->num_pieces != pieces.size()) return {};
+        return p_table->values[tablebase_index(table_pieces, black_turn != flip)];
+    }
+
+    // Probes a game state. Returns empty if the position is not covered, such
+    // as with pawns, castling rights, too many pieces or a missing table.
+    std::optional< TablebaseResult > probe(const GameState& game_state) const {
+        using enum Occupation;
+
+        const auto& board_state = game_state.board_state;
+        if(board_state.white_castle_queen || board_state.white_castle_king || board_state.black_castle_queen || board_state.black_castle_king) {
+            return {};
+        }
+
+        TablebasePiece pieces[max_tablebase_pieces];
+        int n = 0;
+        for(int i = 0; i < BoardState::size; ++i) {
+            const auto o = board_state.board[i];
+            if(o == empty) continue;
+            if(o == white_pawn || o == black_pawn || n == max_tablebase_pieces) return {};
+            pieces[n++] = { o, i };
+        }
+
+        const auto v = probe_value({ pieces, static_cast< std::size_t >(n) }, board_state.black_turn);
+        if(!v || *v == tablebase_value::invalid) return {};
+        if(*v == tablebase_value::draw) return TablebaseResult {};
+        return TablebaseResult {
+            tablebase_value::is_win(*v) ? TablebaseResult::Wdl::win : TablebaseResult::Wdl::loss,
+            tablebase_value::plies(*v),
+        };
+    }
+};
+
+} // namespace chess
+
+#endif
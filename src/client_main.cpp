@@ -0,0 +1,9 @@
+#include "client.hpp"
+
+int main(int argc, char** argv) {
+    using namespace chess;
+
+    run_client(argc >= 2 ? argv[1] : "localhost:50051");
+
+    return 0;
+}
@@ -0,0 +1,230 @@
+#ifndef CHESS_JOURNAL_HPP
+#define CHESS_JOURNAL_HPP
+
+#include <algorithm> // min
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <iostream>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "chess/operation.hpp"
+#include "environment.hpp"
+#include "log.hpp"
+
+#ifdef PLATFORM_UNIX_LIKE
+    #include <unistd.h> // fsync
+#endif
+
+namespace chess {
+
+//-----------------------------------------------------------------------------
+// Append-only journal of game operations.
+//
+// Every accepted operation is appended as a fixed-size record. Records are
+// buffered in memory and written by a background thread, which issues one
+// fsync for each batch (group commit). An operation is thus durable at most
+// flush_interval after it is accepted, while the serving thread only pays for
+// appending to the in-memory buffer.
+//
+// On restart, the journal is read back and all games not yet released are
+// replayed, in parallel across games.
+//-----------------------------------------------------------------------------
+
+struct JournalRecord {
+    enum class Type : std::uint8_t {
+        // op and code2 hold the operation at the given ply.
+        operation = 1,
+        // The game is released and does not need to be recovered.
+        release = 2,
+    };
+
+    std::uint64_t   game_id = 0;
+    // Index of the resulting item in the game history.
+    std::uint32_t   ply = 0;
+    PackedOperation op = 0;
+    Type            type = Type::operation;
+    std::uint8_t    code2 = 0;
+};
+static_assert(sizeof(JournalRecord) == 16);
+
+struct Journal {
+    std::FILE*                   file = nullptr;
+    std::chrono::milliseconds    flush_interval { 5 };
+
+    // Records appended but not yet written.
+    std::vector< JournalRecord > pending;
+    std::mutex                   pending_mutex;
+    std::condition_variable      pending_cv;
+    bool                         running = true;
+    std::thread                  flush_thread;
+
+    explicit Journal(const std::string& path) {
+        file = std::fopen(path.c_str(), "ab");
+        if(!file) {
+            throw std::runtime_error("Cannot open journal " + path);
+        }
+        flush_thread = std::thread([this] { flush_loop(); });
+    }
+    ~Journal() {
+        {
+            std::lock_guard lk(pending_mutex);
+            running = false;
+        }
+        pending_cv.notify_one();
+        flush_thread.join();
+        std::fclose(file);
+    }
+    Journal(const Journal&) = delete;
+    Journal& operator=(const Journal&) = delete;
+
+    void append(const JournalRecord& record) {
+        std::lock_guard lk(pending_mutex);
+        pending.push_back(record);
+    }
+
+    void append_operation(std::uint64_t game_id, std::uint32_t ply, const Operation& op) {
+        append({ game_id, ply, pack_operation(op), JournalRecord::Type::operation, static_cast< std::uint8_t >(op.code2) });
+    }
+    void append_release(std::uint64_t game_id) {
+        append({ game_id, 0, 0, JournalRecord::Type::release, 0 });
+    }
+
+    void flush_loop() {
+        std::vector< JournalRecord > writing;
+        std::unique_lock lk(pending_mutex);
+        while(true) {
+            pending_cv.wait_for(lk, flush_interval, [this] { return !running; });
+            const bool stop = !running;
+            writing.swap(pending);
+            lk.unlock();
+
+            if(!writing.empty()) {
+                const auto written = std::fwrite(writing.data(), sizeof(JournalRecord), writing.size(), file);
+                std::fflush(file);
+#ifdef PLATFORM_UNIX_LIKE
+                fsync(fileno(file));
+#endif
+                if(written != writing.size()) {
+                    log_error({ .event = "journal" }, "Failed to write ", writing.size() - written, " journal records.");
+                }
+                writing.clear();
+            }
+
+            lk.lock();
+            if(stop && pending.empty()) break;
+        }
+    }
+};
+
+// Reads all records of a journal file. A missing file yields no records.
+// A trailing partial record, as left by a crash, is ignored.
+inline std::vector< JournalRecord > read_journal(const std::string& path) {
+    std::vector< JournalRecord > records;
+    std::FILE* file = std::fopen(path.c_str(), "rb");
+    if(!file) return records;
+
+    std::fseek(file, 0, SEEK_END);
+    const auto size = std::ftell(file);
+    std::fseek(file, 0, SEEK_SET);
+    records.resize(size / sizeof(JournalRecord));
+    records.resize(std::fread(records.data(), sizeof(JournalRecord), records.size(), file));
+    std::fclose(file);
+    return records;
+}
+
+// Replays the operations of one game from the standard opening.
+// Returns whether all operations are valid.
+inline bool replay_journal_game(GameHistory& game_history, const std::vector< JournalRecord >& records, const std::vector< std::uint32_t >& indices) {
+    for(std::size_t i = 0; i < indices.size(); ++i) {
+        const auto& r = records[indices[i]];
+        if(r.ply != game_history.num_items()) return false;
+
+        const auto op = unpack_operation(r.op, r.code2);
+        if(i + 1 < indices.size()) {
+            // Only the final operation may end the game.
+            game_round_trusted(game_history, op);
+        }
+        else {
+            std::ostream null_os(nullptr);
+            if(!game_round(game_history, op, null_os)) return false;
+        }
+    }
+    return true;
+}
+
+// Recovers all games that are not released in a journal.
+// Games are replayed in parallel using num_threads threads (0 for hardware concurrency).
+//
+// If include_released is true, released games are also recovered. A released
+// game id that is reused later only keeps its last game.
+//
+// Games adjudicated by tablebases are only recovered as finished if the same
+// tablebases are given.
+inline std::unordered_map< std::uint64_t, GameHistory > recover_journal(const std::string& path, unsigned num_threads = 0, bool include_released = false, const Tablebases* p_tablebases = nullptr) {
+    const auto records = read_journal(path);
+
+    // Group record indices by game, in order of appending.
+    std::unordered_map< std::uint64_t, std::vector< std::uint32_t > > game_records;
+    std::unordered_map< std::uint64_t, bool >                         game_released;
+    for(std::uint32_t i = 0; i < records.size(); ++i) {
+        const auto& r = records[i];
+        if(r.type == JournalRecord::Type::release) {
+            game_released[r.game_id] = true;
+        }
+        else {
+            auto& released = game_released[r.game_id];
+            if(released) {
+                // The game id is reused.
+                game_records.erase(r.game_id);
+                released = false;
+            }
+            game_records[r.game_id].push_back(i);
+        }
+    }
+
+    std::vector< std::uint64_t > game_ids;
+    game_ids.reserve(game_records.size());
+    for(const auto& [id, _] : game_records) {
+        if(include_released || !game_released[id]) game_ids.push_back(id);
+    }
+
+    std::vector< GameHistory > game_histories(game_ids.size());
+    std::vector< char >        game_valid(game_ids.size());
+
+    if(num_threads == 0) num_threads = std::max(1u, std::thread::hardware_concurrency());
+    num_threads = std::min< std::size_t >(num_threads, std::max< std::size_t >(1, game_ids.size()));
+    {
+        std::vector< std::thread > workers;
+        for(unsigned t = 0; t < num_threads; ++t) {
+            workers.emplace_back([&, t] {
+                for(std::size_t i = t; i < game_ids.size(); i += num_threads) {
+                    game_histories[i].p_tablebases = p_tablebases;
+                    game_valid[i] = replay_journal_game(game_histories[i], records, game_records.at(game_ids[i]));
+                }
+            });
+        }
+        for(auto& w : workers) w.join();
+    }
+
+    std::unordered_map< std::uint64_t, GameHistory > res;
+    for(std::size_t i = 0; i < game_ids.size(); ++i) {
+        if(game_valid[i]) {
+            res.emplace(game_ids[i], std::move(game_histories[i]));
+        }
+        else {
+            log_error({ .game_id = game_ids[i], .event = "recover" }, "Invalid journal records, game is not recovered.");
+        }
+    }
+    return res;
+}
+
+} // namespace chess
+
+#endif
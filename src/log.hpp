@@ -0,0 +1,248 @@
+#ifndef CHESS_LOG_HPP
+#define CHESS_LOG_HPP
+
+#include <algorithm> // min
+#include <atomic>
+#include <charconv> // to_chars
+#include <chrono>
+#include <cstdint>
+#include <cstring> // memcpy
+#include <iostream>
+#include <memory> // unique_ptr
+#include <string_view>
+#include <thread>
+#include <type_traits>
+
+#include "utility.hpp"
+
+namespace chess {
+
+//-----------------------------------------------------------------------------
+// Asynchronous leveled logging.
+//
+// Producers format a record into a fixed-size slot of a bounded lock-free
+// ring buffer and return immediately. A background thread drains the ring and
+// writes to std::cout. If the ring is full the record is dropped (and counted)
+// rather than blocking the producer.
+//
+// Records below the compile-time level are discarded by "if constexpr" at the
+// call site. The level can be selected with the CHESS_LOG_LEVEL macro, using
+// the numeric value of LogLevel.
+//-----------------------------------------------------------------------------
+
+enum class LogLevel { trace, debug, info, warning, error, off };
+
+constexpr const char* log_level_text[] {
+    "trace", "debug", "info", "warning", "error", "off"
+};
+constexpr auto text(LogLevel l) { return log_level_text[underlying(l)]; }
+
+#ifdef CHESS_LOG_LEVEL
+constexpr LogLevel log_level_compiled = static_cast< LogLevel >(CHESS_LOG_LEVEL);
+#else
+constexpr LogLevel log_level_compiled = debug ? LogLevel::debug : LogLevel::info;
+#endif
+
+constexpr bool log_enabled(LogLevel level) {
+    return level != LogLevel::off && underlying(level) >= underlying(log_level_compiled);
+}
+
+// Structured fields attached to each record. Zero or null means not applicable.
+struct LogFields {
+    std::uint64_t game_id = 0;
+    std::uint64_t player_id = 0;
+    // Must point to storage with static duration, such as a string literal.
+    const char*   event = nullptr;
+};
+
+struct LogRecord {
+    inline static constexpr int max_text_size = 1000;
+
+    LogLevel                              level = LogLevel::info;
+    std::chrono::steady_clock::time_point time;
+    LogFields                             fields;
+    int                                   text_size = 0;
+    bool                                  truncated = false;
+    char                                  text[max_text_size];
+
+    void append(std::string_view s) {
+        const int n = std::min< int >(s.size(), max_text_size - text_size);
+        std::memcpy(text + text_size, s.data(), n);
+        text_size += n;
+        if(n < static_cast< int >(s.size())) truncated = true;
+    }
+
+    template< typename T >
+    void append_value(const T& val) {
+        if constexpr(std::is_same_v< T, bool >) {
+            append(val ? "true" : "false");
+        }
+        else if constexpr(std::is_same_v< T, char >) {
+            append(std::string_view(&val, 1));
+        }
+        else if constexpr(std::is_enum_v< T >) {
+            append_value(underlying(val));
+        }
+        else if constexpr(std::is_integral_v< T >) {
+            char buffer[24];
+            const auto res = std::to_chars(buffer, buffer + sizeof(buffer), val);
+            append(std::string_view(buffer, res.ptr - buffer));
+        }
+        else if constexpr(std::is_pointer_v< T > && !std::is_convertible_v< T, const char* >) {
+            append_value(reinterpret_cast< std::uintptr_t >(val));
+        }
+        else {
+            append(std::string_view(val));
+        }
+    }
+};
+
+struct Logger {
+    // Must be a power of 2.
+    inline static constexpr std::size_t capacity = 4096;
+
+    Logger() : slots(new Slot[capacity]) {
+        for(std::size_t i = 0; i < capacity; ++i) {
+            slots[i].sequence.store(i, std::memory_order_relaxed);
+        }
+        start_time = std::chrono::steady_clock::now();
+        drain_thread = std::thread([this] { drain_loop(); });
+    }
+    ~Logger() {
+        running.store(false, std::memory_order_release);
+        drain_thread.join();
+    }
+
+    // Formats all arguments into a record and pushes it into the ring.
+    // Never blocks. Returns false if the record is dropped.
+    template< typename... Args >
+    bool write(LogLevel level, const LogFields& fields, const Args&... args) {
+        auto pos = enqueue_pos.load(std::memory_order_relaxed);
+        Slot* slot;
+        while(true) {
+            slot = &slots[pos & (capacity - 1)];
+            const auto seq = slot->sequence.load(std::memory_order_acquire);
+            const auto diff = static_cast< std::intptr_t >(seq) - static_cast< std::intptr_t >(pos);
+            if(diff == 0) {
+                if(enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+            }
+            else if(diff < 0) {
+                // Ring is full.
+                dropped_count.fetch_add(1, std::memory_order_relaxed);
+                return false;
+            }
+            else {
+                pos = enqueue_pos.load(std::memory_order_relaxed);
+            }
+        }
+
+        auto& rec = slot->record;
+        rec.level = level;
+        rec.time = std::chrono::steady_clock::now();
+        rec.fields = fields;
+        rec.text_size = 0;
+        rec.truncated = false;
+        (rec.append_value(args), ...);
+
+        slot->sequence.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    auto num_dropped() const { return dropped_count.load(std::memory_order_relaxed); }
+
+    struct Slot {
+        std::atomic< std::size_t > sequence;
+        LogRecord                  record;
+    };
+
+    // Pops one record and prints it. Returns false if the ring is empty.
+    // Only called by the drain thread.
+    bool drain_one(std::ostream& os) {
+        auto& slot = slots[dequeue_pos & (capacity - 1)];
+        const auto seq = slot.sequence.load(std::memory_order_acquire);
+        if(seq != dequeue_pos + 1) return false;
+
+        print_record(os, slot.record);
+
+        slot.sequence.store(dequeue_pos + capacity, std::memory_order_release);
+        ++dequeue_pos;
+        return true;
+    }
+
+    void print_record(std::ostream& os, const LogRecord& rec) const {
+        const auto us = std::chrono::duration_cast< std::chrono::microseconds >(rec.time - start_time).count();
+        os << '[' << us / 1000000 << '.';
+        const auto frac = us % 1000000;
+        for(auto d = 100000; d > 1 && frac < d; d /= 10) os << '0';
+        os << frac << "] [" << text(rec.level) << ']';
+        if(rec.fields.game_id)   os << " game=" << rec.fields.game_id;
+        if(rec.fields.player_id) os << " player=" << rec.fields.player_id;
+        if(rec.fields.event)     os << " event=" << rec.fields.event;
+        os << ' ';
+        os.write(rec.text, rec.text_size);
+        if(rec.truncated) os << "...";
+        if(rec.text_size == 0 || rec.text[rec.text_size - 1] != '\n') os << '\n';
+    }
+
+    void drain_loop() {
+        using namespace std::chrono_literals;
+
+        auto& os = std::cout;
+        std::uint64_t dropped_reported = 0;
+        while(true) {
+            // Read the flag before draining, so that records pushed before
+            // shutdown are always printed.
+            const bool still_running = running.load(std::memory_order_acquire);
+
+            bool any = false;
+            while(drain_one(os)) any = true;
+
+            const auto dropped = num_dropped();
+            if(dropped != dropped_reported) {
+                os << "[log] " << dropped - dropped_reported << " records dropped.\n";
+                dropped_reported = dropped;
+                any = true;
+            }
+            if(any) os.flush();
+
+            if(!still_running) break;
+            if(!any) std::this_thread::sleep_for(1ms);
+        }
+    }
+
+    std::unique_ptr< Slot[] >             slots;
+    // Separate producer and consumer positions to avoid false sharing.
+    alignas(64) std::atomic< std::size_t > enqueue_pos { 0 };
+    alignas(64) std::size_t                dequeue_pos = 0;
+    std::atomic< std::uint64_t >           dropped_count { 0 };
+    std::atomic_bool                       running { true };
+    std::chrono::steady_clock::time_point  start_time;
+    std::thread                            drain_thread;
+};
+
+inline Logger& logger() {
+    static Logger instance;
+    return instance;
+}
+
+// Logging entry. Arguments can be strings, string views, chars, integers,
+// bools, enums or pointers, and are concatenated in order.
+//
+// Arguments are evaluated even if the level is filtered out, so prefer cheap
+// views (eg ostringstream::view()) over temporaries.
+template< LogLevel level, typename... Args >
+inline void log_at(const LogFields& fields, const Args&... args) {
+    if constexpr(log_enabled(level)) {
+        logger().write(level, fields, args...);
+    }
+}
+
+template< typename... Args > inline void log_trace  (const LogFields& fields, const Args&... args) { log_at< LogLevel::trace   >(fields, args...); }
+template< typename... Args > inline void log_debug  (const LogFields& fields, const Args&... args) { log_at< LogLevel::debug   >(fields, args...); }
+template< typename... Args > inline void log_info   (const LogFields& fields, const Args&... args) { log_at< LogLevel::info    >(fields, args...); }
+template< typename... Args > inline void log_warning(const LogFields& fields, const Args&... args) { log_at< LogLevel::warning >(fields, args...); }
+template< typename... Args > inline void log_error  (const LogFields& fields, const Args&... args) { log_at< LogLevel::error   >(fields, args...); }
+
+} // namespace chess
+
+#endif
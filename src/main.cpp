@@ -13,7 +13,8 @@ int main(int argc, char** argv) {
     if(argc >= 2) {
         string arg_val = argv[1];
         if(arg_val == "serve") {
-            run_server();
+            // Optional journal and opening book paths, and tablebase directory.
+            run_server(argc >= 3 ? argv[2] : "", argc >= 4 ? argv[3] : "", argc >= 5 ? argv[4] : "");
         }
         else {
             run_client(arg_val);
@@ -0,0 +1,109 @@
+#ifndef CHESS_MAPPED_FILE_HPP
+#define CHESS_MAPPED_FILE_HPP
+
+#include <cstddef>
+#include <cstdio>
+#include <stdexcept>
+#include <string>
+#include <utility> // swap
+#include <vector>
+
+#include "environment.hpp"
+
+#ifdef PLATFORM_UNIX_LIKE
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+#endif
+
+namespace chess {
+
+// Read-only view of a whole file.
+//
+// The file is memory-mapped on unix-like platforms, so that pages are loaded
+// lazily and shared among processes. Otherwise, the file content is read into
+// memory.
+struct MappedFile {
+    const std::byte*         data = nullptr;
+    std::size_t              size = 0;
+
+#ifndef PLATFORM_UNIX_LIKE
+    std::vector< std::byte > buffer;
+#endif
+
+    MappedFile() = default;
+    explicit MappedFile(const std::string& path) {
+#ifdef PLATFORM_UNIX_LIKE
+        const int fd = ::open(path.c_str(), O_RDONLY);
+        if(fd < 0) {
+            throw std::runtime_error("Cannot open " + path);
+        }
+        struct stat st;
+        if(::fstat(fd, &st) != 0) {
+            ::close(fd);
+            throw std::runtime_error("Cannot stat " + path);
+        }
+        size = st.st_size;
+        if(size > 0) {
+            void* p = ::mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+            if(p == MAP_FAILED) {
+                ::close(fd);
+                throw std::runtime_error("Cannot map " + path);
+            }
+            data = static_cast< const std::byte* >(p);
+        }
+        // The mapping stays valid after closing the descriptor.
+        ::close(fd);
+#else
+        std::FILE* file = std::fopen(path.c_str(), "rb");
+        if(!file) {
+            throw std::runtime_error("Cannot open " + path);
+        }
+        std::fseek(file, 0, SEEK_END);
+        buffer.resize(std::ftell(file));
+        std::fseek(file, 0, SEEK_SET);
+        buffer.resize(std::fread(buffer.data(), 1, buffer.size(), file));
+        std::fclose(file);
+        data = buffer.data();
+        size = buffer.size();
+#endif
+    }
+
+    MappedFile(MappedFile&& rhs) noexcept { swap(rhs); }
+    MappedFile& operator=(MappedFile&& rhs) noexcept {
+        MappedFile tmp(std::move(rhs));
+        swap(tmp);
+        return *this;
+    }
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    ~MappedFile() {
+#ifdef PLATFORM_UNIX_LIKE
+        if(data) ::munmap(const_cast< std::byte* >(data), size);
+#endif
+    }
+
+    void swap(MappedFile& rhs) noexcept {
+        std::swap(data, rhs.data);
+        std::swap(size, rhs.size);
+#ifndef PLATFORM_UNIX_LIKE
+        buffer.swap(rhs.buffer);
+#endif
+    }
+
+    bool empty() const { return size == 0; }
+
+    // Interprets count objects of type T at the byte offset.
+    // Returns null if the range is out of bounds.
+    template< typename T >
+    const T* view_as(std::size_t offset, std::size_t count = 1) const {
+        if(offset > size || count > (size - offset) / sizeof(T)) return nullptr;
+        return reinterpret_cast< const T* >(data + offset);
+    }
+};
+
+} // namespace chess
+
+#endif
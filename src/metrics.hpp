@@ -0,0 +1,179 @@
+#ifndef CHESS_METRICS_HPP
+#define CHESS_METRICS_HPP
+
+#include <algorithm> // max, min
+#include <atomic>
+#include <bit> // bit_width
+#include <chrono>
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+
+namespace chess {
+
+//-----------------------------------------------------------------------------
+// Instrumentation primitives.
+//
+// All updates are relaxed atomics, so that they can be shared by multiple
+// threads without locking. Readers get an approximate snapshot.
+//-----------------------------------------------------------------------------
+
+struct Counter {
+    std::atomic< std::uint64_t > value { 0 };
+
+    void add(std::uint64_t n = 1) { value.fetch_add(n, std::memory_order_relaxed); }
+    auto get() const { return value.load(std::memory_order_relaxed); }
+};
+
+// A gauge that also remembers its high-water mark.
+struct Gauge {
+    std::atomic< std::int64_t > value { 0 };
+    std::atomic< std::int64_t > max_value { 0 };
+
+    void set(std::int64_t v) {
+        value.store(v, std::memory_order_relaxed);
+        update_max(v);
+    }
+    void add(std::int64_t n = 1) { update_max(value.fetch_add(n, std::memory_order_relaxed) + n); }
+    void sub(std::int64_t n = 1) { value.fetch_sub(n, std::memory_order_relaxed); }
+
+    auto get() const { return value.load(std::memory_order_relaxed); }
+    auto get_max() const { return max_value.load(std::memory_order_relaxed); }
+
+    void update_max(std::int64_t v) {
+        auto cur = max_value.load(std::memory_order_relaxed);
+        while(v > cur && !max_value.compare_exchange_weak(cur, v, std::memory_order_relaxed)) {}
+    }
+};
+
+// HDR-style log-linear histogram of non-negative integers (nanoseconds for
+// latency).
+//
+// Values below 2^sub_bucket_bits are recorded exactly. Larger values are
+// grouped by their power of 2, each of which is split into 2^(sub_bucket_bits
+// - 1) linear sub-buckets, so that the relative error of any reported
+// percentile is bounded by 2^(1 - sub_bucket_bits) over the full 64-bit range.
+struct LatencyHistogram {
+    inline static constexpr int sub_bucket_bits = 6;
+    inline static constexpr int sub_bucket_count = 1 << sub_bucket_bits;
+    inline static constexpr int sub_bucket_half_count = sub_bucket_count / 2;
+    inline static constexpr int num_buckets = sub_bucket_count + (64 - sub_bucket_bits) * sub_bucket_half_count;
+
+    std::atomic< std::uint64_t > buckets[num_buckets] {};
+    std::atomic< std::uint64_t > count { 0 };
+    std::atomic< std::uint64_t > sum { 0 };
+    std::atomic< std::uint64_t > min_value { std::numeric_limits< std::uint64_t >::max() };
+    std::atomic< std::uint64_t > max_value { 0 };
+
+    static constexpr int bucket_index(std::uint64_t v) {
+        if(v < sub_bucket_count) return static_cast< int >(v);
+        const int shift = std::bit_width(v) - sub_bucket_bits;
+        return sub_bucket_count + (shift - 1) * sub_bucket_half_count + static_cast< int >((v >> shift) - sub_bucket_half_count);
+    }
+    // The smallest value that falls in the bucket.
+    static constexpr std::uint64_t bucket_lower(int index) {
+        if(index < sub_bucket_count) return index;
+        const int shift = (index - sub_bucket_count) / sub_bucket_half_count + 1;
+        const auto sub = static_cast< std::uint64_t >((index - sub_bucket_count) % sub_bucket_half_count + sub_bucket_half_count);
+        return sub << shift;
+    }
+    static constexpr std::uint64_t bucket_width(int index) {
+        if(index < sub_bucket_count) return 1;
+        return std::uint64_t(1) << ((index - sub_bucket_count) / sub_bucket_half_count + 1);
+    }
+
+    void record(std::uint64_t v) {
+        buckets[bucket_index(v)].fetch_add(1, std::memory_order_relaxed);
+        count.fetch_add(1, std::memory_order_relaxed);
+        sum.fetch_add(v, std::memory_order_relaxed);
+
+        auto cur_min = min_value.load(std::memory_order_relaxed);
+        while(v < cur_min && !min_value.compare_exchange_weak(cur_min, v, std::memory_order_relaxed)) {}
+        auto cur_max = max_value.load(std::memory_order_relaxed);
+        while(v > cur_max && !max_value.compare_exchange_weak(cur_max, v, std::memory_order_relaxed)) {}
+    }
+    template< typename Rep, typename Period >
+    void record(std::chrono::duration< Rep, Period > d) {
+        record(static_cast< std::uint64_t >(std::max< std::int64_t >(0, std::chrono::duration_cast< std::chrono::nanoseconds >(d).count())));
+    }
+
+    // Adds all samples of another histogram into this one.
+    void merge(const LatencyHistogram& other) {
+        for(int i = 0; i < num_buckets; ++i) {
+            buckets[i].fetch_add(other.buckets[i].load(std::memory_order_relaxed), std::memory_order_relaxed);
+        }
+        count.fetch_add(other.count.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        sum.fetch_add(other.sum.load(std::memory_order_relaxed), std::memory_order_relaxed);
+
+        const auto other_min = other.min_value.load(std::memory_order_relaxed);
+        auto cur_min = min_value.load(std::memory_order_relaxed);
+        while(other_min < cur_min && !min_value.compare_exchange_weak(cur_min, other_min, std::memory_order_relaxed)) {}
+        const auto other_max = other.max_value.load(std::memory_order_relaxed);
+        auto cur_max = max_value.load(std::memory_order_relaxed);
+        while(other_max > cur_max && !max_value.compare_exchange_weak(cur_max, other_max, std::memory_order_relaxed)) {}
+    }
+
+    auto get_count() const { return count.load(std::memory_order_relaxed); }
+    auto get_min() const { return get_count() ? min_value.load(std::memory_order_relaxed) : 0; }
+    auto get_max() const { return max_value.load(std::memory_order_relaxed); }
+    double get_mean() const {
+        const auto c = get_count();
+        return c ? static_cast< double >(sum.load(std::memory_order_relaxed)) / c : 0.0;
+    }
+
+    // Returns the value at the given quantile, in range [0, 1].
+    std::uint64_t percentile(double q) const {
+        const auto c = get_count();
+        if(c == 0) return 0;
+
+        const auto rank = std::max< std::uint64_t >(1, static_cast< std::uint64_t >(q * c + 0.5));
+        std::uint64_t cumulative = 0;
+        for(int i = 0; i < num_buckets; ++i) {
+            cumulative += buckets[i].load(std::memory_order_relaxed);
+            if(cumulative >= rank) {
+                // Report the middle of the bucket, clamped by the exact extremes.
+                const auto mid = bucket_lower(i) + (bucket_width(i) - 1) / 2;
+                return std::min(std::max(mid, get_min()), get_max());
+            }
+        }
+        return get_max();
+    }
+
+    // Prints a one-line summary, with values in microseconds.
+    void print_summary_to(std::ostream& os) const {
+        const auto us = [](auto ns) { return static_cast< double >(ns) / 1000; };
+        const auto flags = os.flags();
+        os << std::fixed << std::setprecision(1)
+            << "count " << get_count()
+            << ", mean " << us(get_mean())
+            << ", min " << us(get_min())
+            << ", p50 " << us(percentile(0.5))
+            << ", p90 " << us(percentile(0.9))
+            << ", p99 " << us(percentile(0.99))
+            << ", p999 " << us(percentile(0.999))
+            << ", max " << us(get_max())
+            << " (us)";
+        os.flags(flags);
+    }
+};
+
+// Records the lifetime of the object into a histogram. Without a histogram,
+// the clock is not read.
+struct ScopedLatency {
+    LatencyHistogram*                     p_histogram = nullptr;
+    std::chrono::steady_clock::time_point start {};
+
+    explicit ScopedLatency(LatencyHistogram* p_histogram) : p_histogram(p_histogram) {
+        if(p_histogram) start = std::chrono::steady_clock::now();
+    }
+    ~ScopedLatency() {
+        if(p_histogram) p_histogram->record(std::chrono::steady_clock::now() - start);
+    }
+    ScopedLatency(const ScopedLatency&) = delete;
+    ScopedLatency& operator=(const ScopedLatency&) = delete;
+};
+
+} // namespace chess
+
+#endif
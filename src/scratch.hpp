@@ -0,0 +1,45 @@
+#ifndef CHESS_SCRATCH_HPP
+#define CHESS_SCRATCH_HPP
+
+#include <cstddef>
+#include <memory>
+#include <memory_resource>
+#include <sstream>
+#include <string>
+
+namespace chess {
+
+//-----------------------------------------------------------------------------
+// Scratch memory for the temporaries of handling one event, such as the
+// messages built in reply to a request.
+//
+// Each thread has its own arena, so threads do not contend on the allocator.
+// Allocations only bump a pointer, and deallocations are no-ops. The owner of
+// the event loop releases everything at once after each event, so nothing
+// allocated from the arena may outlive the event.
+//-----------------------------------------------------------------------------
+
+struct ScratchArena {
+    // Covers typical events without falling back to the upstream allocator.
+    inline static constexpr std::size_t initial_size = 64 * 1024;
+
+    std::unique_ptr< std::byte[] >      buffer { new std::byte[initial_size] };
+    std::pmr::monotonic_buffer_resource resource { buffer.get(), initial_size, std::pmr::new_delete_resource() };
+
+    std::pmr::memory_resource* get() { return &resource; }
+
+    // Releases all allocations, and returns memory obtained from upstream.
+    void reset() { resource.release(); }
+};
+
+inline ScratchArena& thread_scratch_arena() {
+    thread_local ScratchArena arena;
+    return arena;
+}
+
+using ScratchString        = std::pmr::string;
+using ScratchOStringStream = std::basic_ostringstream< char, std::char_traits< char >, std::pmr::polymorphic_allocator< char > >;
+
+} // namespace chess
+
+#endif
@@ -1,32 +1,170 @@
 #ifndef CHESS_SERVER_HPP
 #define CHESS_SERVER_HPP
 
+#include <algorithm> // clamp, max
+#include <atomic>
+#include <charconv> // from_chars
+#include <chrono>
 #include <cstdint>
 #include <deque>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <optional>
 #include <sstream>
 #include <stdexcept>
 #include <string>
-#include <tuple>
+#include <thread>
 #include <unordered_map>
-#include <unordered_set>
+#include <vector>
 
+#include <google/protobuf/arena.h>
+#include <grpcpp/alarm.h>
 #include <grpcpp/ext/proto_server_reflection_plugin.h>
 #include <grpcpp/grpcpp.h>
 #include <grpcpp/health_check_service_interface.h>
 
+#include "book.hpp"
+#include "chess/engine.hpp"
 #include "chess/game.hpp"
+#include "journal.hpp"
+#include "log.hpp"
+#include "metrics.hpp"
 #include "proto/helloworld.grpc.pb.h"
+#include "scratch.hpp"
+#include "slot_pool.hpp"
+#include "trace.hpp"
+#include "worker_pool.hpp"
 
 namespace chess {
 
+// Player id of server-side bot players. Rejected in client requests.
+inline constexpr std::uint64_t bot_player_id = std::numeric_limits< std::uint64_t >::max();
+
+// A server-side engine player of a game.
+struct BotPlayer {
+    bool black = false;
+    // Thinking time left for the rest of the game.
+    std::chrono::steady_clock::duration time_left {};
+    // The search in progress. 0 if none.
+    std::uint64_t search_id = 0;
+    // Set to stop the search in progress.
+    std::shared_ptr< std::atomic_bool > p_cancel;
+
+    void cancel() {
+        if(p_cancel) p_cancel->store(true, std::memory_order_relaxed);
+        search_id = 0;
+        p_cancel.reset();
+    }
+};
+
+struct BotSettings {
+    // Searches running at once, over all games.
+    std::size_t num_threads = std::max(1u, std::thread::hardware_concurrency() / 2);
+    // Searches queued or running at once, including cancelled searches not
+    // finished yet. Each game with a bot has at most one search that is not
+    // cancelled, so this also caps the games with a bot.
+    std::size_t max_searches = 64;
+    // Thinking time of a bot for a whole game.
+    std::chrono::milliseconds game_budget { 5 * 60 * 1000 };
+    // Limits of the time of one move, which is otherwise a share of the time
+    // left. No move takes more than the time left.
+    std::chrono::milliseconds min_move_time { 100 };
+    std::chrono::milliseconds max_move_time { 5000 };
+    int                       moves_to_go = 30;
+    // Nodes of each search once the thinking time is used up.
+    std::uint64_t             max_nodes_without_time = 20000;
+};
+
 struct ServedGame {
     // raw data
     GameHistory game_history;
 
     // client identity
     std::uint64_t player_ids[2] {}; // white, black
+
+    // Shared by all players and spectators of the game.
+    GameStatusCache status_cache;
+
+    // If set, the player of its color is a bot.
+    std::optional< BotPlayer > bot;
+
+    bool is_full() const { return player_ids[0] && player_ids[1]; }
 };
 
+// Response to a single request, in the scratch arena of the thread.
+struct ChessResponse {
+    ScratchString message { thread_scratch_arena().get() };
+    // Whether the message should be sent to all sessions following the game.
+    bool          broadcast = false;
+    // Sent before the message to other sessions when broadcasting.
+    ScratchString repeated_message { thread_scratch_arena().get() };
+    bool          client_finish = false;
+    // The game the request refers to. 0 if the player is not in any game.
+    std::uint64_t game_id = 0;
+    // Whether the game has been released as no player is left.
+    bool          game_released = false;
+};
+
+// Instrumentation of the server behavior, reported by the "stats" command.
+struct ServerMetrics {
+    // completion queue events
+    Counter event_connect;
+    Counter event_read;
+    Counter event_write;
+    Counter event_finish;
+    Counter event_client_finish;
+    Counter event_client_disconnect;
+    Counter event_invalid;
+
+    // Total number of replies waiting to be written, over all sessions.
+    Gauge   rep_queue_depth;
+    Gauge   active_sessions;
+    // Games with both players registered.
+    Gauge   active_games;
+    Gauge   bot_games;
+    // Bot searches finished, including those discarded.
+    Counter bot_searches;
+
+    // From receiving a request to the completion of writing its reply.
+    LatencyHistogram request_to_reply;
+    LatencyHistogram game_round;
+    LatencyHistogram bot_search;
+
+    std::chrono::steady_clock::time_point start_time = std::chrono::steady_clock::now();
+
+    void print_to(std::ostream& os) const {
+        const auto uptime = std::chrono::duration< double >(std::chrono::steady_clock::now() - start_time).count();
+        os
+            << "uptime: " << uptime << " s\n"
+            << "events: connect " << event_connect.get()
+                << ", read " << event_read.get()
+                << ", write " << event_write.get()
+                << ", finish " << event_finish.get()
+                << ", client_finish " << event_client_finish.get()
+                << ", client_disconnect " << event_client_disconnect.get()
+                << ", invalid " << event_invalid.get() << '\n'
+            << "rep_queue depth: " << rep_queue_depth.get() << " (max " << rep_queue_depth.get_max() << ")\n"
+            << "active sessions: " << active_sessions.get() << " (max " << active_sessions.get_max() << ")\n"
+            << "active games: " << active_games.get() << " (max " << active_games.get_max() << ")\n"
+            << "bot games: " << bot_games.get() << " (max " << bot_games.get_max() << "), searches " << bot_searches.get() << '\n';
+        os << "request to reply: ";
+        request_to_reply.print_summary_to(os);
+        os << "\ngame_round: ";
+        game_round.print_summary_to(os);
+        os << "\nbot search: ";
+        bot_search.print_summary_to(os);
+        os << '\n';
+    }
+};
+
+// Whether the gRPC peer string refers to the local machine.
+inline bool is_local_peer(const std::string& peer) {
+    return peer.starts_with("ipv4:127.") || peer.starts_with("ipv6:[::1]") || peer.starts_with("unix:");
+}
+
 
 // Logic and data behind the server's behavior.
 struct ChessServiceImpl {
@@ -35,16 +173,38 @@ struct ChessServiceImpl {
     struct CallSession {
         enum class Event { connect, read, write, finish, client_finish, client_disconnect };
 
+        static constexpr const char* trace_name(Event event) {
+            switch(event) {
+                case Event::connect:           return "cq/connect";
+                case Event::read:              return "cq/read";
+                case Event::write:             return "cq/write";
+                case Event::finish:            return "cq/finish";
+                case Event::client_finish:     return "cq/client_finish";
+                case Event::client_disconnect: return "cq/client_disconnect";
+                default:                       return "cq/unknown";
+            }
+        }
+
         struct State {
             struct ReplyItem {
-                chess_proto::ChessReply rep;
+                // In reply_arena. Null if finish_only.
+                chess_proto::ChessReply* p_rep = nullptr;
                 bool finish_only = false;
+                // If set, the reply answers a request received at this time.
+                std::chrono::steady_clock::time_point request_time {};
             };
 
             bool finished = false;
             bool can_write = true;
             chess_proto::ChessRequest req_cache;
+            // Replies are allocated in the arena, which is reset whenever
+            // the queue is drained.
+            google::protobuf::Arena reply_arena;
             std::deque< ReplyItem > rep_queue;
+            // The game followed by this session. 0 if not following any game.
+            std::uint64_t game_id = 0;
+            // Request time of the reply being written, if any.
+            std::chrono::steady_clock::time_point writing_request_time {};
 
             grpc::ServerContext ctx;
             grpc::ServerAsyncReaderWriter<chess_proto::ChessReply, chess_proto::ChessRequest> stream;
@@ -52,12 +212,31 @@ struct ChessServiceImpl {
             State() : stream(&ctx) {}
         };
 
-        std::weak_ptr<State> p_state;
+        // Handle in the session pool. Stale once the session is removed.
+        SlotHandle session;
         Event event = Event::connect;
     };
 
     // Game data
-    ServedGame served_game;
+    //
+    // Each player can be registered in at most one game. Clients not
+    // specifying a game id join the default game.
+    inline static constexpr std::uint64_t default_game_id = 1;
+    std::unordered_map< std::uint64_t, ServedGame >    served_games;
+    std::unordered_map< std::uint64_t, std::uint64_t > player_games;
+
+    // Persistence of accepted operations. Null if disabled.
+    std::unique_ptr< Journal > journal;
+
+    // Shared by all games for hints. Null if disabled.
+    std::unique_ptr< OpeningBook > opening_book;
+    // Hints from the opening book. Empty if disabled.
+    MoveHintFunc                   opening_book_hint;
+
+    // Shared by all games for adjudication. Null if disabled.
+    std::unique_ptr< Tablebases > tablebases;
+
+    ServerMetrics metrics;
 
     // All call sessions
     bool running = true;
@@ -67,12 +246,74 @@ struct ChessServiceImpl {
     std::unique_ptr<grpc::ServerCompletionQueue> cq;
     std::unique_ptr<grpc::Server> server;
 
+    // Bot searches run on their own threads, so that they never delay the
+    // completion queue. Results are posted back to the completion queue
+    // thread, which owns the games.
+    struct BotResult {
+        std::uint64_t                       game_id = 0;
+        std::uint64_t                       search_id = 0;
+        std::optional< Operation >          op;
+        std::chrono::steady_clock::duration elapsed {};
+    };
+    struct BotResults {
+        std::mutex              mutex;
+        std::vector< BotResult > results;
+        // Whether the alarm is set and its event not yet handled. The alarm is
+        // only set again after that.
+        bool                    wakeup_pending = false;
+        grpc::Alarm             alarm;
+    };
+    BotSettings                   bot_settings;
+    BotResults                    bot_results;
+    std::unique_ptr< WorkerPool > bot_pool;
+    std::uint64_t                 next_bot_search_id = 1;
+    // Searches cancelled, whose results are not handled yet. They still take
+    // places in the queue of the pool.
+    std::size_t                   num_cancelled_bot_searches = 0;
+
+    // Completion queue tag of bot results. Never equal to a session tag.
+    void* bot_results_tag() { return &bot_results; }
+
     ~ChessServiceImpl() {
+        // Stop the searches before the completion queue they post to.
+        for(auto& [game_id, served_game] : served_games) {
+            if(served_game.bot) served_game.bot->cancel();
+        }
+        bot_pool.reset();
+
         server->Shutdown();
         // Always shutdown the completion queue after the server.
         cq->Shutdown();
     }
 
+    // Recovers games from the journal, and journals new operations to it.
+    void open_journal(const std::string& journal_path) {
+        const auto start_time = std::chrono::steady_clock::now();
+        auto recovered = recover_journal(journal_path, 0, false, tablebases.get());
+        for(auto& [game_id, game_history] : recovered) {
+            served_games[game_id].game_history = std::move(game_history);
+        }
+        log_info(
+            { .event = "recover" },
+            "Recovered ", recovered.size(), " games from journal ", journal_path, " in ",
+            std::chrono::duration_cast< std::chrono::milliseconds >(std::chrono::steady_clock::now() - start_time).count(), " ms."
+        );
+
+        journal = std::make_unique< Journal >(journal_path);
+    }
+
+    void open_opening_book(const std::string& book_path) {
+        opening_book = std::make_unique< OpeningBook >(book_path);
+        opening_book_hint = [p_book = opening_book.get()](const GameState& game_state) { return p_book->best(game_state); };
+        log_info({ .event = "book" }, "Opened opening book ", book_path, " with ", opening_book->entries.size(), " entries.");
+    }
+
+    // Tables are opened on first use. Should be called before open_journal.
+    void open_tablebases(const std::string& directory) {
+        tablebases = std::make_unique< Tablebases >(directory);
+        log_info({ .event = "tablebase" }, "Using endgame tablebases in ", directory, ".");
+    }
+
     void run(std::string server_address) {
         using namespace std;
         using namespace grpc;
@@ -88,7 +329,8 @@ struct ChessServiceImpl {
         cq = builder.AddCompletionQueue();
         // Finally assemble the server.
         server = builder.BuildAndStart();
-        std::cout << "Server listening on " << server_address << std::endl;
+        bot_pool = std::make_unique< WorkerPool >(bot_settings.num_threads, bot_settings.max_searches);
+        log_info({ .event = "listen" }, "Server listening on ", server_address);
 
         // Proceed to server main loop.
         main_loop();
@@ -108,7 +350,7 @@ struct ChessServiceImpl {
         const auto get_tag = [&](void* tag) {
             auto tag_it = tags.find((uint64_t) tag);
             if(tag_it == tags.end()) {
-                cout << "Error: tag " << tag_it->first << " is not found in tags.";
+                log_error({ .event = "tag" }, "Tag ", tag, " is not found in tags.");
                 throw runtime_error("Invalid tag");
             }
             else {
@@ -118,106 +360,224 @@ struct ChessServiceImpl {
             }
         };
 
+        // All sessions, including the one waiting for a new client. Slots of
+        // finished sessions are recycled, so connection churn does not go
+        // through the allocator for each session.
+        SlotPool< CallSession::State > states;
+        const auto num_running_sessions = [&] { return states.size() - 1; };
+
         // Make new session.
         const auto make_session_state = [&, this]() {
-            auto state = make_shared<CallSession::State>();
-            service.RequestCommand(&state->ctx, &state->stream, cq.get(), cq.get(), add_tag({ state, CallSession::Event::connect }));
-            state->ctx.AsyncNotifyWhenDone(add_tag({ state, CallSession::Event::client_disconnect }));
-            return state;
+            const auto handle = states.acquire();
+            const auto state = states.get(handle);
+            service.RequestCommand(&state->ctx, &state->stream, cq.get(), cq.get(), add_tag({ handle, CallSession::Event::connect }));
+            state->ctx.AsyncNotifyWhenDone(add_tag({ handle, CallSession::Event::client_disconnect }));
         };
 
         // Spawn a new session to serve new clients.
-        auto new_state = make_session_state();
-        // Running sessions are stored here.
-        unordered_set< shared_ptr< CallSession::State > > states;
+        make_session_state();
+        // Sessions following each game.
+        unordered_map< uint64_t, vector< SlotHandle > > game_sessions;
+
+        const auto unfollow_game = [&](SlotHandle handle, CallSession::State& state) {
+            const auto it = game_sessions.find(state.game_id);
+            if(it != game_sessions.end()) {
+                erase_if(it->second, [&](SlotHandle h) {
+                    return h == handle || !states.get(h);
+                });
+            }
+            state.game_id = 0;
+        };
 
 
         // Function to read from client.
-        const auto session_async_read = [&](weak_ptr<CallSession::State> p_state) {
-            auto state = p_state.lock();
+        const auto session_async_read = [&](SlotHandle handle) {
+            const auto state = states.get(handle);
             if(state) {
-                state->stream.Read(&state->req_cache, add_tag({ p_state, CallSession::Event::read }));
+                state->stream.Read(&state->req_cache, add_tag({ handle, CallSession::Event::read }));
             }
             else {
-                cout << "Warning: session has been deleted when trying to read." << endl;
+                log_warning({ .event = "read" }, "Session has been deleted when trying to read.");
             }
         };
 
+        // Queue a reply to a session.
+        const auto push_reply = [&, this](CallSession::State& state, CallSession::State::ReplyItem item) {
+            state.rep_queue.push_back(move(item));
+            metrics.rep_queue_depth.add();
+        };
+        const auto push_message_reply = [&](CallSession::State& state, string_view message, chrono::steady_clock::time_point request_time = {}) {
+            const auto p_rep = google::protobuf::Arena::Create< chess_proto::ChessReply >(&state.reply_arena);
+            p_rep->set_message(message.data(), message.size());
+            push_reply(state, { p_rep, false, request_time });
+        };
+        const auto push_finish_reply = [&](CallSession::State& state) {
+            push_reply(state, { nullptr, true });
+        };
+
         // Write next reply in queue to stream.
-        const auto async_write_next_reply = [&](weak_ptr<CallSession::State> p_state) {
-            auto state = p_state.lock();
+        const auto async_write_next_reply = [&, this](SlotHandle handle) {
+            const auto state = states.get(handle);
             if(state) {
                 if(state->can_write && !state->rep_queue.empty()) {
                     auto rep = move(state->rep_queue.front());
                     state->rep_queue.pop_front();
+                    metrics.rep_queue_depth.sub();
                     state->can_write = false;
+                    state->writing_request_time = rep.request_time;
                     if(rep.finish_only) {
-                        state->stream.Finish(grpc::Status::OK, add_tag({ state, CallSession::Event::client_finish }));
+                        state->stream.Finish(grpc::Status::OK, add_tag({ handle, CallSession::Event::client_finish }));
                     }
                     else {
-                        state->stream.Write(rep.rep, add_tag({ state, CallSession::Event::write }));
+                        // The reply is serialized before Write returns.
+                        state->stream.Write(*rep.p_rep, add_tag({ handle, CallSession::Event::write }));
+                    }
+                    if(state->rep_queue.empty()) {
+                        state->reply_arena.Reset();
                     }
                 }
             }
             else {
-                cout << "Warning: session has been deleted when trying to write next reply." << endl;
+                log_warning({ .event = "write" }, "Session has been deleted when trying to write next reply.");
+            }
+        };
+
+        // Sends the message to all sessions following the game, preceded by
+        // the repeated message except for the sender, which may be null.
+        const auto broadcast_to_game = [&](uint64_t game_id, string_view repeated_msg, string_view msg, const CallSession::State* p_sender, chrono::steady_clock::time_point request_time) {
+            for(const auto each_handle : game_sessions[game_id]) {
+                const auto each_state = states.get(each_handle);
+                if(!each_state) continue;
+
+                if(each_state != p_sender) {
+                    push_message_reply(*each_state, repeated_msg);
+                }
+                push_message_reply(*each_state, msg, each_state == p_sender ? request_time : chrono::steady_clock::time_point {});
+                async_write_next_reply(each_handle);
+            }
+        };
+
+        // Plays the moves of finished bot searches.
+        const auto handle_bot_results = [&, this] {
+            vector< BotResult > results;
+            {
+                scoped_lock lock(bot_results.mutex);
+                bot_results.wakeup_pending = false;
+                results.swap(bot_results.results);
+            }
+
+            for(const auto& r : results) {
+                metrics.bot_searches.add();
+                metrics.bot_search.record(r.elapsed);
+
+                // Discard results of cancelled searches.
+                const auto game_it = served_games.find(r.game_id);
+                if(game_it == served_games.end() || !game_it->second.bot || game_it->second.bot->search_id != r.search_id) {
+                    --num_cancelled_bot_searches;
+                    continue;
+                }
+                auto& served_game = game_it->second;
+                auto& bot = *served_game.bot;
+                bot.search_id = 0;
+                bot.p_cancel.reset();
+                bot.time_left = max(bot.time_left - r.elapsed, chrono::steady_clock::duration::zero());
+                if(served_game.game_history.ptr_current_item()->game_state.status != GameState::Status::active) continue;
+
+                const auto try_play = [&](const optional< Operation >& op) {
+                    if(!op) return false;
+                    const auto command = command_text(*op);
+                    ScratchOStringStream oss_message(ios_base::out, thread_scratch_arena().get());
+                    ScratchOStringStream oss_repeated(ios_base::out, thread_scratch_arena().get());
+                    oss_repeated << (bot.black ? "black> " : "white> ") << command << endl;
+                    if(!play_game_command(r.game_id, served_game, bot.black, command, oss_message)) {
+                        log_error({ .game_id = r.game_id, .player_id = bot_player_id, .event = "bot" }, "Bot move rejected: ", command);
+                        return false;
+                    }
+                    log_debug({ .game_id = r.game_id, .player_id = bot_player_id, .event = "bot" }, command);
+                    broadcast_to_game(r.game_id, oss_repeated.view(), oss_message.view(), nullptr, {});
+                    return true;
+                };
+                // The game never waits for a bot whose move is missing or
+                // rejected. It plays a move without search, or resigns.
+                try_play(r.op)
+                    || try_play(bot_fallback_operation(served_game))
+                    || try_play(Operation { Operation::Category::resign });
             }
         };
 
         // Function that handles received message and writes to client.
-        const auto session_gen_respond = [&](weak_ptr<CallSession::State> p_state) {
-            auto state = p_state.lock();
+        const auto session_gen_respond = [&, this](SlotHandle handle, chrono::steady_clock::time_point request_time) {
+            const auto state = states.get(handle);
             if(state) {
-                auto [ msg, broadcast, repeated_msg, client_finish ] = chess_respond(state->req_cache);
+                // Admin command, only available to local clients.
+                if(state->req_cache.command() == "stats" && is_local_peer(state->ctx.peer())) {
+                    ScratchOStringStream oss_stats(ios_base::out, thread_scratch_arena().get());
+                    metrics.print_to(oss_stats);
+                    push_message_reply(*state, oss_stats.view(), request_time);
+                    async_write_next_reply(handle);
+                    return;
+                }
+                // Admin command, writing the traced spans to a file.
+                if(state->req_cache.command() == "trace" && is_local_peer(state->ctx.peer())) {
+                    push_message_reply(*state, write_trace_file(), request_time);
+                    async_write_next_reply(handle);
+                    return;
+                }
+
+                auto [ msg, broadcast, repeated_msg, client_finish, game_id, game_released ] = chess_respond(state->req_cache, state->game_id);
+
+                // Bind the session to the game it refers to.
+                if(game_id && state->game_id != game_id) {
+                    unfollow_game(handle, *state);
+                    state->game_id = game_id;
+                    game_sessions[game_id].push_back(handle);
+                }
 
                 if(broadcast) {
-                    for(const auto& each_state : states) {
-                        if(each_state != state) {
-                            chess_proto::ChessReply rep_repeated;
-                            rep_repeated.set_message(repeated_msg);
-                            each_state->rep_queue.push_back({ move(rep_repeated), false });
-                        }
-                        chess_proto::ChessReply rep;
-                        rep.set_message(msg);
-                        each_state->rep_queue.push_back({ move(rep), false });
-                        async_write_next_reply(each_state);
-                    }
+                    broadcast_to_game(game_id, repeated_msg, msg, state, request_time);
                 }
                 else {
-                    chess_proto::ChessReply rep;
-                    rep.set_message(msg);
-                    state->rep_queue.push_back({ move(rep), false });
-                    async_write_next_reply(state);
+                    push_message_reply(*state, msg, request_time);
+                    async_write_next_reply(handle);
                 }
 
                 if(client_finish) {
                     // Add empty finish action.
-                    state->rep_queue.push_back({ chess_proto::ChessReply{}, true });
+                    push_finish_reply(*state);
+                }
+                if(game_released) {
+                    for(const auto each_handle : game_sessions[game_id]) {
+                        if(const auto each_state = states.get(each_handle)) each_state->game_id = 0;
+                    }
+                    game_sessions.erase(game_id);
                 }
             }
             else {
-                cout << "Error: session has been deleted when trying to generate response." << endl;
+                log_error({ .event = "read" }, "Session has been deleted when trying to generate response.");
             }
         };
 
-        const auto finish_session_state = [&](weak_ptr<CallSession::State> p_state) {
-            auto state = p_state.lock();
+        const auto finish_session_state = [&](SlotHandle handle) {
+            const auto state = states.get(handle);
             if(state) {
-                state->rep_queue.push_back({ chess_proto::ChessReply{}, true });
-                async_write_next_reply(state);
+                push_finish_reply(*state);
+                async_write_next_reply(handle);
             }
             else {
-                cout << "Error: session state has already been deleted on finishing." << endl;
+                log_error({ .event = "client_disconnect" }, "Session state has already been deleted on finishing.");
             }
         };
 
-        const auto remove_session_state = [&](weak_ptr<CallSession::State> p_state) {
-            auto state = p_state.lock();
+        const auto remove_session_state = [&, this](SlotHandle handle) {
+            const auto state = states.get(handle);
             if(state) {
-                states.erase(state);
+                metrics.rep_queue_depth.sub(state->rep_queue.size());
+                unfollow_game(handle, *state);
+                states.release(handle);
+                metrics.active_sessions.set(num_running_sessions());
             }
             else {
-                cout << "Error: session state has already been deleted on session deletion." << endl;
+                log_error({ .event = "client_finish" }, "Session state has already been deleted on session deletion.");
             }
         };
 
@@ -231,48 +591,63 @@ struct ChessServiceImpl {
             // The return value of Next should always be checked. This return value
             // tells us whether there is any kind of event or cq_ is shutting down.
             GPR_ASSERT(cq->Next(&tag, &ok));
+            if(tag == bot_results_tag()) {
+                TraceScope trace_event("cq/bot_results");
+                handle_bot_results();
+                thread_scratch_arena().reset();
+                continue;
+            }
             if (!ok) {
-                cout << "[Queue] Warning: invalid completion queue item." << endl;
+                metrics.event_invalid.add();
+                log_warning({ .event = "queue" }, "Invalid completion queue item.");
                 continue;
             }
             auto session = get_tag(tag);
+            // Spans the handling of the event, including the replies it writes.
+            TraceScope trace_event(CallSession::trace_name(session.event));
 
             switch(session.event) {
                 using enum CallSession::Event;
 
                 case connect:
-                    cout << "[Queue] Client connected." << endl;
+                    metrics.event_connect.add();
+                    log_debug({ .event = "connect" }, "Client connected.");
                     // Create a new session state for new connections.
-                    states.insert(move(new_state));
-                    new_state = make_session_state();
+                    make_session_state();
+                    metrics.active_sessions.set(num_running_sessions());
 
                     // Read from stream of this session.
-                    session_async_read(session.p_state);
+                    session_async_read(session.session);
                     break;
 
                 case read:
-                    cout << "[Queue] Received client message." << endl;
+                    metrics.event_read.add();
+                    log_trace({ .event = "read" }, "Received client message.");
 
                     // Process and generate replies to message.
-                    session_gen_respond(session.p_state);
+                    session_gen_respond(session.session, chrono::steady_clock::now());
 
                     // Continue reading.
-                    session_async_read(session.p_state);
+                    session_async_read(session.session);
                     break;
 
                 case write:
-                    cout << "[Queue] Message sent to client." << endl;
+                    metrics.event_write.add();
+                    log_trace({ .event = "write" }, "Message sent to client.");
 
                     // Restore can_write state.
                     {
-                        auto state = session.p_state.lock();
+                        const auto state = states.get(session.session);
                         if(state) {
+                            if(state->writing_request_time != chrono::steady_clock::time_point {}) {
+                                metrics.request_to_reply.record(chrono::steady_clock::now() - state->writing_request_time);
+                            }
                             state->can_write = true;
                             // Continue writing.
-                            async_write_next_reply(session.p_state);
+                            async_write_next_reply(session.session);
                         }
                         else {
-                            cout << "Warning: session closed when writing completes." << endl;
+                            log_warning({ .event = "write" }, "Session closed when writing completes.");
                         }
                     }
 
@@ -280,122 +655,359 @@ struct ChessServiceImpl {
 
                 case finish:
                     // Currently never used.
-                    cout << "[Queue] Server finished." << endl;
+                    metrics.event_finish.add();
+                    log_info({ .event = "finish" }, "Server finished.");
                     running = false;
                     break;
 
                 case client_finish:
-                    cout << "[Queue] Client finished." << endl;
+                    metrics.event_client_finish.add();
+                    log_debug({ .event = "client_finish" }, "Client finished.");
 
                     // Remove session states.
-                    remove_session_state(session.p_state);
+                    remove_session_state(session.session);
                     break;
 
                 case client_disconnect:
-                    cout << "[Queue] Client disconnected." << endl;
+                    metrics.event_client_disconnect.add();
+                    log_debug({ .event = "client_disconnect" }, "Client disconnected.");
 
                     // Remove session states.
-                    finish_session_state(session.p_state);
+                    finish_session_state(session.session);
                     break;
 
                 default:
-                    cout << "[Queue] Error: unknown session event " << underlying(session.event) << endl;
+                    log_error({ .event = "queue" }, "Unknown session event ", session.event);
+            }
+
+            // Temporaries of the event are no longer used.
+            thread_scratch_arena().reset();
+        }
+    }
+
+    // Plays a command of a player, and journals the operation if the game
+    // progresses. Returns whether the game progresses.
+    bool play_game_command(std::uint64_t game_id, ServedGame& served_game, bool from_black, std::string_view command, std::ostream& os_message) {
+        auto& gh = served_game.game_history;
+        const bool progressed = server_game_step(gh, from_black, command, os_message, &metrics.game_round, opening_book_hint ? &opening_book_hint : nullptr, &served_game.status_cache);
+        if(progressed && journal) {
+            journal->append_operation(game_id, gh.num_items() - 1, gh.ptr_current_item()->op);
+        }
+        return progressed;
+    }
+
+    // Starts a search of the bot if it is to move and not searching yet.
+    // The time of the move is a share of the time left for the game. Once no
+    // time is left, the search is limited by nodes instead.
+    void start_bot_search(std::uint64_t game_id, ServedGame& served_game) {
+        using namespace std::chrono;
+
+        if(!served_game.bot) return;
+        auto& bot = *served_game.bot;
+        const auto& game_state = served_game.game_history.ptr_current_item()->game_state;
+        if(game_state.status != GameState::Status::active) {
+            cancel_bot_search(bot);
+            return;
+        }
+        if(bot.search_id || game_state.board_state.black_turn != bot.black) return;
+
+        const auto move_time = std::min< steady_clock::duration >(
+            std::clamp< steady_clock::duration >(bot.time_left / bot_settings.moves_to_go, bot_settings.min_move_time, bot_settings.max_move_time),
+            bot.time_left
+        );
+        const auto max_nodes = move_time > steady_clock::duration::zero() ? 0 : bot_settings.max_nodes_without_time;
+        const auto search_id = next_bot_search_id++;
+        auto p_cancel = std::make_shared< std::atomic_bool >(false);
+        bot.search_id = search_id;
+        bot.p_cancel = p_cancel;
+
+        // Runs on a worker thread. Only the copied game state, the opening
+        // book and the tablebases are read. The book is never modified, and
+        // probing the tablebases is thread-safe.
+        const bool submitted = bot_pool->try_submit([this, game_id, search_id, game_state, move_time, max_nodes, p_cancel] {
+            TraceScope trace("bot/search");
+            const auto start = steady_clock::now();
+            auto op = opening_book ? opening_book->best(game_state) : std::nullopt;
+            if(!op) {
+                const auto deadline = max_nodes ? steady_clock::time_point::max() : start + move_time;
+                op = engine_search(game_state, { deadline, 64, p_cancel.get(), max_nodes, tablebases.get() }).op;
             }
+            post_bot_result({ game_id, search_id, op, steady_clock::now() - start });
+        });
+        if(!submitted) {
+            // Not expected, as the searches are capped at the queue size.
+            // The move is still played, without search.
+            log_error({ .game_id = game_id, .event = "bot" }, "Bot search queue is full.");
+            post_bot_result({ game_id, search_id, bot_fallback_operation(served_game) });
+        }
+    }
+
+    // A move of the bot without search: the book move, or else the first valid
+    // move. Empty if there is no valid move.
+    std::optional< Operation > bot_fallback_operation(const ServedGame& served_game) const {
+        const auto& item = *served_game.game_history.ptr_current_item();
+        if(opening_book) {
+            if(const auto op = opening_book->best(item.game_state)) return op;
+        }
+        std::optional< Operation > res;
+        valid_operation_generator(item.game_state, served_game.game_history.zobrist_table, item.board_state_hash, [&](Operation op) {
+            if(!res && op.category != Operation::Category::resign && op.category != Operation::Category::draw_accept) res = op;
+        });
+        return res;
+    }
+
+    void cancel_bot_search(BotPlayer& bot) {
+        if(bot.search_id) ++num_cancelled_bot_searches;
+        bot.cancel();
+    }
+
+    // Called from worker threads. Wakes the completion queue thread, unless a
+    // wakeup is already pending.
+    void post_bot_result(BotResult result) {
+        std::scoped_lock lock(bot_results.mutex);
+        bot_results.results.push_back(std::move(result));
+        if(!bot_results.wakeup_pending) {
+            bot_results.wakeup_pending = true;
+            bot_results.alarm.Set(cq.get(), gpr_now(GPR_CLOCK_MONOTONIC), bot_results_tag());
+        }
+    }
+
+    // Removes the bot from its seat, cancelling its search.
+    void remove_bot(ServedGame& served_game) {
+        if(!served_game.bot) return;
+        cancel_bot_search(*served_game.bot);
+        served_game.player_ids[served_game.bot->black ? 1 : 0] = 0;
+        served_game.bot.reset();
+        metrics.bot_games.sub();
+    }
+
+    // Writes the spans of all threads in the Chrome trace event format, and
+    // returns the reply to the "trace" command.
+    std::string write_trace_file() {
+        if constexpr(!trace_enabled) {
+            return "Tracing is not compiled in. Build with CHESS_TRACE=1.\n";
+        }
+
+        const std::string path = "chess_trace.json";
+        std::ofstream os(path);
+        const auto num_spans = tracer().write_chrome_trace(os);
+        if(!os) {
+            log_error({ .event = "trace" }, "Cannot write trace to ", path);
+            return "Cannot write trace to " + path + ".\n";
         }
+        log_info({ .event = "trace" }, "Wrote ", num_spans, " spans to ", path);
+        return "Wrote " + std::to_string(num_spans) + " spans to " + path + ".\n";
     }
 
-    // Returns the message, whether the message should be broadcasted, the repeated player message, and whether the client finishes.
-    // The repeated player message will not be replied to the sending player.
-    std::tuple< std::string, bool, std::string, bool > chess_respond(const chess_proto::ChessRequest& req) {
+    // Generates the response to a request.
+    // The message is broadcasted to all sessions of the game if requested, in
+    // which case the repeated player message is sent first to every session
+    // except the sender.
+    // followed_game_id is the game followed by the session, if any, so that a
+    // spectator not seated in the game can still request its status.
+    ChessResponse chess_respond(const chess_proto::ChessRequest& req, std::uint64_t followed_game_id = 0) {
         using namespace std;
 
-        ostringstream oss_message;
-        ostringstream oss_repeated;
-        bool broadcast = false;
-        bool client_finish = false;
+        // Messages are built in the scratch arena, and moved into the
+        // response without copying.
+        ChessResponse res;
+        ScratchOStringStream oss_message(ios_base::out, thread_scratch_arena().get());
+        ScratchOStringStream oss_repeated(ios_base::out, thread_scratch_arena().get());
         int who = 0; // 0: not ready, 1: white, 2: black
 
+        const auto& command = req.command();
+        const auto player_game_it = player_games.find(req.id());
+        ServedGame* p_served_game = nullptr;
+        if(player_game_it != player_games.end()) {
+            res.game_id = player_game_it->second;
+            p_served_game = &served_games.at(res.game_id);
+        }
+
         const auto server_log_game_players = [&, this] {
-            cout << "[Game] Players: 白" << (served_game.player_ids[0] ? "○" : "×") << " 黑" << (served_game.player_ids[1] ? "○" : "×") << endl;
+            log_info(
+                { .game_id = res.game_id, .player_id = req.id(), .event = "players" },
+                "Players: 白", (p_served_game->player_ids[0] ? "○" : "×"), " 黑", (p_served_game->player_ids[1] ? "○" : "×")
+            );
         };
-        const auto print_game_status = [&, this] {
-            served_game.game_history.ptr_current_item()->game_state.pretty_print_to(oss_message);
+        const auto print_game_status = [&] {
+            oss_message << p_served_game->status_cache.update(p_served_game->game_history).board_text;
             oss_message << endl;
         };
 
-        // General check
-        if(req.id() == 0) {
+        // General check. The bot id is reserved, so that no client can take
+        // the seat of a bot.
+        if(req.id() == 0 || req.id() == bot_player_id) {
             oss_message << "Error: invalid player id: " << req.id() << endl;
         }
-        else if(req.command() == "init") {
-            if(served_game.player_ids[0] == 0) {
-                served_game.player_ids[0] = req.id();
-                oss_message << "Player " << req.id() << " registered as white." << endl;
-                if(served_game.player_ids[1]) {
-                    oss_message << "Game starts.\n";
-                    print_game_status();
+        else if(command == "init" || command.starts_with("init ")) {
+            // Parse optional game id.
+            uint64_t game_id = default_game_id;
+            if(command.size() > 5) {
+                const auto [ptr, ec] = from_chars(command.data() + 5, command.data() + command.size(), game_id);
+                if(ec != errc() || ptr != command.data() + command.size() || game_id == 0) {
+                    oss_message << "Error: invalid game id: " << command.substr(5) << endl;
+                    game_id = 0;
                 }
-                broadcast = true;
-            }
-            else if(served_game.player_ids[0] == req.id()) {
-                oss_message << "Error: player " << req.id() << " is already registered as white." << endl;
             }
-            else if(served_game.player_ids[1] == 0) {
-                served_game.player_ids[1] = req.id();
-                oss_message << "Player " << req.id() << " registered as black." << endl;
-                if(served_game.player_ids[0]) {
-                    oss_message << "Game starts.\n";
-                    print_game_status();
-                }
-                broadcast = true;
+
+            if(game_id == 0) {
+                // Error reported.
             }
-            else if(served_game.player_ids[1] == req.id()) {
-                oss_message << "Error: player " << req.id() << " is already registered as black." << endl;
+            else if(p_served_game && res.game_id != game_id) {
+                oss_message << "Error: player " << req.id() << " is already registered in game " << res.game_id << "." << endl;
             }
             else {
-                oss_message << "Error: cannot register new player." << endl;
+                res.game_id = game_id;
+                p_served_game = &served_games[game_id];
+                p_served_game->game_history.p_tablebases = tablebases.get();
+                const bool was_full = p_served_game->is_full();
+
+                if(p_served_game->player_ids[0] == 0 && p_served_game->player_ids[1] != req.id()) {
+                    p_served_game->player_ids[0] = req.id();
+                    player_games[req.id()] = game_id;
+                    oss_message << "Player " << req.id() << " registered as white." << endl;
+                    if(p_served_game->player_ids[1]) {
+                        oss_message << "Game starts.\n";
+                        print_game_status();
+                    }
+                    res.broadcast = true;
+                }
+                else if(p_served_game->player_ids[0] == req.id()) {
+                    oss_message << "Error: player " << req.id() << " is already registered as white." << endl;
+                }
+                else if(p_served_game->player_ids[1] == 0) {
+                    p_served_game->player_ids[1] = req.id();
+                    player_games[req.id()] = game_id;
+                    oss_message << "Player " << req.id() << " registered as black." << endl;
+                    if(p_served_game->player_ids[0]) {
+                        oss_message << "Game starts.\n";
+                        print_game_status();
+                    }
+                    res.broadcast = true;
+                }
+                else if(p_served_game->player_ids[1] == req.id()) {
+                    oss_message << "Error: player " << req.id() << " is already registered as black." << endl;
+                }
+                else {
+                    // The session still follows the game as a spectator.
+                    oss_message << "Error: cannot register new player." << endl;
+                }
+
+                if(!was_full && p_served_game->is_full()) metrics.active_games.add();
+                server_log_game_players();
             }
-            server_log_game_players();
         }
-        else if(req.command() == "exit") {
+        else if(command == "exit") {
             oss_message << "Player " << req.id() << " left the game." << endl;
-            for(auto& id : served_game.player_ids) {
-                if(id == req.id()) {
-                    broadcast = true;
-                    id = 0;
+            if(p_served_game) {
+                const bool was_full = p_served_game->is_full();
+                for(auto& id : p_served_game->player_ids) {
+                    if(id == req.id()) {
+                        res.broadcast = true;
+                        id = 0;
+                    }
+                }
+                player_games.erase(player_game_it);
+                // A bot does not play on alone.
+                if(p_served_game->bot && p_served_game->player_ids[p_served_game->bot->black ? 0 : 1] == 0) {
+                    remove_bot(*p_served_game);
+                }
+                if(was_full) metrics.active_games.sub();
+                server_log_game_players();
+
+                // Release the game when no player is left.
+                if(p_served_game->player_ids[0] == 0 && p_served_game->player_ids[1] == 0) {
+                    served_games.erase(res.game_id);
+                    p_served_game = nullptr;
+                    res.game_released = true;
+                    if(journal) journal->append_release(res.game_id);
                 }
             }
-            client_finish = true;
-            server_log_game_players();
+            res.client_finish = true;
         }
-        else if(served_game.player_ids[0] == 0 || served_game.player_ids[1] == 0) {
+        else if(command == "bot") {
+            // A bot takes the free seat of the game of the player.
+            if(p_served_game == nullptr) {
+                oss_message << "Error: player " << req.id() << " is not registered in any game." << endl;
+            }
+            else if(p_served_game->is_full()) {
+                oss_message << "Error: the game already has two players." << endl;
+            }
+            // Each bot takes a search place, and so does each cancelled search
+            // still in the queue, so that the queue cannot overflow.
+            else if(static_cast< std::size_t >(metrics.bot_games.get()) + num_cancelled_bot_searches >= bot_settings.max_searches) {
+                oss_message << "Error: too many bot games. Try again later." << endl;
+            }
+            else {
+                const bool black = p_served_game->player_ids[1] == 0;
+                p_served_game->player_ids[black ? 1 : 0] = bot_player_id;
+                p_served_game->bot = BotPlayer { black, bot_settings.game_budget };
+                metrics.bot_games.add();
+                metrics.active_games.add();
+
+                oss_message << "Bot registered as " << (black ? "black" : "white") << "." << endl;
+                oss_message << "Game starts.\n";
+                print_game_status();
+                res.broadcast = true;
+                server_log_game_players();
+
+                start_bot_search(res.game_id, *p_served_game);
+            }
+        }
+        else if(p_served_game == nullptr && command == "show" && served_games.contains(followed_game_id)) {
+            // Spectators share the cached status with the players.
+            res.game_id = followed_game_id;
+            p_served_game = &served_games.at(followed_game_id);
+            print_game_status();
+        }
+        else if(p_served_game == nullptr) {
+            oss_message << "Error: player " << req.id() << " is not registered in any game." << endl;
+        }
+        else if(!p_served_game->is_full()) {
             oss_message << "Error: waiting for other players." << endl;
         }
-        else if(req.id() == served_game.player_ids[0]) {
+        else if(req.id() == p_served_game->player_ids[0]) {
             who = 1; // white
         }
-        else if(req.id() == served_game.player_ids[1]) {
+        else if(req.id() == p_served_game->player_ids[1]) {
             who = 2; // black
         }
 
         if(who) {
-            oss_repeated << (who == 2 ? "black> " : "white> ") << req.command() << endl;
-            broadcast = server_game_step(served_game.game_history, who == 2, req.command(), oss_message);
+            oss_repeated << (who == 2 ? "black> " : "white> ") << command << endl;
+            res.broadcast = play_game_command(res.game_id, *p_served_game, who == 2, command, oss_message);
+
+            // The bot replies to the move, or stops if the game ended.
+            if(res.broadcast) start_bot_search(res.game_id, *p_served_game);
         }
 
         // Server debug.
-        cout << "Player " << req.id() << "> " << req.command() << endl;
-        cout << oss_message.str();
+        log_debug({ .game_id = res.game_id, .player_id = req.id(), .event = "request" }, command);
+        log_trace({ .game_id = res.game_id, .player_id = req.id(), .event = "reply" }, oss_message.view());
 
-        return { oss_message.str(), broadcast, oss_repeated.str(), client_finish };
+        res.message = move(oss_message).str();
+        res.repeated_message = move(oss_repeated).str();
+        return res;
     }
 
 };
 
-inline void run_server() {
+// If journal_path is not empty, games are recovered from and persisted to the journal.
+// If book_path is not empty, the opening book is used for hints.
+// If tablebase_dir is not empty, endgames in the tablebases are adjudicated.
+inline void run_server(const std::string& journal_path = "", const std::string& book_path = "", const std::string& tablebase_dir = "") {
     std::string server_address("0.0.0.0:50051");
 
     ChessServiceImpl server;
+    if(!tablebase_dir.empty()) {
+        server.open_tablebases(tablebase_dir);
+    }
+    if(!journal_path.empty()) {
+        server.open_journal(journal_path);
+    }
+    if(!book_path.empty()) {
+        server.open_opening_book(book_path);
+    }
     server.run(server_address);
 }
 
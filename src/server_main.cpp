@@ -0,0 +1,10 @@
+#include "server.hpp"
+
+int main(int argc, char** argv) {
+    using namespace chess;
+
+    // Optional journal and opening book paths, and tablebase directory.
+    run_server(argc >= 2 ? argv[1] : "", argc >= 3 ? argv[2] : "", argc >= 4 ? argv[3] : "");
+
+    return 0;
+}
@@ -0,0 +1,91 @@
+#ifndef CHESS_SLOT_POOL_HPP
+#define CHESS_SLOT_POOL_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <utility>
+#include <vector>
+
+namespace chess {
+
+//-----------------------------------------------------------------------------
+// Pool of objects in recycled slots, referred to by stable handles.
+//
+// Slots are allocated in slabs that are never freed or moved, so the address
+// of an object is stable while it is alive, and releasing an object keeps its
+// slot for the next one instead of returning the memory to the allocator.
+//
+// Each handle records the generation of its slot, which is incremented on
+// release, so a handle to a released object is detected as stale instead of
+// referring to the object that reuses the slot.
+//-----------------------------------------------------------------------------
+
+struct SlotHandle {
+    std::uint32_t index = 0;
+    // 0 is never used by a live object, so a default handle is always stale.
+    std::uint32_t generation = 0;
+
+    friend bool operator==(const SlotHandle&, const SlotHandle&) = default;
+};
+
+template< typename T >
+struct SlotPool {
+    inline static constexpr std::size_t slab_size = 64;
+
+    struct Slot {
+        std::optional< T > value;
+        std::uint32_t      generation = 1;
+    };
+
+    std::vector< std::unique_ptr< Slot[] > > slabs;
+    // Indices of released slots, reused last in first out.
+    std::vector< std::uint32_t >             free_indices;
+    std::size_t                              num_active = 0;
+
+    Slot& slot(std::uint32_t index) { return slabs[index / slab_size][index % slab_size]; }
+
+    // Constructs an object in a free slot, adding a slab if there is none.
+    template< typename... Args >
+    SlotHandle acquire(Args&&... args) {
+        if(free_indices.empty()) {
+            const auto first = static_cast< std::uint32_t >(slabs.size() * slab_size);
+            slabs.push_back(std::make_unique< Slot[] >(slab_size));
+            for(auto i = static_cast< std::uint32_t >(slab_size); i > 0; --i) {
+                free_indices.push_back(first + i - 1);
+            }
+        }
+        const auto index = free_indices.back();
+        free_indices.pop_back();
+
+        auto& s = slot(index);
+        s.value.emplace(std::forward< Args >(args)...);
+        ++num_active;
+        return { index, s.generation };
+    }
+
+    // Returns null if the handle is stale.
+    T* get(SlotHandle handle) {
+        if(handle.index >= slabs.size() * slab_size) return nullptr;
+        auto& s = slot(handle.index);
+        if(s.generation != handle.generation || !s.value) return nullptr;
+        return &*s.value;
+    }
+
+    // Destroys the object. Does nothing if the handle is stale.
+    void release(SlotHandle handle) {
+        if(!get(handle)) return;
+        auto& s = slot(handle.index);
+        s.value.reset();
+        if(++s.generation == 0) s.generation = 1;
+        free_indices.push_back(handle.index);
+        --num_active;
+    }
+
+    std::size_t size() const { return num_active; }
+};
+
+} // namespace chess
+
+#endif
@@ -0,0 +1,118 @@
+// Game archive tool.
+//
+// Builds a memory-mapped archive of finished games from a server journal, and
+// answers queries on it in place.
+//
+// Usage:
+//   chess_archive build <journal> <archive>
+//   chess_archive info <archive>
+//   chess_archive game <archive> <game id>
+//   chess_archive reach <archive> <game id> <ply>
+//       Lists all games that reached the position of a game after the ply.
+
+#include <cstdint>
+#include <exception>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "archive.hpp"
+#include "chess/pgn.hpp"
+#include "journal.hpp"
+
+namespace chess {
+
+inline int archive_build(const std::string& journal_path, const std::string& archive_path) {
+    const auto games = recover_journal(journal_path, 0, true);
+
+    std::vector< ArchiveInputGame > finished;
+    for(const auto& [id, gh] : games) {
+        if(gh.ptr_current_item()->game_state.status != GameState::Status::active) {
+            finished.push_back({ id, &gh });
+        }
+    }
+    write_game_archive(archive_path, finished);
+    std::cout << "Archived " << finished.size() << " finished games out of " << games.size() << '.' << std::endl;
+    return 0;
+}
+
+inline int archive_info(const GameArchive& archive) {
+    std::uint64_t results[4] {};
+    for(std::size_t i = 0; i < archive.games.size(); ++i) {
+        ++results[archive.games[i].result % 4];
+    }
+    std::cout << "games " << archive.games.size()
+        << ", plies " << archive.ops.size()
+        << ", positions " << archive.positions.size() << '\n'
+        << "white wins " << results[underlying(GameState::Status::white_win)]
+        << ", black wins " << results[underlying(GameState::Status::black_win)]
+        << ", draws " << results[underlying(GameState::Status::draw)] << std::endl;
+    return 0;
+}
+
+inline int archive_game(const GameArchive& archive, std::uint64_t game_id) {
+    const auto game = archive.find_game(game_id);
+    if(!game) {
+        std::cout << "Game " << game_id << " not found." << std::endl;
+        return 1;
+    }
+    // Moves in SAN. Resignations and accepted draws only show in the result.
+    const auto gh = archive.load_game_history(*game);
+    for(std::size_t ply = 1; ply < gh.num_items(); ++ply) {
+        const auto san = san_text(gh.history[ply - 1].game_state, gh.history[ply].op, gh.history[ply].game_state);
+        if(san.empty()) continue;
+        if(ply % 2 == 1) std::cout << (ply + 1) / 2 << ". ";
+        std::cout << san << ' ';
+    }
+    std::cout << pgn_result_text(game->result()) << std::endl;
+    return 0;
+}
+
+inline int archive_reach(const GameArchive& archive, std::uint64_t game_id, std::uint32_t ply) {
+    const auto game = archive.find_game(game_id);
+    if(!game || ply >= game->hashes.size()) {
+        std::cout << "Position not found." << std::endl;
+        return 1;
+    }
+    std::uint64_t count = 0;
+    archive.for_each_game_reaching(game->hashes[ply], [&](const GameArchive::GameView& g, std::uint32_t g_ply) {
+        std::cout << "game " << g.p_record->game_id << " ply " << g_ply << ' ' << pgn_result_text(g.result()) << '\n';
+        ++count;
+    });
+    std::cout << count << " games reached the position." << std::endl;
+    return 0;
+}
+
+} // namespace chess
+
+int main(int argc, char** argv) {
+    using namespace std;
+    using namespace chess;
+
+    try {
+        const string command = argc >= 2 ? argv[1] : "";
+        if(command == "build" && argc == 4) {
+            return archive_build(argv[2], argv[3]);
+        }
+        if(command == "info" && argc == 3) {
+            return archive_info(GameArchive(argv[2]));
+        }
+        if(command == "game" && argc == 4) {
+            return archive_game(GameArchive(argv[2]), stoull(argv[3]));
+        }
+        if(command == "reach" && argc == 5) {
+            return archive_reach(GameArchive(argv[2]), stoull(argv[3]), stoul(argv[4]));
+        }
+    }
+    catch(const exception& e) {
+        cerr << e.what() << endl;
+        return 1;
+    }
+
+    cerr << "Usage:\n"
+        << "  chess_archive build <journal> <archive>\n"
+        << "  chess_archive info <archive>\n"
+        << "  chess_archive game <archive> <game id>\n"
+        << "  chess_archive reach <archive> <game id> <ply>\n";
+    return 1;
+}
@@ -0,0 +1,333 @@
+// Microbenchmarks of the rules primitives.
+//
+// Runs each primitive over a corpus of positions from random games, which is
+// generated from a fixed seed so that runs are comparable. Each benchmark is
+// calibrated to run for at least the minimum time, and repeated. Results are
+// written to stdout as JSON in the layout of Google Benchmark, with the mean,
+// median and standard deviation of the time per item over the repetitions,
+// and a summary is written to stderr.
+//
+// Usage:
+//   chess_bench [--seed <n>] [--games <n>] [--max-plies <n>]
+//               [--min-time <seconds>] [--repetitions <n>] [--filter <substring>]
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "chess/mobility.hpp"
+#include "chess/operation.hpp"
+#include "utility.hpp"
+
+namespace chess {
+
+struct BenchConfig {
+    std::uint64_t seed = 1;
+    int           num_games = 64;
+    int           max_plies = 160;
+    double        min_time = 0.5;
+    int           repetitions = 5;
+    // Only benchmarks whose name contains the filter are run.
+    std::string   filter;
+};
+
+// A position of the corpus, with its valid operations.
+struct BenchPosition {
+    GameState                       game_state;
+    BoardStateZobristTable::HashInt board_state_hash = 0;
+    std::vector< Operation >        valid_ops;
+    // Random operations, mostly invalid, as a client might send.
+    std::vector< Operation >        random_ops;
+};
+
+struct BenchCorpus {
+    std::vector< GameHistory >   games;
+    std::vector< BenchPosition > positions;
+    std::vector< PackedPosition > packed_positions;
+    std::size_t                  num_valid_ops = 0;
+    std::size_t                  num_random_ops = 0;
+    // Identifies the corpus, so that results of different corpora are not
+    // compared by mistake.
+    std::uint64_t                checksum = 0;
+};
+
+// Plays random games from the standard opening. Only the seeded generator
+// is used, so the corpus is the same on every run.
+inline BenchCorpus make_bench_corpus(const BenchConfig& config) {
+    std::mt19937_64 rng(config.seed);
+
+    BenchCorpus corpus;
+    std::ostream null_os(nullptr);
+    corpus.games.resize(config.num_games);
+    for(auto& gh : corpus.games) {
+        for(int ply = 0; ply < config.max_plies; ++ply) {
+            const auto& item = *gh.ptr_current_item();
+            if(item.game_state.status != GameState::Status::active) break;
+
+            BenchPosition pos { item.game_state, item.board_state_hash };
+            valid_operation_generator(item.game_state, gh.zobrist_table, item.board_state_hash, [&](Operation op) { pos.valid_ops.push_back(op); });
+            for(std::size_t i = 0; i < pos.valid_ops.size(); ++i) {
+                pos.random_ops.push_back(Operation {
+                    Operation::Category::move,
+                    static_cast< int >(rng() % 8), static_cast< int >(rng() % 8),
+                    static_cast< int >(rng() % 8), static_cast< int >(rng() % 8),
+                });
+            }
+            const auto op = pos.valid_ops[rng() % pos.valid_ops.size()];
+
+            corpus.num_valid_ops += pos.valid_ops.size();
+            corpus.num_random_ops += pos.random_ops.size();
+            // The hash of the game history uses a random Zobrist table, which
+            // differs between runs.
+            corpus.checksum = corpus.checksum * 31 + hash(pos.game_state.board_state, standard_zobrist_table());
+            corpus.packed_positions.push_back(pack_position(pos.game_state));
+            corpus.positions.push_back(std::move(pos));
+
+            // Checks game endings such as checkmate and repetition.
+            game_round(gh, op, null_os);
+        }
+    }
+    return corpus;
+}
+
+// Prevents the compiler from optimizing away the computation of a value.
+template< typename T >
+inline void bench_keep(const T& value) {
+#if defined(_MSC_VER)
+    static volatile const void* sink;
+    sink = &value;
+#else
+    asm volatile("" : : "r,m"(value) : "memory");
+#endif
+}
+
+struct Benchmark {
+    std::string name;
+    // Number of items processed by one iteration.
+    std::size_t items_per_iteration = 0;
+    std::function< void() > run;
+};
+
+struct BenchResult {
+    std::string           name;
+    std::uint64_t         iterations = 0;
+    std::size_t           items_per_iteration = 0;
+    // Nanoseconds per item of each repetition.
+    std::vector< double > ns_per_item;
+};
+
+inline BenchResult run_benchmark(const Benchmark& bench, const BenchConfig& config) {
+    using namespace std;
+    using clock = chrono::steady_clock;
+
+    const auto time_iterations = [&](uint64_t iterations) {
+        const auto start = clock::now();
+        for(uint64_t i = 0; i < iterations; ++i) bench.run();
+        return chrono::duration< double >(clock::now() - start).count();
+    };
+
+    // Warm up, then grow the iterations until the minimum time is reached.
+    time_iterations(1);
+    uint64_t iterations = 1;
+    while(true) {
+        const auto elapsed = time_iterations(iterations);
+        if(elapsed >= config.min_time) break;
+        const double factor = elapsed > 0 ? config.min_time * 1.4 / elapsed : 10;
+        iterations = max< uint64_t >(iterations + 1, static_cast< uint64_t >(iterations * min(factor, 10.0)));
+    }
+
+    BenchResult res { bench.name, iterations, bench.items_per_iteration };
+    for(int r = 0; r < config.repetitions; ++r) {
+        const auto elapsed = time_iterations(iterations);
+        res.ns_per_item.push_back(elapsed * 1e9 / (static_cast< double >(iterations) * bench.items_per_iteration));
+    }
+    return res;
+}
+
+inline std::vector< Benchmark > make_benchmarks(const BenchCorpus& corpus) {
+    using namespace std;
+
+    const auto& table = standard_zobrist_table();
+    vector< Benchmark > res;
+
+    res.push_back({ "position_attacked", corpus.positions.size() * BoardState::size, [&] {
+        for(const auto& pos : corpus.positions) {
+            const auto& board_state = pos.game_state.board_state;
+            for(int i = 0; i < BoardState::size; ++i) {
+                const auto [x, y] = BoardState::index_to_coord(i);
+                bench_keep(board_state.position_attacked(x, y, !board_state.black_turn));
+            }
+        }
+    } });
+
+    res.push_back({ "validate_operation/valid", corpus.num_valid_ops, [&] {
+        for(const auto& pos : corpus.positions) {
+            for(const auto& op : pos.valid_ops) bench_keep(validate_operation(pos.game_state, op).okay);
+        }
+    } });
+
+    res.push_back({ "validate_operation/random", corpus.num_random_ops, [&] {
+        for(const auto& pos : corpus.positions) {
+            for(const auto& op : pos.random_ops) bench_keep(validate_operation(pos.game_state, op).okay);
+        }
+    } });
+
+    res.push_back({ "apply_operation_in_place", corpus.num_valid_ops, [&] {
+        for(const auto& pos : corpus.positions) {
+            for(const auto& op : pos.valid_ops) {
+                auto game_state = pos.game_state;
+                bench_keep(apply_operation_in_place(game_state, pos.board_state_hash, op, table));
+            }
+        }
+    } });
+
+    res.push_back({ "hash", corpus.positions.size(), [&] {
+        for(const auto& pos : corpus.positions) bench_keep(hash(pos.game_state.board_state, table));
+    } });
+
+    // Each position of a game is looked up in the full history of the game.
+    size_t num_history_items = 0;
+    for(const auto& gh : corpus.games) num_history_items += gh.num_items();
+    res.push_back({ "count_board_state_repetition", num_history_items, [&] {
+        for(const auto& gh : corpus.games) {
+            for(const auto& item : gh.current_items()) {
+                bench_keep(gh.count_board_state_repetition(item.game_state.board_state, item.board_state_hash));
+            }
+        }
+    } });
+
+    res.push_back({ "count_valid_operations", corpus.positions.size(), [&] {
+        for(const auto& pos : corpus.positions) bench_keep(count_valid_operations(pos.game_state, table, pos.board_state_hash));
+    } });
+
+    res.push_back({ "count_valid_operations_batch", corpus.positions.size(), [&, counts = vector< int >(corpus.positions.size())]() mutable {
+        count_valid_operations_batch(corpus.packed_positions, counts);
+        bench_keep(counts.data());
+    } });
+
+    return res;
+}
+
+inline double bench_mean(const std::vector< double >& xs) {
+    double sum = 0;
+    for(const auto x : xs) sum += x;
+    return xs.empty() ? 0 : sum / xs.size();
+}
+inline double bench_median(std::vector< double > xs) {
+    if(xs.empty()) return 0;
+    std::ranges::sort(xs);
+    const auto n = xs.size();
+    return n % 2 ? xs[n / 2] : (xs[n / 2 - 1] + xs[n / 2]) / 2;
+}
+inline double bench_stddev(const std::vector< double >& xs) {
+    if(xs.size() < 2) return 0;
+    const auto mean = bench_mean(xs);
+    double sum = 0;
+    for(const auto x : xs) sum += (x - mean) * (x - mean);
+    return std::sqrt(sum / (xs.size() - 1));
+}
+
+// Writes the results in the JSON layout of Google Benchmark. Times are per
+// item, in nanoseconds.
+inline void write_bench_json(std::ostream& os, const BenchConfig& config, const BenchCorpus& corpus, const std::vector< BenchResult >& results) {
+    os << std::setprecision(6);
+    os << "{\n"
+        << "  \"context\": {\n"
+        << "    \"library_build_type\": \"" << (debug ? "debug" : "release") << "\",\n"
+        << "    \"seed\": " << config.seed << ",\n"
+        << "    \"games\": " << config.num_games << ",\n"
+        << "    \"max_plies\": " << config.max_plies << ",\n"
+        << "    \"positions\": " << corpus.positions.size() << ",\n"
+        << "    \"corpus_checksum\": \"" << std::hex << corpus.checksum << std::dec << "\",\n"
+        << "    \"repetitions\": " << config.repetitions << "\n"
+        << "  },\n"
+        << "  \"benchmarks\": [";
+
+    bool first = true;
+    const auto write_entry = [&](const BenchResult& r, const std::string& suffix, const char* run_type, int repetition_index, double ns) {
+        os << (first ? "\n" : ",\n");
+        first = false;
+        os << "    {\n"
+            << "      \"name\": \"" << r.name << suffix << "\",\n"
+            << "      \"run_name\": \"" << r.name << "\",\n"
+            << "      \"run_type\": \"" << run_type << "\",\n";
+        if(repetition_index >= 0) {
+            os << "      \"repetition_index\": " << repetition_index << ",\n";
+        }
+        os
+            << "      \"iterations\": " << r.iterations << ",\n"
+            << "      \"items_per_iteration\": " << r.items_per_iteration << ",\n"
+            << "      \"real_time\": " << ns << ",\n"
+            << "      \"time_unit\": \"ns\",\n"
+            << "      \"items_per_second\": " << (ns > 0 ? 1e9 / ns : 0) << "\n"
+            << "    }";
+    };
+    for(const auto& r : results) {
+        for(int i = 0; i < static_cast< int >(r.ns_per_item.size()); ++i) {
+            write_entry(r, "", "iteration", i, r.ns_per_item[i]);
+        }
+        write_entry(r, "_mean",   "aggregate", -1, bench_mean(r.ns_per_item));
+        write_entry(r, "_median", "aggregate", -1, bench_median(r.ns_per_item));
+        write_entry(r, "_stddev", "aggregate", -1, bench_stddev(r.ns_per_item));
+    }
+    os << "\n  ]\n}\n";
+}
+
+inline BenchConfig parse_bench_config(int argc, char** argv) {
+    BenchConfig config;
+    for(int i = 1; i + 1 < argc; i += 2) {
+        const std::string key = argv[i];
+        const std::string val = argv[i + 1];
+        if(key == "--seed")             config.seed = std::stoull(val);
+        else if(key == "--games")       config.num_games = std::stoi(val);
+        else if(key == "--max-plies")   config.max_plies = std::stoi(val);
+        else if(key == "--min-time")    config.min_time = std::stod(val);
+        else if(key == "--repetitions") config.repetitions = std::max(1, std::stoi(val));
+        else if(key == "--filter")      config.filter = val;
+        else {
+            std::cerr << "Unknown option " << key << std::endl;
+            std::exit(1);
+        }
+    }
+    return config;
+}
+
+inline void run_bench(const BenchConfig& config) {
+    using namespace std;
+
+    const auto corpus = make_bench_corpus(config);
+    cerr << "Corpus: " << corpus.positions.size() << " positions from " << config.num_games << " games, seed " << config.seed << ".\n";
+    if(corpus.positions.empty()) {
+        cerr << "Empty corpus." << endl;
+        exit(1);
+    }
+
+    vector< BenchResult > results;
+    for(const auto& bench : make_benchmarks(corpus)) {
+        if(bench.name.find(config.filter) == string::npos) continue;
+        results.push_back(run_benchmark(bench, config));
+
+        const auto& r = results.back();
+        cerr << left << setw(32) << r.name << right
+            << " median " << setw(10) << fixed << setprecision(2) << bench_median(r.ns_per_item) << " ns/item"
+            << "  stddev " << setw(8) << bench_stddev(r.ns_per_item)
+            << "  iterations " << r.iterations << defaultfloat << endl;
+    }
+
+    write_bench_json(cout, config, corpus, results);
+}
+
+} // namespace chess
+
+int main(int argc, char** argv) {
+    chess::run_bench(chess::parse_bench_config(argc, argv));
+    return 0;
+}
@@ -0,0 +1,204 @@
+// Opening book tool.
+//
+// Usage:
+//   chess_book build <pgn> <book> [--max-plies <n>] [--min-games <n>] [--threads <n>]
+//       Builds a book from the first plies of all games with a result.
+//       A move scores 2 for a win and 1 for a draw of the player making it.
+//   chess_book probe <book> [<fen>]
+//       Lists the book moves of a position, the standard opening by default.
+
+#include <algorithm> // max, min
+#include <chrono>
+#include <cstdint>
+#include <exception>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "book.hpp"
+#include "chess/fen.hpp"
+#include "chess/pgn.hpp"
+#include "mapped_file.hpp"
+
+namespace chess {
+
+struct BookBuildConfig {
+    std::size_t   max_plies = 20;
+    std::uint64_t min_games = 3;
+    unsigned      num_threads = 0;
+};
+
+// Statistics of a move in a position.
+struct BookMoveStats {
+    std::uint64_t score = 0;
+    std::uint64_t num_games = 0;
+};
+struct BookMoveKey {
+    BoardStateZobristTable::HashInt hash = 0;
+    PackedOperation                 op = 0;
+
+    friend bool operator==(const BookMoveKey&, const BookMoveKey&) = default;
+};
+struct BookMoveKeyHash {
+    std::size_t operator()(const BookMoveKey& key) const noexcept {
+        return key.hash ^ (static_cast< std::size_t >(key.op) * 0x9e3779b97f4a7c15ull);
+    }
+};
+using BookMoveMap = std::unordered_map< BookMoveKey, BookMoveStats, BookMoveKeyHash >;
+
+inline int book_build(const std::string& pgn_path, const std::string& book_path, BookBuildConfig config) {
+    const MappedFile file(pgn_path);
+    const std::string_view text(reinterpret_cast< const char* >(file.data), file.size);
+
+    const auto start = std::chrono::steady_clock::now();
+
+    std::vector< PgnGameText > games;
+    for_each_pgn_game(text, [&](const PgnGameText& game) { games.push_back(game); });
+
+    if(config.num_threads == 0) config.num_threads = std::max(1u, std::thread::hardware_concurrency());
+    const auto& table = standard_zobrist_table();
+    const GameHistory initial_game_history;
+
+    // Each thread counts moves of a strided subset of games.
+    std::vector< BookMoveMap >   thread_moves(config.num_threads);
+    std::vector< std::uint64_t > thread_num_used(config.num_threads);
+    {
+        std::vector< std::thread > workers;
+        for(unsigned t = 0; t < config.num_threads; ++t) {
+            workers.emplace_back([&, t] {
+                auto& moves = thread_moves[t];
+                for(std::size_t i = t; i < games.size(); i += config.num_threads) {
+                    std::optional< GameState::Status > result;
+                    for(const auto& tag : parse_pgn_tags(games[i].tags)) {
+                        if(tag.name == "Result") result = parse_pgn_result(tag.value);
+                    }
+                    if(!result || *result == GameState::Status::active) continue;
+
+                    auto game_history = initial_game_history;
+                    if(!replay_pgn_game(game_history, games[i], config.max_plies).okay) continue;
+                    ++thread_num_used[t];
+
+                    const auto  history = game_history.current_items();
+                    for(std::size_t ply = 1; ply < history.size(); ++ply) {
+                        const auto& board_state = history[ply - 1].game_state.board_state;
+                        auto& stats = moves[{ hash(board_state, table), pack_operation(history[ply].op) }];
+                        stats.score +=
+                            *result == GameState::Status::draw ? 1
+                            : (*result == GameState::Status::black_win) == board_state.black_turn ? 2
+                            : 0;
+                        ++stats.num_games;
+                    }
+                }
+            });
+        }
+        for(auto& w : workers) w.join();
+    }
+
+    BookMoveMap moves = std::move(thread_moves[0]);
+    std::uint64_t num_used = thread_num_used[0];
+    for(unsigned t = 1; t < config.num_threads; ++t) {
+        for(const auto& [key, stats] : thread_moves[t]) {
+            auto& s = moves[key];
+            s.score += stats.score;
+            s.num_games += stats.num_games;
+        }
+        num_used += thread_num_used[t];
+    }
+
+    // Keep frequent moves, and scale the scores of each position into 16 bits.
+    std::vector< OpeningBookEntry > entries;
+    std::unordered_map< BoardStateZobristTable::HashInt, std::uint64_t > max_scores;
+    for(const auto& [key, stats] : moves) {
+        if(stats.num_games >= config.min_games) {
+            auto& m = max_scores[key.hash];
+            m = std::max(m, stats.score);
+        }
+    }
+    for(const auto& [key, stats] : moves) {
+        if(stats.num_games < config.min_games) continue;
+        const auto max_score = max_scores[key.hash];
+        const auto weight = max_score > 0xffff ? stats.score * 0xffff / max_score : stats.score;
+        entries.push_back({
+            key.hash,
+            key.op,
+            static_cast< std::uint16_t >(weight),
+            static_cast< std::uint32_t >(std::min< std::uint64_t >(stats.num_games, 0xffffffff)),
+        });
+    }
+    write_opening_book(book_path, entries);
+
+    const std::chrono::duration< double > elapsed = std::chrono::steady_clock::now() - start;
+    std::cout << "games " << games.size()
+        << ", used " << num_used
+        << ", positions " << max_scores.size()
+        << ", entries " << entries.size()
+        << ", " << elapsed.count() << " s" << std::endl;
+    return 0;
+}
+
+inline int book_probe(const std::string& book_path, const std::string& fen) {
+    const OpeningBook book(book_path);
+    const auto parsed = parse_fen(fen);
+    if(!parsed.okay) {
+        std::cerr << "Invalid FEN: " << parsed.error_message << std::endl;
+        return 1;
+    }
+    const auto& game_state = parsed.game_state;
+
+    const auto start = std::chrono::steady_clock::now();
+    const auto found = book.find(game_state);
+    const std::chrono::duration< double, std::micro > elapsed = std::chrono::steady_clock::now() - start;
+
+    for(const auto& e : found) {
+        const auto op = unpack_operation(e.op);
+        if(!is_operation_legal(game_state, op)) continue;
+
+        // The state after the move is only needed for the check suffix.
+        GameHistory gh(game_state);
+        std::ostream null_os(nullptr);
+        game_round(gh, op, null_os);
+        std::cout << san_text(game_state, op, gh.ptr_current_item()->game_state)
+            << " weight " << e.weight
+            << " games " << e.num_games << '\n';
+    }
+    std::cout << found.size() << " moves, lookup " << elapsed.count() << " us" << std::endl;
+    return 0;
+}
+
+} // namespace chess
+
+int main(int argc, char** argv) {
+    using namespace std;
+    using namespace chess;
+
+    try {
+        const string command = argc >= 2 ? argv[1] : "";
+        if(command == "build" && argc >= 4) {
+            BookBuildConfig config;
+            bool args_valid = true;
+            for(int i = 4; i < argc; ++i) {
+                const string arg = argv[i];
+                if(arg == "--max-plies" && i + 1 < argc)      config.max_plies = stoull(argv[++i]);
+                else if(arg == "--min-games" && i + 1 < argc) config.min_games = stoull(argv[++i]);
+                else if(arg == "--threads" && i + 1 < argc)   config.num_threads = stoul(argv[++i]);
+                else args_valid = false;
+            }
+            if(args_valid) return book_build(argv[2], argv[3], config);
+        }
+        if(command == "probe" && (argc == 3 || argc == 4)) {
+            return book_probe(argv[2], argc == 4 ? argv[3] : standard_opening_fen);
+        }
+    }
+    catch(const exception& e) {
+        cerr << e.what() << endl;
+        return 1;
+    }
+
+    cerr << "Usage:\n"
+        << "  chess_book build <pgn> <book> [--max-plies <n>] [--min-games <n>] [--threads <n>]\n"
+        << "  chess_book probe <book> [<fen>]\n";
+    return 1;
+}
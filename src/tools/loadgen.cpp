@@ -0,0 +1,449 @@
+// Headless load generator for the chess server.
+//
+// Opens pairs of Command streams, registers each pair in its own game, and
+// plays random valid games, reporting the throughput and the latency from
+// sending a move to receiving its reply.
+//
+// Usage:
+//   chess_loadgen [--target <host:port>] [--games <concurrent games>]
+//                 [--threads <n>] [--duration <seconds>] [--rate <moves/s per game>]
+//                 [--max-plies <n>] [--max-games <n>]
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <grpcpp/alarm.h>
+#include <grpcpp/grpcpp.h>
+
+#include "chess/game.hpp"
+#include "metrics.hpp"
+#include "proto/helloworld.grpc.pb.h"
+#include "utility.hpp"
+
+namespace chess {
+
+struct LoadgenConfig {
+    std::string   target = "localhost:50051";
+    int           num_games = 100;
+    int           num_threads = 1;
+    double        duration = 10;
+    // Moves per second for each game. 0 means as fast as possible.
+    double        rate = 0;
+    int           max_plies = 300;
+    // Total games to start. 0 means unlimited within the duration.
+    std::uint64_t max_games = 0;
+};
+
+struct LoadgenStats {
+    Counter          games_started;
+    Counter          games_completed;
+    Counter          games_failed;
+    Counter          moves;
+    LatencyHistogram move_latency;
+};
+
+// A game played by two streams on the same completion queue.
+//
+// The server replies to each request on the sender's stream, after any
+// broadcast messages queued earlier. A valid request from the opponent queues
+// 2 broadcast messages (the repeated command and the message) on this stream,
+// which are skipped before the reply.
+struct LoadgenGame {
+    enum class Phase { connecting, registering_white, registering_black, playing, exiting_first, exiting_second, done };
+    enum class TagKind { start, read, write, finish, alarm };
+
+    struct Tag {
+        LoadgenGame* game = nullptr;
+        int          side = 0;
+        TagKind      kind = TagKind::start;
+    };
+
+    struct Player {
+        std::uint64_t        id = 0;
+        grpc::ClientContext  ctx;
+        std::unique_ptr< grpc::ClientAsyncReaderWriter< chess_proto::ChessRequest, chess_proto::ChessReply > > stream;
+        chess_proto::ChessRequest req;
+        chess_proto::ChessReply   rep;
+        grpc::Status         status;
+
+        bool                 started = false;
+        bool                 done = false;
+        bool                 writing = false;
+        std::deque< std::string > write_queue;
+
+        // Broadcast messages to skip before the reply to our request.
+        int                  unread_broadcasts = 0;
+        bool                 awaiting_reply = false;
+        std::chrono::steady_clock::time_point sent_time;
+
+        Tag                  tags[4];
+    };
+
+    const LoadgenConfig&  config;
+    LoadgenStats&         stats;
+    grpc::CompletionQueue& cq;
+    const std::atomic_bool& stopping;
+
+    std::uint64_t         game_id = 0;
+    Phase                 phase = Phase::connecting;
+    Player                players[2]; // white, black
+    int                   pending_ops = 0;
+    bool                  failed = false;
+
+    GameHistory           game_history;
+    Operation             pending_op;
+    std::mt19937          gen;
+    grpc::Alarm           alarm;
+    Tag                   alarm_tag { this, 0, TagKind::alarm };
+    std::chrono::system_clock::time_point next_move_time = std::chrono::system_clock::now();
+
+    LoadgenGame(
+        const LoadgenConfig&    config,
+        LoadgenStats&           stats,
+        grpc::CompletionQueue&  cq,
+        const std::atomic_bool& stopping,
+        const GameHistory&      initial_game_history,
+        std::uint64_t           game_id,
+        std::uint64_t           seed
+    ) : config(config), stats(stats), cq(cq), stopping(stopping), game_id(game_id), game_history(initial_game_history), gen(seed) {}
+
+    bool finished() const { return players[0].done && players[1].done && pending_ops == 0; }
+
+    void start(chess_proto::ChessServer::Stub& stub) {
+        std::uniform_int_distribution< std::uint64_t > dis(1);
+        for(int side = 0; side < 2; ++side) {
+            auto& p = players[side];
+            p.id = dis(gen);
+            for(int k = 0; k < 4; ++k) p.tags[k] = { this, side, static_cast< TagKind >(k) };
+            p.stream = stub.PrepareAsyncCommand(&p.ctx, &cq);
+            p.stream->StartCall(&p.tags[static_cast< int >(TagKind::start)]);
+            ++pending_ops;
+        }
+    }
+
+    void post_read(int side) {
+        auto& p = players[side];
+        p.stream->Read(&p.rep, &p.tags[static_cast< int >(TagKind::read)]);
+        ++pending_ops;
+    }
+
+    void send(int side, std::string command) {
+        auto& p = players[side];
+        p.awaiting_reply = true;
+        p.sent_time = std::chrono::steady_clock::now();
+        p.write_queue.push_back(std::move(command));
+        write_next(side);
+    }
+    void write_next(int side) {
+        auto& p = players[side];
+        if(p.writing || p.write_queue.empty()) return;
+        p.req.set_id(p.id);
+        p.req.set_command(std::move(p.write_queue.front()));
+        p.write_queue.pop_front();
+        p.writing = true;
+        p.stream->Write(p.req, &p.tags[static_cast< int >(TagKind::write)]);
+        ++pending_ops;
+    }
+
+    // Cancels both streams. Pending operations complete with failure.
+    void abort() {
+        if(!failed) {
+            failed = true;
+            stats.games_failed.add();
+        }
+        for(auto& p : players) {
+            if(p.started && !p.done) p.ctx.TryCancel();
+        }
+    }
+
+    void schedule_move() {
+        if(config.rate > 0) {
+            next_move_time += std::chrono::duration_cast< std::chrono::system_clock::duration >(std::chrono::duration< double >(1 / config.rate));
+            alarm.Set(&cq, next_move_time, &alarm_tag);
+            ++pending_ops;
+        }
+        else {
+            make_move();
+        }
+    }
+
+    void make_move() {
+        const auto& item = *game_history.ptr_current_item();
+        const auto& gs = item.game_state;
+
+        const bool game_over =
+            gs.status != GameState::Status::active
+            || static_cast< int >(game_history.num_items()) > config.max_plies
+            || stopping;
+
+        std::vector< Operation > ops;
+        if(!game_over) {
+            valid_operation_generator(gs, game_history.zobrist_table, item.board_state_hash, [&](Operation op) { ops.push_back(op); });
+        }
+        if(ops.empty()) {
+            phase = Phase::exiting_first;
+            send(0, "exit");
+            return;
+        }
+
+        pending_op = ops[std::uniform_int_distribution< std::size_t >(0, ops.size() - 1)(gen)];
+        send(gs.board_state.black_turn ? 1 : 0, command_text(pending_op));
+    }
+
+    void on_reply(int side) {
+        auto& other = players[1 - side];
+
+        switch(phase) {
+            case Phase::registering_white:
+                phase = Phase::registering_black;
+                send(1, "init " + std::to_string(game_id));
+                break;
+
+            case Phase::registering_black:
+                other.unread_broadcasts += 2;
+                phase = Phase::playing;
+                schedule_move();
+                break;
+
+            case Phase::playing:
+                {
+                    stats.move_latency.record(std::chrono::steady_clock::now() - players[side].sent_time);
+                    stats.moves.add();
+                    other.unread_broadcasts += 2;
+
+                    std::ostream null_os(nullptr);
+                    if(!game_round(game_history, pending_op, null_os)) {
+                        // Should never happen, as the move is generated from valid moves.
+                        abort();
+                        return;
+                    }
+                    schedule_move();
+                }
+                break;
+
+            case Phase::exiting_first:
+                other.unread_broadcasts += 2;
+                phase = Phase::exiting_second;
+                send(1 - side, "exit");
+                break;
+
+            default:
+                break;
+        }
+    }
+
+    void handle(const Tag& tag, bool ok) {
+        --pending_ops;
+        auto& p = players[tag.side];
+
+        switch(tag.kind) {
+            case TagKind::start:
+                if(!ok) {
+                    p.done = true;
+                    abort();
+                    break;
+                }
+                p.started = true;
+                if(failed) {
+                    // The other stream failed to start, so no init will be
+                    // sent on this one. Close it instead of reading.
+                    p.ctx.TryCancel();
+                    p.stream->Finish(&p.status, &p.tags[static_cast< int >(TagKind::finish)]);
+                    ++pending_ops;
+                    break;
+                }
+                post_read(tag.side);
+                if(players[0].started && players[1].started && phase == Phase::connecting) {
+                    phase = Phase::registering_white;
+                    send(0, "init " + std::to_string(game_id));
+                }
+                break;
+
+            case TagKind::read:
+                if(!ok) {
+                    // Stream is closed by the server.
+                    if(!(phase == Phase::exiting_first || phase == Phase::exiting_second)) abort();
+                    p.stream->Finish(&p.status, &p.tags[static_cast< int >(TagKind::finish)]);
+                    ++pending_ops;
+                    break;
+                }
+                if(p.unread_broadcasts > 0) {
+                    --p.unread_broadcasts;
+                }
+                else if(p.awaiting_reply) {
+                    p.awaiting_reply = false;
+                    on_reply(tag.side);
+                }
+                post_read(tag.side);
+                break;
+
+            case TagKind::write:
+                p.writing = false;
+                if(!ok) {
+                    abort();
+                    break;
+                }
+                write_next(tag.side);
+                break;
+
+            case TagKind::finish:
+                p.done = true;
+                if(players[0].done && players[1].done) {
+                    phase = Phase::done;
+                    if(!failed) stats.games_completed.add();
+                }
+                break;
+
+            case TagKind::alarm:
+                if(ok && phase == Phase::playing && !failed) make_move();
+                break;
+        }
+    }
+};
+
+// Drives a share of the games on its own completion queue.
+inline void loadgen_worker(
+    const LoadgenConfig&                 config,
+    LoadgenStats&                        stats,
+    chess_proto::ChessServer::Stub&      stub,
+    int                                  num_games,
+    const std::atomic_bool&              stopping,
+    std::atomic< std::uint64_t >&        games_to_start,
+    const GameHistory&                   initial_game_history,
+    std::uint64_t                        seed
+) {
+    grpc::CompletionQueue cq;
+    std::mt19937_64 gen(seed);
+    std::vector< std::unique_ptr< LoadgenGame > > games(num_games);
+
+    // Returns whether a game is started.
+    const auto start_game = [&](std::unique_ptr< LoadgenGame >& slot) {
+        if(stopping) return false;
+        if(config.max_games) {
+            auto left = games_to_start.load();
+            do {
+                if(left == 0) return false;
+            } while(!games_to_start.compare_exchange_weak(left, left - 1));
+        }
+        slot = std::make_unique< LoadgenGame >(config, stats, cq, stopping, initial_game_history, std::uniform_int_distribution< std::uint64_t >(1)(gen), gen());
+        slot->start(stub);
+        stats.games_started.add();
+        return true;
+    };
+
+    int live_games = 0;
+    for(auto& slot : games) {
+        if(start_game(slot)) ++live_games;
+    }
+
+    bool shutdown = false;
+    void* raw_tag;
+    bool ok;
+    while(true) {
+        const auto status = cq.AsyncNext(&raw_tag, &ok, std::chrono::system_clock::now() + std::chrono::milliseconds(100));
+        if(status == grpc::CompletionQueue::SHUTDOWN) break;
+        if(status == grpc::CompletionQueue::GOT_EVENT) {
+            const auto& tag = *static_cast< LoadgenGame::Tag* >(raw_tag);
+            auto* game = tag.game;
+            game->handle(tag, ok);
+
+            if(game->finished()) {
+                for(auto& slot : games) {
+                    if(slot.get() == game) {
+                        slot.reset();
+                        --live_games;
+                        if(start_game(slot)) ++live_games;
+                        break;
+                    }
+                }
+            }
+        }
+        if(live_games == 0 && !shutdown) {
+            shutdown = true;
+            cq.Shutdown();
+        }
+    }
+}
+
+inline LoadgenConfig parse_loadgen_config(int argc, char** argv) {
+    LoadgenConfig config;
+    for(int i = 1; i + 1 < argc; i += 2) {
+        const std::string key = argv[i];
+        const std::string val = argv[i + 1];
+        if(key == "--target")         config.target = val;
+        else if(key == "--games")     config.num_games = std::stoi(val);
+        else if(key == "--threads")   config.num_threads = std::stoi(val);
+        else if(key == "--duration")  config.duration = std::stod(val);
+        else if(key == "--rate")      config.rate = std::stod(val);
+        else if(key == "--max-plies") config.max_plies = std::stoi(val);
+        else if(key == "--max-games") config.max_games = std::stoull(val);
+        else {
+            std::cerr << "Unknown option " << key << std::endl;
+            std::exit(1);
+        }
+    }
+    return config;
+}
+
+inline void run_loadgen(const LoadgenConfig& config) {
+    using namespace std;
+
+    auto channel = grpc::CreateChannel(config.target, grpc::InsecureChannelCredentials());
+    auto stub = chess_proto::ChessServer::NewStub(channel);
+
+    LoadgenStats stats;
+    atomic_bool stopping { false };
+    atomic< uint64_t > games_to_start { config.max_games };
+
+    cout << "Playing " << config.num_games << " concurrent games against " << config.target
+        << " on " << config.num_threads << " threads for " << config.duration << " s." << endl;
+
+    // The Zobrist table and the seeds are drawn from the global random
+    // generator, which is not thread-safe, before any worker starts. Games
+    // share the Zobrist table by copying.
+    const GameHistory initial_game_history;
+    vector< uint64_t > seeds(config.num_threads);
+    for(auto& seed : seeds) seed = rand_gen();
+
+    const auto start_time = chrono::steady_clock::now();
+    vector< thread > workers;
+    for(int i = 0; i < config.num_threads; ++i) {
+        const int num_games = config.num_games / config.num_threads + (i < config.num_games % config.num_threads ? 1 : 0);
+        workers.emplace_back(loadgen_worker, cref(config), ref(stats), ref(*stub), num_games, cref(stopping), ref(games_to_start), cref(initial_game_history), seeds[i]);
+    }
+
+    // Stop after duration, or earlier if all games are done.
+    const auto deadline = start_time + chrono::duration_cast< chrono::steady_clock::duration >(chrono::duration< double >(config.duration));
+    while(chrono::steady_clock::now() < deadline) {
+        if(config.max_games && stats.games_completed.get() + stats.games_failed.get() >= config.max_games) break;
+        this_thread::sleep_for(chrono::milliseconds(50));
+    }
+    const auto play_time = chrono::duration< double >(chrono::steady_clock::now() - start_time).count();
+    const auto moves = stats.moves.get();
+    stopping = true;
+    for(auto& w : workers) w.join();
+
+    cout
+        << "games: started " << stats.games_started.get()
+            << ", completed " << stats.games_completed.get()
+            << ", failed " << stats.games_failed.get() << '\n'
+        << "moves: " << moves << " in " << play_time << " s, " << moves / play_time << " moves/s\n"
+        << "move latency: ";
+    stats.move_latency.print_summary_to(cout);
+    cout << endl;
+}
+
+} // namespace chess
+
+int main(int argc, char** argv) {
+    chess::run_loadgen(chess::parse_loadgen_config(argc, argv));
+    return 0;
+}
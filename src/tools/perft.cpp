@@ -0,0 +1,107 @@
+// Move generation check by perft.
+//
+// Without a FEN, counts the leaf positions of each known position to the
+// depth, and compares with the known counts. Exits with 1 if any count does
+// not match, so that a rules change that breaks move generation is caught.
+//
+// With a FEN, counts the leaf positions under each operation of the position
+// ("divide"), which locates a wrong count by comparison with another engine.
+//
+// Usage:
+//   chess_perft [--depth <n>]
+//   chess_perft --fen <fen> [--depth <n>]
+
+#include <algorithm> // min
+#include <cctype> // tolower
+#include <chrono>
+#include <cstdint>
+#include <exception>
+#include <iostream>
+#include <string>
+
+#include "chess/fen.hpp"
+#include "chess/perft.hpp"
+
+namespace chess {
+
+// Returns false if any count does not match.
+inline bool perft_check(int depth) {
+    using namespace std;
+
+    bool okay = true;
+    for(const auto& pos : perft_positions()) {
+        const auto fen = parse_fen(pos.fen);
+        if(!fen.okay) throw runtime_error("Invalid FEN " + string(pos.fen) + ": " + fen.error_message);
+
+        const int pos_depth = min< int >(depth, pos.counts.size());
+        for(int d = 1; d <= pos_depth; ++d) {
+            const auto start = chrono::steady_clock::now();
+            const auto count = perft(fen.game_state, d);
+            const auto expected = pos.counts[d - 1];
+            cout << pos.name << " depth " << d << ": " << count;
+            if(count != expected) {
+                cout << ", expected " << expected;
+                okay = false;
+            }
+            cout << " (" << chrono::duration< double >(chrono::steady_clock::now() - start).count() << " s)" << endl;
+        }
+    }
+    cout << (okay ? "All counts match." : "Some counts do not match.") << endl;
+    return okay;
+}
+
+inline int perft_divide(const std::string& fen_text, int depth) {
+    using namespace std;
+
+    const auto fen = parse_fen(fen_text);
+    if(!fen.okay) {
+        cerr << "Invalid FEN: " << fen.error_message << endl;
+        return 1;
+    }
+    if(depth < 1) return 0;
+
+    uint64_t total = 0;
+    valid_operation_generator(fen.game_state, standard_zobrist_table(), 0, [&](Operation op) {
+        if(op.category == Operation::Category::resign || op.category == Operation::Category::draw_accept) return;
+        const auto count = perft(game_state_after(fen.game_state, op), depth - 1);
+        cout
+            << static_cast< char >('a' + op.x0) << static_cast< char >('1' + op.y0)
+            << static_cast< char >('a' + op.x1) << static_cast< char >('1' + op.y1);
+        if(op.category == Operation::Category::promote) {
+            cout << static_cast< char >(tolower(letter(static_cast< Occupation >(op.code))));
+        }
+        cout << ": " << count << '\n';
+        total += count;
+    });
+    cout << "total " << total << endl;
+    return 0;
+}
+
+} // namespace chess
+
+int main(int argc, char** argv) {
+    using namespace std;
+    using namespace chess;
+
+    try {
+        int    depth = 4;
+        string fen;
+        for(int i = 1; i < argc; ++i) {
+            const string arg = argv[i];
+            if(arg == "--depth" && i + 1 < argc)    depth = stoi(argv[++i]);
+            else if(arg == "--fen" && i + 1 < argc) fen = argv[++i];
+            else {
+                cerr << "Usage:\n"
+                    << "  chess_perft [--depth <n>]\n"
+                    << "  chess_perft --fen <fen> [--depth <n>]\n";
+                return 1;
+            }
+        }
+        if(!fen.empty()) return perft_divide(fen, depth);
+        return perft_check(depth) ? 0 : 1;
+    }
+    catch(const exception& e) {
+        cerr << e.what() << endl;
+        return 1;
+    }
+}
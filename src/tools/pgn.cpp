@@ -0,0 +1,106 @@
+// PGN tool.
+//
+// Usage:
+//   chess_pgn validate <pgn> [--threads <n>] [--max-errors <n>]
+//       Replays all games through the rules, in parallel, and reports the
+//       games that fail.
+//   chess_pgn export <archive> <pgn>
+//       Writes all games of a game archive in PGN.
+
+#include <algorithm> // count
+#include <chrono>
+#include <cstdint>
+#include <exception>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <string_view>
+
+#include "archive.hpp"
+#include "chess/pgn.hpp"
+#include "mapped_file.hpp"
+
+namespace chess {
+
+inline int pgn_validate(const std::string& path, unsigned num_threads, std::uint64_t max_errors) {
+    const MappedFile file(path);
+    const std::string_view text(reinterpret_cast< const char* >(file.data), file.size);
+
+    std::uint64_t num_errors = 0;
+    const auto start = std::chrono::steady_clock::now();
+    const auto stats = validate_pgn_games(text, num_threads, [&](std::size_t game_index, const PgnGameText& game, const std::string& error_message) {
+        if(num_errors++ < max_errors) {
+            const auto line = std::count(text.data(), game.tags.data(), '\n') + 1;
+            std::cout << "game " << game_index + 1 << " (line " << line << "): " << error_message << '\n';
+        }
+    });
+    const std::chrono::duration< double > elapsed = std::chrono::steady_clock::now() - start;
+
+    std::cout << "games " << stats.num_games
+        << ", valid " << stats.num_valid_games
+        << ", invalid " << stats.num_games - stats.num_valid_games
+        << ", plies " << stats.num_plies
+        << ", " << elapsed.count() << " s"
+        << ", " << (elapsed.count() > 0 ? stats.num_plies / elapsed.count() : 0.0) << " plies/s" << std::endl;
+    return stats.num_valid_games == stats.num_games ? 0 : 1;
+}
+
+inline int pgn_export(const std::string& archive_path, const std::string& pgn_path) {
+    const GameArchive archive(archive_path);
+    std::ofstream os(pgn_path);
+    if(!os) {
+        std::cerr << "Cannot open " << pgn_path << std::endl;
+        return 1;
+    }
+
+    for(std::size_t i = 0; i < archive.games.size(); ++i) {
+        const auto game = archive.game_at(i);
+        write_pgn(os, archive.load_game_history(game), {
+            { "Event", "Casual game" },
+            { "Site", "?" },
+            { "Date", "????.??.??" },
+            { "Round", "-" },
+            { "White", "?" },
+            { "Black", "?" },
+            { "Result", pgn_result_text(game.result()) },
+            { "GameId", std::to_string(game.p_record->game_id) },
+        });
+    }
+    std::cout << "Exported " << archive.games.size() << " games." << std::endl;
+    return 0;
+}
+
+} // namespace chess
+
+int main(int argc, char** argv) {
+    using namespace std;
+    using namespace chess;
+
+    try {
+        const string command = argc >= 2 ? argv[1] : "";
+        if(command == "validate" && argc >= 3) {
+            unsigned      num_threads = 0;
+            std::uint64_t max_errors = 20;
+            bool          args_valid = true;
+            for(int i = 3; i < argc; ++i) {
+                const string arg = argv[i];
+                if(arg == "--threads" && i + 1 < argc)         num_threads = stoul(argv[++i]);
+                else if(arg == "--max-errors" && i + 1 < argc) max_errors = stoull(argv[++i]);
+                else args_valid = false;
+            }
+            if(args_valid) return pgn_validate(argv[2], num_threads, max_errors);
+        }
+        if(command == "export" && argc == 4) {
+            return pgn_export(argv[2], argv[3]);
+        }
+    }
+    catch(const exception& e) {
+        cerr << e.what() << endl;
+        return 1;
+    }
+
+    cerr << "Usage:\n"
+        << "  chess_pgn validate <pgn> [--threads <n>] [--max-errors <n>]\n"
+        << "  chess_pgn export <archive> <pgn>\n";
+    return 1;
+}
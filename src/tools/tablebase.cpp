@@ -0,0 +1,492 @@
+// Endgame tablebase tool.
+//
+// Usage:
+//   chess_tablebase generate <dir> [<name>...]
+//       Generates tables by retrograde analysis, such as "KQvKR". By default,
+//       all pawnless tables of up to max_tablebase_pieces pieces are
+//       generated. Sets with pawns are not supported. Tables reached by
+//       captures must already be in the directory, or be generated earlier
+//       in the same run.
+//   chess_tablebase probe <dir> <fen>
+//       Probes a position.
+
+#include <algorithm> // max
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib> // abs
+#include <cstring> // memcpy, strncpy
+#include <exception>
+#include <iostream>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "chess/fen.hpp"
+#include "chess/tablebase.hpp"
+
+namespace chess {
+
+// Parses a table name, such as "KQvKR", into pieces in table order.
+inline std::vector< Occupation > parse_tablebase_name(const std::string& name) {
+    using enum Occupation;
+
+    const auto v = name.find('v');
+    if(name.size() < 3 || name[0] != 'K' || v == std::string::npos || v + 1 >= name.size() || name[v + 1] != 'K') {
+        throw std::runtime_error("Invalid table name: " + name);
+    }
+    std::vector< Occupation > res { white_king, black_king };
+    const auto add = [&](std::size_t begin, std::size_t end, bool black) {
+        for(std::size_t i = begin; i < end; ++i) {
+            switch(name[i]) {
+                case 'Q': res.push_back(black ? black_queen  : white_queen);  break;
+                case 'R': res.push_back(black ? black_rook   : white_rook);   break;
+                case 'B': res.push_back(black ? black_bishop : white_bishop); break;
+                case 'N': res.push_back(black ? black_knight : white_knight); break;
+                default:  throw std::runtime_error("Invalid table name: " + name);
+            }
+        }
+    };
+    add(1, v, false);
+    add(v + 2, name.size(), true);
+
+    std::vector< TablebasePiece > pieces;
+    for(const auto o : res) pieces.push_back({ o, 0 });
+    if(res.size() > max_tablebase_pieces || tablebase_name(pieces) != name || !tablebase_white_stronger(pieces)) {
+        throw std::runtime_error("Not a canonical table name: " + name);
+    }
+    return res;
+}
+
+// All pawnless tables of up to max_tablebase_pieces pieces, smaller tables
+// first.
+inline std::vector< std::string > all_tablebase_names() {
+    constexpr char letters[] { 'Q', 'R', 'B', 'N' };
+    std::vector< std::string > res;
+    for(const char a : letters) {
+        res.push_back(std::string("K") + a + "vK");
+    }
+    for(int a = 0; a < 4; ++a) {
+        for(int b = a; b < 4; ++b) {
+            res.push_back(std::string("K") + letters[a] + letters[b] + "vK");
+        }
+    }
+    for(int a = 0; a < 4; ++a) {
+        for(int b = a; b < 4; ++b) {
+            res.push_back(std::string("K") + letters[a] + "vK" + letters[b]);
+        }
+    }
+    return res;
+}
+
+// Retrograde analysis of one table.
+//
+// Every valid position first counts its legal moves. Captures are resolved
+// right away from the smaller tables. Then, by increasing distance to mate,
+// resolved positions update their predecessors, found by moving pieces
+// backwards:
+//   - A predecessor of a lost position is won.
+//   - A predecessor of a won position loses one of its move counts, and is
+//     lost once no moves are left that do not lose.
+// Positions left unresolved are draws.
+//
+// The distances of captures into smaller tables may be larger than the
+// current distance, so resolutions are queued by distance.
+struct TablebaseGenerator {
+    static constexpr int king_steps[8][2]   { { 1, 0 }, { 1, 1 }, { 0, 1 }, { -1, 1 }, { -1, 0 }, { -1, -1 }, { 0, -1 }, { 1, -1 } };
+    static constexpr int knight_steps[8][2] { { 1, 2 }, { 2, 1 }, { 2, -1 }, { 1, -2 }, { -1, -2 }, { -2, -1 }, { -2, 1 }, { -1, 2 } };
+
+    // A decoded position. Captured pieces have square -1.
+    struct Position {
+        int        num_pieces = 0;
+        int        square[max_tablebase_pieces] {};
+        bool       black_turn = false;
+        Occupation board[BoardState::size] {};
+    };
+
+    const Tablebases&           tablebases;
+    std::string                 name;
+    std::vector< Occupation >   pieces;
+    int                         num_pieces = 0;
+    std::uint64_t               num_entries = 0;
+
+    std::vector< std::uint8_t > values;
+    // Moves not yet known to lose, excluding captures.
+    std::vector< std::uint8_t > counters;
+    // Smallest distance of a loss, from captures into won positions.
+    std::vector< std::uint8_t > loss_floors;
+    // Whether some capture does not lose, so the position cannot be lost.
+    std::vector< std::uint8_t > escapes;
+
+    // Positions to resolve, by plies to mate.
+    std::vector< std::vector< std::uint32_t > > pending_wins;
+    std::vector< std::vector< std::uint32_t > > pending_losses;
+
+    TablebaseGenerator(const Tablebases& tablebases, const std::string& name) :
+        tablebases(tablebases),
+        name(name),
+        pieces(parse_tablebase_name(name)),
+        num_pieces(static_cast< int >(pieces.size())),
+        num_entries(tablebase_num_entries(num_pieces)),
+        pending_wins(tablebase_value::max_plies + 2),
+        pending_losses(tablebase_value::max_plies + 2)
+    {}
+
+    bool is_black(int i) const { return is_black_piece(pieces[i]); }
+
+    Position decode(std::uint64_t index) const {
+        Position pos;
+        pos.num_pieces = num_pieces;
+        for(int i = num_pieces - 1; i >= 1; --i) {
+            pos.square[i] = static_cast< int >(index % 64);
+            index /= 64;
+        }
+        pos.black_turn = index >= 16;
+        pos.square[0] = BoardState::coord_to_index(static_cast< int >(index % 4), static_cast< int >(index % 16 / 4));
+        for(int i = 0; i < num_pieces; ++i) {
+            pos.board[pos.square[i]] = pieces[i];
+        }
+        return pos;
+    }
+
+    std::uint64_t index(const Position& pos) const {
+        TablebasePiece table_pieces[max_tablebase_pieces];
+        for(int i = 0; i < num_pieces; ++i) table_pieces[i] = { pieces[i], pos.square[i] };
+        return tablebase_index({ table_pieces, static_cast< std::size_t >(num_pieces) }, pos.black_turn);
+    }
+
+    // Whether the squares between two aligned squares are empty.
+    static bool path_clear(const Position& pos, int from, int to) {
+        const auto [fx, fy] = BoardState::index_to_coord(from);
+        const auto [tx, ty] = BoardState::index_to_coord(to);
+        const int dx = (tx > fx) - (tx < fx), dy = (ty > fy) - (ty < fy);
+        for(int x = fx + dx, y = fy + dy; x != tx || y != ty; x += dx, y += dy) {
+            if(pos.board[BoardState::coord_to_index(x, y)] != Occupation::empty) return false;
+        }
+        return true;
+    }
+
+    bool attacked(const Position& pos, int target, bool by_black) const {
+        using enum Occupation;
+
+        const auto [tx, ty] = BoardState::index_to_coord(target);
+        for(int i = 0; i < num_pieces; ++i) {
+            if(pos.square[i] < 0 || is_black(i) != by_black) continue;
+            const auto [x, y] = BoardState::index_to_coord(pos.square[i]);
+            const int dx = std::abs(tx - x), dy = std::abs(ty - y);
+            if(dx == 0 && dy == 0) continue;
+            const bool straight = dx == 0 || dy == 0;
+            const bool diagonal = dx == dy;
+            switch(pieces[i]) {
+                case white_king:   case black_king:   if(dx <= 1 && dy <= 1) return true; break;
+                case white_knight: case black_knight: if((dx == 1 && dy == 2) || (dx == 2 && dy == 1)) return true; break;
+                case white_rook:   case black_rook:   if(straight && path_clear(pos, pos.square[i], target)) return true; break;
+                case white_bishop: case black_bishop: if(diagonal && path_clear(pos, pos.square[i], target)) return true; break;
+                case white_queen:  case black_queen:  if((straight || diagonal) && path_clear(pos, pos.square[i], target)) return true; break;
+                default: break;
+            }
+        }
+        return false;
+    }
+
+    // Whether the king of the side is attacked.
+    bool in_check(const Position& pos, bool black) const {
+        return attacked(pos, pos.square[black ? 1 : 0], !black);
+    }
+
+    bool valid(const Position& pos) const {
+        for(int i = 0; i < num_pieces; ++i) {
+            for(int j = 0; j < i; ++j) {
+                if(pos.square[i] == pos.square[j]) return false;
+            }
+        }
+        // This also rejects adjacent kings.
+        return !in_check(pos, !pos.black_turn);
+    }
+
+    // Calls func(to) for each square the piece may move to on an empty board
+    // region, stopping sliders at the first occupied square, which is also
+    // passed. Moves are their own reverse for pawnless pieces.
+    template< typename Func >
+    void for_each_target(const Position& pos, int i, Func&& func) const {
+        using enum Occupation;
+
+        const auto [x, y] = BoardState::index_to_coord(pos.square[i]);
+        const auto piece = pieces[i];
+        const auto steps = [&](const int (&s)[8][2]) {
+            for(const auto& d : s) {
+                if(BoardState::is_location_valid(x + d[0], y + d[1])) func(BoardState::coord_to_index(x + d[0], y + d[1]));
+            }
+        };
+        const auto rays = [&](int begin, int step) {
+            for(int k = begin; k < 8; k += step) {
+                const int dx = king_steps[k][0], dy = king_steps[k][1];
+                for(int nx = x + dx, ny = y + dy; BoardState::is_location_valid(nx, ny); nx += dx, ny += dy) {
+                    const int to = BoardState::coord_to_index(nx, ny);
+                    func(to);
+                    if(pos.board[to] != empty) break;
+                }
+            }
+        };
+        switch(piece) {
+            case white_king:   case black_king:   steps(king_steps);   break;
+            case white_knight: case black_knight: steps(knight_steps); break;
+            case white_rook:   case black_rook:   rays(0, 2);          break;
+            case white_bishop: case black_bishop: rays(1, 2);          break;
+            case white_queen:  case black_queen:  rays(0, 1);          break;
+            default: break;
+        }
+    }
+
+    // Calls func(pos) for each position reached by moving piece i to an empty
+    // square, with the side to move toggled. pos is restored afterwards.
+    template< typename Func >
+    void for_each_quiet_move(Position& pos, int i, Func&& func) const {
+        const int from = pos.square[i];
+        for_each_target(pos, i, [&](int to) {
+            if(pos.board[to] != Occupation::empty) return;
+            pos.board[from] = Occupation::empty;
+            pos.board[to] = pieces[i];
+            pos.square[i] = to;
+            pos.black_turn = !pos.black_turn;
+            func(pos);
+            pos.black_turn = !pos.black_turn;
+            pos.square[i] = from;
+            pos.board[to] = Occupation::empty;
+            pos.board[from] = pieces[i];
+        });
+    }
+
+    // The entry of the position after piece i captures piece j.
+    std::uint8_t capture_value(const Position& pos, int i, int j) const {
+        TablebasePiece rest[max_tablebase_pieces];
+        std::size_t n = 0;
+        for(int k = 0; k < num_pieces; ++k) {
+            if(k == j) continue;
+            rest[n++] = { pieces[k], k == i ? pos.square[j] : pos.square[k] };
+        }
+        const auto v = tablebases.probe_value({ rest, n }, !pos.black_turn);
+        if(!v) {
+            throw std::runtime_error("Missing table " + tablebase_name({ rest, n }) + " for " + name);
+        }
+        return *v;
+    }
+
+    void push(std::vector< std::vector< std::uint32_t > >& pending, int plies, std::uint64_t index) {
+        if(plies > tablebase_value::max_plies) {
+            throw std::runtime_error("Distance to mate too large in " + name);
+        }
+        pending[plies].push_back(static_cast< std::uint32_t >(index));
+    }
+
+    void initialize() {
+        values.assign(num_entries, tablebase_value::invalid);
+        counters.assign(num_entries, 0);
+        loss_floors.assign(num_entries, 0);
+        escapes.assign(num_entries, 0);
+
+        for(std::uint64_t index = 0; index < num_entries; ++index) {
+            auto pos = decode(index);
+            if(!valid(pos)) continue;
+            values[index] = tablebase_value::draw;
+
+            const bool black = pos.black_turn;
+            int num_legal = 0;
+            int win_plies = -1;
+            for(int i = 0; i < num_pieces; ++i) {
+                if(is_black(i) != black) continue;
+                const int from = pos.square[i];
+                for_each_target(pos, i, [&](int to) {
+                    const auto target = pos.board[to];
+                    int captured = -1;
+                    if(target != Occupation::empty) {
+                        if(is_black_piece(target) == black) return;
+                        for(int j = 0; j < num_pieces; ++j) {
+                            if(pos.square[j] == to) captured = j;
+                        }
+                    }
+
+                    // Make the move and test whether the king is left attacked.
+                    pos.board[from] = Occupation::empty;
+                    pos.board[to] = pieces[i];
+                    pos.square[i] = to;
+                    if(captured >= 0) pos.square[captured] = -1;
+                    const bool legal = !in_check(pos, black);
+                    if(captured >= 0) pos.square[captured] = to;
+                    pos.square[i] = from;
+                    pos.board[to] = target;
+                    pos.board[from] = pieces[i];
+                    if(!legal) return;
+
+                    ++num_legal;
+                    if(captured < 0) {
+                        ++counters[index];
+                        return;
+                    }
+                    const auto v = capture_value(pos, i, captured);
+                    if(tablebase_value::is_loss(v)) {
+                        escapes[index] = 1;
+                        const int plies = tablebase_value::plies(v) + 1;
+                        if(win_plies < 0 || plies < win_plies) win_plies = plies;
+                    }
+                    else if(tablebase_value::is_win(v)) {
+                        loss_floors[index] = std::max(loss_floors[index], static_cast< std::uint8_t >(tablebase_value::plies(v) + 1));
+                    }
+                    else {
+                        escapes[index] = 1;
+                    }
+                });
+            }
+
+            if(num_legal == 0) {
+                // Checkmate is a loss now, and stalemate a draw.
+                if(in_check(pos, black)) push(pending_losses, 0, index);
+                else                     escapes[index] = 1;
+            }
+            else {
+                if(win_plies >= 0) push(pending_wins, win_plies, index);
+                if(counters[index] == 0 && !escapes[index]) push(pending_losses, loss_floors[index], index);
+            }
+        }
+    }
+
+    void propagate() {
+        for(int plies = 0; plies <= tablebase_value::max_plies; ++plies) {
+            // Wins and losses have odd and even distances respectively.
+            const bool win = plies % 2 == 1;
+            auto& pending = (win ? pending_wins : pending_losses)[plies];
+
+            for(std::size_t k = 0; k < pending.size(); ++k) {
+                const std::uint64_t index = pending[k];
+                if(values[index] != tablebase_value::draw) continue;
+                values[index] = tablebase_value::mate_in(plies);
+
+                // Predecessors are reached by the other side moving backwards.
+                auto pos = decode(index);
+                for(int i = 0; i < num_pieces; ++i) {
+                    if(is_black(i) == pos.black_turn) continue;
+                    for_each_quiet_move(pos, i, [&](const Position& prev) {
+                        // The side that just moved must not be in check.
+                        if(in_check(prev, !prev.black_turn)) return;
+                        const auto prev_index = this->index(prev);
+                        if(values[prev_index] != tablebase_value::draw) return;
+
+                        if(!win) {
+                            push(pending_wins, plies + 1, prev_index);
+                        }
+                        else {
+                            if constexpr(debug) {
+                                if(counters[prev_index] == 0) throw std::logic_error("Tablebase move counter underflow.");
+                            }
+                            if(--counters[prev_index] == 0 && !escapes[prev_index]) {
+                                push(pending_losses, std::max< int >(plies + 1, loss_floors[prev_index]), prev_index);
+                            }
+                        }
+                    });
+                }
+            }
+            pending.clear();
+            pending.shrink_to_fit();
+        }
+    }
+
+    void write(const std::string& path) const {
+        TablebaseHeader header;
+        std::memcpy(header.magic, TablebaseHeader::magic_value, sizeof(header.magic));
+        header.num_pieces = num_pieces;
+        std::strncpy(header.name, name.c_str(), sizeof(header.name) - 1);
+        header.num_entries = num_entries;
+
+        std::FILE* file = std::fopen(path.c_str(), "wb");
+        if(!file) {
+            throw std::runtime_error("Cannot open tablebase " + path);
+        }
+        std::fwrite(&header, sizeof(header), 1, file);
+        std::fwrite(values.data(), 1, values.size(), file);
+        const bool failed = std::ferror(file);
+        std::fclose(file);
+        if(failed) {
+            throw std::runtime_error("Cannot write tablebase " + path);
+        }
+    }
+};
+
+inline int tablebase_generate(const std::string& dir, std::vector< std::string > names) {
+    if(names.empty()) names = all_tablebase_names();
+
+    Tablebases tablebases(dir);
+    for(const auto& name : names) {
+        const auto start = std::chrono::steady_clock::now();
+
+        TablebaseGenerator generator(tablebases, name);
+        generator.initialize();
+        generator.propagate();
+        generator.write(dir + '/' + Tablebases::file_name(name));
+        tablebases.rescan();
+
+        std::uint64_t num_wins = 0, num_draws = 0, num_losses = 0;
+        int max_plies = 0;
+        for(const auto v : generator.values) {
+            if(v == tablebase_value::invalid) continue;
+            if(v == tablebase_value::draw) { ++num_draws; continue; }
+            (tablebase_value::is_win(v) ? num_wins : num_losses) += 1;
+            max_plies = std::max(max_plies, tablebase_value::plies(v));
+        }
+        const std::chrono::duration< double > elapsed = std::chrono::steady_clock::now() - start;
+        std::cout << name
+            << ": wins " << num_wins
+            << ", draws " << num_draws
+            << ", losses " << num_losses
+            << ", longest mate " << max_plies << " plies"
+            << ", " << elapsed.count() << " s" << std::endl;
+    }
+    return 0;
+}
+
+inline int tablebase_probe(const std::string& dir, const std::string& fen) {
+    const auto parsed = parse_fen(fen);
+    if(!parsed.okay) {
+        std::cerr << "Invalid FEN: " << parsed.error_message << std::endl;
+        return 1;
+    }
+
+    const Tablebases tablebases(dir);
+    const auto res = tablebases.probe(parsed.game_state);
+    if(!res) {
+        std::cout << "Not in tablebases." << std::endl;
+        return 1;
+    }
+    switch(res->wdl) {
+        case TablebaseResult::Wdl::win:  std::cout << "Win, mate in " << res->plies_to_mate << " plies." << std::endl; break;
+        case TablebaseResult::Wdl::loss: std::cout << "Loss, mated in " << res->plies_to_mate << " plies." << std::endl; break;
+        case TablebaseResult::Wdl::draw: std::cout << "Draw." << std::endl; break;
+    }
+    return 0;
+}
+
+} // namespace chess
+
+int main(int argc, char** argv) {
+    using namespace std;
+    using namespace chess;
+
+    try {
+        const string command = argc >= 2 ? argv[1] : "";
+        if(command == "generate" && argc >= 3) {
+            return tablebase_generate(argv[2], vector< string >(argv + 3, argv + argc));
+        }
+        if(command == "probe" && argc == 4) {
+            return tablebase_probe(argv[2], argv[3]);
+        }
+    }
+    catch(const exception& e) {
+        cerr << e.what() << endl;
+        return 1;
+    }
+
+    cerr << "Usage:\n"
+        << "  chess_tablebase generate <dir> [<name>...]\n"
+        << "  chess_tablebase probe <dir> <fen>\n";
+    return 1;
+}
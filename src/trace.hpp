@@ -0,0 +1,182 @@
+#ifndef CHESS_TRACE_HPP
+#define CHESS_TRACE_HPP
+
+#include <algorithm> // max
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <memory> // shared_ptr, unique_ptr
+#include <mutex>
+#include <vector>
+
+namespace chess {
+
+//-----------------------------------------------------------------------------
+// Scoped tracing of hot paths.
+//
+// Each thread records spans into its own ring buffer, without locking or
+// allocation. When a ring is full, the oldest spans are overwritten. The spans
+// of all threads can be exported in the Chrome trace event format, which is
+// also read by Perfetto.
+//
+// Tracing is compiled in with the CHESS_TRACE macro set to 1. Otherwise the
+// scopes are empty and are removed by "if constexpr".
+//-----------------------------------------------------------------------------
+
+#if defined(CHESS_TRACE) && CHESS_TRACE
+constexpr bool trace_enabled = true;
+#else
+constexpr bool trace_enabled = false;
+#endif
+
+struct TraceEvent {
+    // Must point to storage with static duration, such as a string literal.
+    std::atomic< const char* >   name { nullptr };
+    // Nanoseconds since the start of the trace.
+    std::atomic< std::uint64_t > start_ns { 0 };
+    std::atomic< std::uint64_t > duration_ns { 0 };
+};
+
+// Ring of spans, written by one thread and read by the exporter.
+struct TraceBuffer {
+    // Must be a power of 2.
+    inline static constexpr std::size_t capacity = 1 << 16;
+
+    std::unique_ptr< TraceEvent[] > events { new TraceEvent[capacity] };
+    // Number of spans ever written.
+    std::atomic< std::uint64_t >    write_count { 0 };
+    int                             thread_index = 0;
+
+    void push(const char* name, std::uint64_t start_ns, std::uint64_t duration_ns) {
+        const auto pos = write_count.load(std::memory_order_relaxed);
+        auto& event = events[pos & (capacity - 1)];
+        event.name.store(name, std::memory_order_relaxed);
+        event.start_ns.store(start_ns, std::memory_order_relaxed);
+        event.duration_ns.store(duration_ns, std::memory_order_relaxed);
+        write_count.store(pos + 1, std::memory_order_release);
+    }
+};
+
+struct Tracer {
+    std::chrono::steady_clock::time_point          start_time = std::chrono::steady_clock::now();
+    std::mutex                                     buffers_mutex;
+    // Kept after their threads exit, so that their spans can be exported.
+    std::vector< std::shared_ptr< TraceBuffer > >  buffers;
+
+    std::uint64_t now_ns() const {
+        return std::chrono::duration_cast< std::chrono::nanoseconds >(std::chrono::steady_clock::now() - start_time).count();
+    }
+
+    TraceBuffer& thread_buffer() {
+        thread_local const auto buffer = [this] {
+            auto res = std::make_shared< TraceBuffer >();
+            std::scoped_lock lock(buffers_mutex);
+            res->thread_index = static_cast< int >(buffers.size()) + 1;
+            buffers.push_back(res);
+            return res;
+        }();
+        return *buffer;
+    }
+
+    // Writes the spans in the Chrome trace event format, with times in
+    // microseconds. Returns the number of spans written.
+    //
+    // Spans may be recorded while exporting. A span overwritten while being
+    // read is detected by the write count of its ring, and skipped.
+    std::uint64_t write_chrome_trace(std::ostream& os) {
+        std::vector< std::shared_ptr< TraceBuffer > > buffers_copy;
+        {
+            std::scoped_lock lock(buffers_mutex);
+            buffers_copy = buffers;
+        }
+
+        std::uint64_t num_written = 0;
+        os << std::fixed << std::setprecision(3);
+        os << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+        for(const auto& p_buffer : buffers_copy) {
+            const auto& buffer = *p_buffer;
+            const auto end = buffer.write_count.load(std::memory_order_acquire);
+            const auto begin = end > TraceBuffer::capacity ? end - TraceBuffer::capacity : 0;
+
+            struct Span { const char* name; std::uint64_t start_ns, duration_ns; };
+            std::vector< Span > spans;
+            spans.reserve(end - begin);
+            for(auto i = begin; i < end; ++i) {
+                const auto& event = buffer.events[i & (TraceBuffer::capacity - 1)];
+                spans.push_back({
+                    event.name.load(std::memory_order_relaxed),
+                    event.start_ns.load(std::memory_order_relaxed),
+                    event.duration_ns.load(std::memory_order_relaxed),
+                });
+            }
+            // Spans at positions below this may have been overwritten. The
+            // span at end_after may be being written, over the slot of
+            // end_after - capacity, so that slot is not valid either.
+            const auto end_after = buffer.write_count.load(std::memory_order_acquire);
+            const auto valid_begin = std::max(begin, end_after + 1 > TraceBuffer::capacity ? end_after + 1 - TraceBuffer::capacity : 0);
+
+            for(auto i = valid_begin; i < end; ++i) {
+                const auto& span = spans[i - begin];
+                os << (num_written ? ",\n" : "\n")
+                    << "{\"name\":\"" << span.name
+                    << "\",\"cat\":\"chess\",\"ph\":\"X\",\"pid\":1,\"tid\":" << buffer.thread_index
+                    << ",\"ts\":" << span.start_ns / 1000.0
+                    << ",\"dur\":" << span.duration_ns / 1000.0 << '}';
+                ++num_written;
+            }
+        }
+        os << "\n]}\n";
+        os << std::defaultfloat;
+        return num_written;
+    }
+};
+
+inline Tracer& tracer() {
+    static Tracer instance;
+    return instance;
+}
+
+// Records a span from construction to destruction. Consecutive phases can
+// share one scope with next().
+//
+// Name: must point to storage with static duration, such as a string literal.
+struct TraceScope {
+    const char*   name = nullptr;
+    std::uint64_t start_ns = 0;
+
+    explicit TraceScope(const char* name) {
+        if constexpr(trace_enabled) {
+            this->name = name;
+            start_ns = tracer().now_ns();
+        }
+    }
+    TraceScope(const TraceScope&) = delete;
+    TraceScope& operator=(const TraceScope&) = delete;
+    ~TraceScope() { end(); }
+
+    // Ends the current span and starts another.
+    void next(const char* name) {
+        if constexpr(trace_enabled) {
+            const auto now = tracer().now_ns();
+            if(this->name) tracer().thread_buffer().push(this->name, start_ns, now - start_ns);
+            this->name = name;
+            start_ns = now;
+        }
+    }
+
+    // Ends the span early. Does nothing if already ended.
+    void end() {
+        if constexpr(trace_enabled) {
+            if(name) {
+                tracer().thread_buffer().push(name, start_ns, tracer().now_ns() - start_ns);
+                name = nullptr;
+            }
+        }
+    }
+};
+
+} // namespace chess
+
+#endif
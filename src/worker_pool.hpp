@@ -0,0 +1,86 @@
+#ifndef CHESS_WORKER_POOL_HPP
+#define CHESS_WORKER_POOL_HPP
+
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace chess {
+
+//-----------------------------------------------------------------------------
+// Fixed set of threads running tasks from a bounded queue.
+//
+// The number of threads caps the tasks running at once, and the queue caps
+// the tasks waiting, so that the submitter is never blocked and a burst of
+// work cannot grow without bound. Tasks should watch their own cancel flags
+// to finish early, as the pool never interrupts a running task.
+//
+// The queue is a ring allocated once, so submitting a task small enough for
+// the storage of std::function, such as a lambda capturing a pointer, does
+// not allocate.
+//-----------------------------------------------------------------------------
+
+struct WorkerPool {
+    std::mutex                          mutex;
+    std::condition_variable             cv;
+    // Ring of max_queued slots, of which num_tasks from first_task are queued.
+    std::vector< std::function< void() > > tasks;
+    std::size_t                         first_task = 0;
+    std::size_t                         num_tasks = 0;
+    bool                                stopping = false;
+    std::vector< std::thread >          threads;
+
+    WorkerPool(std::size_t num_threads, std::size_t max_queued) : tasks(max_queued) {
+        for(std::size_t i = 0; i < num_threads; ++i) {
+            threads.emplace_back([this] { work_loop(); });
+        }
+    }
+    // Tasks not started are dropped. Running tasks are waited for.
+    ~WorkerPool() {
+        {
+            std::scoped_lock lock(mutex);
+            stopping = true;
+            for(auto& task : tasks) task = nullptr;
+            num_tasks = 0;
+        }
+        cv.notify_all();
+        for(auto& t : threads) t.join();
+    }
+
+    // Returns false, without running the task, if the queue is full.
+    bool try_submit(std::function< void() > task) {
+        {
+            std::scoped_lock lock(mutex);
+            if(stopping || num_tasks >= tasks.size()) return false;
+            tasks[(first_task + num_tasks) % tasks.size()] = std::move(task);
+            ++num_tasks;
+        }
+        cv.notify_one();
+        return true;
+    }
+
+    auto num_threads() const { return threads.size(); }
+
+    void work_loop() {
+        while(true) {
+            std::function< void() > task;
+            {
+                std::unique_lock lock(mutex);
+                cv.wait(lock, [this] { return stopping || num_tasks > 0; });
+                if(stopping) return;
+                task = std::move(tasks[first_task]);
+                tasks[first_task] = nullptr;
+                first_task = (first_task + 1) % tasks.size();
+                --num_tasks;
+            }
+            task();
+        }
+    }
+};
+
+} // namespace chess
+
+#endif